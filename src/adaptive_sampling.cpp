@@ -0,0 +1,70 @@
+#include "adaptive_sampling.h"
+#include "utils.h"
+
+static inline f32 luminance(v4f colour)
+{
+    return 0.2126f*colour.r + 0.7152f*colour.g + 0.0722f*colour.b;
+}
+
+static inline void add_sample(PixelEstimate* estimate, v4f colour)
+{
+    ++estimate->count;
+    
+    // NOTE: alpha is averaged along with the colour, but it's left out of the error
+    for (u32 c = 0; c < 4; ++c)
+    {
+        f32 diff = colour.e[c] - estimate->mean.e[c];
+        estimate->mean.e[c] += diff/estimate->count;
+        estimate->sumSquaredDiffs.e[c] += diff*(colour.e[c] - estimate->mean.e[c]);
+    }
+}
+
+static inline f32 estimate_error(PixelEstimate* estimate)
+{
+    if (estimate->count < 2)
+        return F32_MAX;
+    
+    f32 error = 0.0f;
+    for (u32 c = 0; c < 3; ++c)
+    {
+        f32 variance = estimate->sumSquaredDiffs.e[c]/(estimate->count - 1);
+        f32 standardError = (f32)sqrt(variance/estimate->count);
+        
+        // NOTE: the image is written out with gamma 2, and the slope of sqrt(x) is 1/(2*sqrt(x)), so the same error
+        // stands out more in dark pixels. The floor keeps pure black pixels from needing an error of 0.
+        f32 mean = MAX_VALUE(estimate->mean.e[c], 0.001f);
+        error = MAX_VALUE(error, standardError/(2.0f*(f32)sqrt(mean)));
+    }
+    
+    return error;
+}
+
+static inline bool has_converged(PixelEstimate* estimate, AdaptiveSettings* settings)
+{
+    if (settings->errorThreshold <= 0.0f || estimate->count < settings->minSamples)
+        return false;
+    
+    return estimate_error(estimate) <= settings->errorThreshold;
+}
+
+static void write_sample_heatmap(char* fileName, PixelEstimate* pixels, u32 width, u32 height, u32 minSamples, u32 maxSamples)
+{
+    Image heatmap = {};
+    heatmap.width = width;
+    heatmap.height = height;
+    heatmap.pixels = (v4f*)memory_alloc(sizeof(v4f)*width*height);
+    
+    f32 range = (f32)MAX_VALUE(maxSamples - minSamples, 1);
+    
+    for (u32 i = 0; i < width*height; ++i)
+    {
+        f32 ratio = clamp((pixels[i].count - (f32)minSamples)/range, 0.0f, 1.0f);
+        
+        // blue through green to red
+        v4f colour = ratio < 0.5f ? v4f(0.0f, 2.0f*ratio, 1.0f - 2.0f*ratio) : v4f(2.0f*ratio - 1.0f, 2.0f - 2.0f*ratio, 0.0f);
+        heatmap.pixels[i] = colour;
+    }
+    
+    write_image_to_bmp(fileName, &heatmap);
+    memory_free(heatmap.pixels);
+}
\ No newline at end of file
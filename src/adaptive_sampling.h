@@ -0,0 +1,46 @@
+#ifndef ADAPTIVE_SAMPLING_H
+#define ADAPTIVE_SAMPLING_H
+
+#include "types.h"
+#include "image.h"
+
+// every pixel gets at least this many samples before its error estimate is trusted
+#define ADAPTIVE_MIN_SAMPLES 16
+
+// how close to its true value a pixel has to be before it stops taking samples, see estimate_error
+#define ADAPTIVE_ERROR_THRESHOLD 0.01f
+
+// Instead of every pixel getting the same number of samples, each pixel keeps taking them until its error estimate
+// drops below errorThreshold, up to the usual samples per pixel. Flat areas like the sky stop early, and the samples
+// go to the noisy pixels instead.
+struct AdaptiveSettings
+{
+    // 0 turns adaptive sampling off
+    f32 errorThreshold;
+    u32 minSamples;
+};
+
+// The running mean and variance of the brightness of a pixel's samples, kept with Welford's algorithm so it can be
+// updated one sample at a time without losing precision.
+struct PixelEstimate
+{
+    u32 count;
+    v4f mean;
+    v4f sumSquaredDiffs;
+};
+
+static inline f32 luminance(v4f colour);
+
+static inline void add_sample(PixelEstimate* estimate, v4f colour);
+
+// The standard error of the pixel's mean brightness, scaled to how big it looks once the image is gamma corrected
+// for display. A threshold of 0.01 is about 2.5 levels out of 255.
+static inline f32 estimate_error(PixelEstimate* estimate);
+
+// true if the pixel doesn't need any more samples, which is never the case when adaptive sampling is off
+static inline bool has_converged(PixelEstimate* estimate, AdaptiveSettings* settings);
+
+// writes an image of how many samples each pixel took, from blue for minSamples up to red for maxSamples
+static void write_sample_heatmap(char* fileName, PixelEstimate* pixels, u32 width, u32 height, u32 minSamples, u32 maxSamples);
+
+#endif //ADAPTIVE_SAMPLING_H
@@ -0,0 +1,89 @@
+#include "alias_table.h"
+
+static AliasTable build_alias_table(f32* weights, u32 count)
+{
+    assert(count > 0);
+    
+    AliasTable result = {};
+    result.count = count;
+    result.thresholds = (f32*)memory_alloc(count*sizeof(f32));
+    result.aliases = (u32*)memory_alloc(count*sizeof(u32));
+    result.probabilities = (f32*)memory_alloc(count*sizeof(f32));
+    
+    // NOTE: summed in f64, a big table of small weights would lose most of them in f32
+    f64 totalWeight = 0.0;
+    for (u32 i = 0; i < count; ++i)
+        totalWeight += weights[i];
+    
+    result.totalWeight = (f32)totalWeight;
+    
+    for (u32 i = 0; i < count; ++i)
+        result.probabilities[i] = totalWeight > 0.0 ? (f32)(weights[i]/totalWeight) : 1.0f/count;
+    
+    // each slot's weight scaled so the average is 1, the slots under 1 are filled up with part of a slot over 1
+    f64* scaled = (f64*)memory_alloc(count*sizeof(f64));
+    u32* small = (u32*)memory_alloc(count*sizeof(u32));
+    u32* large = (u32*)memory_alloc(count*sizeof(u32));
+    u32 smallCount = 0;
+    u32 largeCount = 0;
+    
+    for (u32 i = 0; i < count; ++i)
+    {
+        scaled[i] = (f64)result.probabilities[i]*count;
+        if (scaled[i] < 1.0)
+            small[smallCount++] = i;
+        else
+            large[largeCount++] = i;
+    }
+    
+    while (smallCount > 0 && largeCount > 0)
+    {
+        u32 smallIndex = small[--smallCount];
+        u32 largeIndex = large[--largeCount];
+        
+        result.thresholds[smallIndex] = (f32)scaled[smallIndex];
+        result.aliases[smallIndex] = largeIndex;
+        
+        // the large slot gives up what the small one was missing, and might end up small itself
+        scaled[largeIndex] -= 1.0 - scaled[smallIndex];
+        if (scaled[largeIndex] < 1.0)
+            small[smallCount++] = largeIndex;
+        else
+            large[largeCount++] = largeIndex;
+    }
+    
+    // NOTE: whatever's left is 1 give or take rounding, so it keeps its own choice
+    while (largeCount > 0)
+    {
+        u32 index = large[--largeCount];
+        result.thresholds[index] = 1.0f;
+        result.aliases[index] = index;
+    }
+    
+    while (smallCount > 0)
+    {
+        u32 index = small[--smallCount];
+        result.thresholds[index] = 1.0f;
+        result.aliases[index] = index;
+    }
+    
+    memory_free(scaled);
+    memory_free(small);
+    memory_free(large);
+    
+    return result;
+}
+
+static inline u32 sample_alias_table(AliasTable* table, f32 slotSample, f32 coinSample)
+{
+    u32 slot = MIN_VALUE((u32)(slotSample*table->count), table->count - 1);
+    return coinSample < table->thresholds[slot] ? slot : table->aliases[slot];
+}
+
+static void free_alias_table(AliasTable* table)
+{
+    memory_free(table->thresholds);
+    memory_free(table->aliases);
+    memory_free(table->probabilities);
+    *table = {};
+}
\ No newline at end of file
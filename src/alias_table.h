@@ -0,0 +1,32 @@
+#ifndef ALIAS_TABLE_H
+#define ALIAS_TABLE_H
+
+#include "types.h"
+
+// Picks one of a fixed set of choices in proportion to their weights in O(1), with Vose's alias method. Every slot
+// is equally likely to be landed on, and then either keeps its own choice or hands over to its alias, with the
+// thresholds set so that each choice comes out with its share of the total weight.
+struct AliasTable
+{
+    u32 count;
+    
+    // the chance that landing on a slot picks its own choice instead of its alias
+    f32* thresholds;
+    u32* aliases;
+    
+    // each choice's share of the total weight, the chance of it being picked
+    f32* probabilities;
+    
+    f32 totalWeight;
+};
+
+// Builds a table for picking from count choices with the given weights, none of which can be negative. If they're
+// all 0 every choice is equally likely.
+static AliasTable build_alias_table(f32* weights, u32 count);
+
+// Picks a choice, with slotSample in [0, 1) picking the slot and coinSample in [0, 1) whether it hands over to its alias.
+static inline u32 sample_alias_table(AliasTable* table, f32 slotSample, f32 coinSample);
+
+static void free_alias_table(AliasTable* table);
+
+#endif //ALIAS_TABLE_H
@@ -4,7 +4,7 @@ set DEBUG=0
 
 pushd ..\build
 
-set flags=/nologo /D_CRT_SECURE_NO_WARNINGS /Gm- /GR- /EHa- /Zi /FC /W4 /WX /wd4201 /wd4505
+set flags=/nologo /D_CRT_SECURE_NO_WARNINGS /Gm- /GR- /EHa- /Zi /FC /W4 /WX /wd4201 /wd4505 /arch:AVX2
 set linker_flags=/incremental:no
 
 if %DEBUG% == 1 (
@@ -0,0 +1,1077 @@
+#include "bvh.h"
+#include "utils.h"
+
+// a box in min/max form, which is much cheaper to grow than a Rect3f while building
+struct BVHBounds
+{
+    v3f min;
+    v3f max;
+};
+
+// everything the builders need to know about an object, gathered up front so that building
+// never has to touch the objects themselves
+struct BVHPrimitive
+{
+    BVHBounds bounds;
+    v3f centroid;
+    u32 objectIndex;
+};
+
+// a subtree handed off to the thread pool, once built its root is written to outNode
+struct BVHBuildTask
+{
+    struct BVHBuilder* builder;
+    
+    u32 startIndex;
+    u32 endIndex;
+    
+    // how many interior nodes are above the subtree's root
+    u32 depth;
+    
+    BVHNode** outNode;
+};
+
+struct BVHBuilder
+{
+    BVHPrimitive* primitives;
+    
+    // NOTE: nodes are handed out from the block with an atomic increment, so build threads can share it
+    BVHNode* nodes;
+    volatile LONG nodeCount;
+    
+    BVHBuildSettings* settings;
+    
+    // only set up when building with more than one thread
+    TP_CALLBACK_ENVIRON* threadEnvironment;
+    
+    BVHBuildTask* tasks;
+    volatile LONG taskCount;
+    u32 maxTaskCount;
+    
+    // the number of subtrees still being built, the event is signalled once this reaches 0
+    volatile LONG pendingTasks;
+    HANDLE tasksFinished;
+};
+
+/*
+* Build Settings
+*/
+
+BVHBuildSettings BVHBuildSettings::median_split(f32 startTime, f32 endTime)
+{
+    BVHBuildSettings result = {};
+    result.method = BVHBuildSettings::Method::MEDIAN_SPLIT;
+    result.maxLeafSize = 1;
+    result.binCount = 0;
+    result.traversalCost = 1.0f;
+    result.threadCount = 1;
+    result.startTime = startTime;
+    result.endTime = endTime;
+    result.maxRefitCostGrowth = 1.5f;
+    return result;
+}
+
+BVHBuildSettings BVHBuildSettings::binned_sah(f32 startTime, f32 endTime)
+{
+    BVHBuildSettings result = {};
+    result.method = BVHBuildSettings::Method::BINNED_SAH;
+    result.maxLeafSize = SPHERE_BATCH_SIZE;
+    result.binCount = 16;
+    result.traversalCost = 1.0f;
+    result.threadCount = 1;
+    result.startTime = startTime;
+    result.endTime = endTime;
+    result.maxRefitCostGrowth = 1.5f;
+    return result;
+}
+
+/*
+* Building
+*/
+
+// bounds that contain nothing, so growing them by any box gives that box
+static inline BVHBounds empty_bounds()
+{
+    BVHBounds result;
+    result.min = v3f(F32_MAX, F32_MAX, F32_MAX);
+    result.max = v3f(F32_MIN, F32_MIN, F32_MIN);
+    return result;
+}
+
+static inline void grow_bounds(BVHBounds* bounds, BVHBounds* other)
+{
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+        bounds->min.e[axis] = MIN_VALUE(bounds->min.e[axis], other->min.e[axis]);
+        bounds->max.e[axis] = MAX_VALUE(bounds->max.e[axis], other->max.e[axis]);
+    }
+}
+
+static inline f32 surface_area(BVHBounds* bounds)
+{
+    v3f size = bounds->max - bounds->min;
+    return 2.0f*(size.x*size.y + size.x*size.z + size.y*size.z);
+}
+
+static BVHNode* new_node(BVHBuilder* builder)
+{
+    u32 nodeIndex = (u32)InterlockedIncrement(&builder->nodeCount) - 1;
+    
+    BVHNode* result = builder->nodes + nodeIndex;
+    *result = {};
+    return result;
+}
+
+static BVHNode* new_leaf_node(BVHBuilder* builder, u32 startIndex, u32 endIndex, BVHBounds* bounds)
+{
+    BVHNode* result = new_node(builder);
+    result->boundingBox = Rect3f::from_bounds(bounds->min, bounds->max);
+    result->firstObject = startIndex;
+    result->objectCount = endIndex - startIndex;
+    return result;
+}
+
+// Rearranges the list between startIndex and endIndex so the primitive at nthIndex is the one that would be
+// there if the list was sorted along sortAxis, with nothing greater before it and nothing smaller after it.
+static void select_bvh_primitive(BVHPrimitive* list, u32 startIndex, u32 endIndex, u32 nthIndex, u32 sortAxis)
+{
+    assert(list);
+    assert(sortAxis < 3);
+    assert(startIndex <= nthIndex && nthIndex < endIndex);
+    
+    while (endIndex - startIndex > 1)
+    {
+        // NOTE: picking the median of the first, middle and last element keeps already sorted lists, like
+        // the ones generate_random_sphere_grid makes, from taking quadratic time
+        f32 first = list[startIndex].centroid[sortAxis];
+        f32 middle = list[startIndex + (endIndex - startIndex)/2].centroid[sortAxis];
+        f32 last = list[endIndex - 1].centroid[sortAxis];
+        
+        f32 pivot = MAX_VALUE(MIN_VALUE(first, middle), MIN_VALUE(MAX_VALUE(first, middle), last));
+        
+        // split the list into three parts, less than, equal to, and greater than the pivot, so that runs
+        // of primitives in the same position don't slow things down either
+        u32 lessEnd = startIndex;
+        u32 greaterStart = endIndex;
+        u32 index = startIndex;
+        while (index < greaterStart)
+        {
+            f32 value = list[index].centroid[sortAxis];
+            
+            if (value < pivot)
+            {
+                SWAP(list[index], list[lessEnd], BVHPrimitive);
+                ++lessEnd;
+                ++index;
+            }
+            else if (value > pivot)
+            {
+                --greaterStart;
+                SWAP(list[index], list[greaterStart], BVHPrimitive);
+            }
+            else
+                ++index;
+        }
+        
+        if (nthIndex < lessEnd)
+            endIndex = lessEnd;
+        else if (nthIndex >= greaterStart)
+            startIndex = greaterStart;
+        else
+            break;
+    }
+}
+
+// NOTE: halving the objects at every level keeps this tree at most 32 deep, well within BVH_MAX_STACK_SIZE
+static BVHNode* build_median_split_node(BVHBuilder* builder, u32 startIndex, u32 endIndex)
+{
+    BVHPrimitive* primitives = builder->primitives;
+    
+    if (endIndex - startIndex == 1)
+        return new_leaf_node(builder, startIndex, endIndex, &primitives[startIndex].bounds);
+    
+    u32 sortAxis = random_u32(0, 3);
+    u32 midIndex = (startIndex + endIndex)/2;
+    
+    // NOTE: the halves don't need to be sorted themselves, only split around the median
+    select_bvh_primitive(primitives, startIndex, endIndex, midIndex, sortAxis);
+    
+    BVHNode* leftNode = build_median_split_node(builder, startIndex, midIndex);
+    BVHNode* rightNode = build_median_split_node(builder, midIndex, endIndex);
+    
+    BVHNode* result = new_node(builder);
+    result->boundingBox = bounding_box(leftNode->boundingBox, rightNode->boundingBox);
+    result->left = leftNode;
+    result->right = rightNode;
+    return result;
+}
+
+// Leaves test their spheres a batch at a time, so a leaf costs one intersection test for each batch it takes rather
+// than for each sphere, and a full batch is no dearer than a single sphere.
+static inline f32 sah_leaf_cost(u32 objectCount)
+{
+    return (f32)((objectCount + SPHERE_BATCH_SIZE - 1)/SPHERE_BATCH_SIZE);
+}
+
+struct SAHBin
+{
+    BVHBounds bounds;
+    u32 count;
+};
+
+// which bin a centroid falls into along the given axis
+static inline u32 sah_bin_index(f32 centroid, f32 axisMin, f32 binScale, u32 binCount)
+{
+    u32 index = (u32)((centroid - axisMin)*binScale);
+    return MIN_VALUE(index, binCount - 1);
+}
+
+static void build_binned_sah_child(BVHBuilder* builder, u32 startIndex, u32 endIndex, u32 depth, BVHNode** outNode);
+
+static BVHNode* build_binned_sah_node(BVHBuilder* builder, u32 startIndex, u32 endIndex, u32 depth)
+{
+    BVHPrimitive* primitives = builder->primitives;
+    BVHBuildSettings* settings = builder->settings;
+    
+    u32 count = endIndex - startIndex;
+    
+    BVHBounds nodeBounds = primitives[startIndex].bounds;
+    v3f centroidMin = primitives[startIndex].centroid;
+    v3f centroidMax = primitives[startIndex].centroid;
+    
+    for (u32 i = startIndex + 1; i < endIndex; ++i)
+    {
+        grow_bounds(&nodeBounds, &primitives[i].bounds);
+        
+        for (u32 axis = 0; axis < 3; ++axis)
+        {
+            centroidMin.e[axis] = MIN_VALUE(centroidMin.e[axis], primitives[i].centroid[axis]);
+            centroidMax.e[axis] = MAX_VALUE(centroidMax.e[axis], primitives[i].centroid[axis]);
+        }
+    }
+    
+    // NOTE: lopsided splits can make the tree as deep as it has objects, which the traversal stacks can't hold, so
+    // anything still left this deep goes in one leaf however many objects it has
+    if (count == 1 || depth >= BVH_MAX_STACK_SIZE)
+        return new_leaf_node(builder, startIndex, endIndex, &nodeBounds);
+    
+    // NOTE: the cost of leaving the node as a leaf is testing every object in it, and all costs are
+    // in units of a single intersection test
+    f32 leafCost = sah_leaf_cost(count);
+    f32 nodeArea = surface_area(&nodeBounds);
+    
+    f32 bestCost = F32_MAX;
+    u32 bestAxis = 0;
+    u32 bestSplit = 0;
+    
+    SAHBin bins[64];
+    f32 rightAreas[64];
+    u32 binCount = MIN_VALUE(settings->binCount, (u32)ARRAY_LENGTH(bins));
+    assert(binCount >= 2);
+    
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+        f32 axisMin = centroidMin[axis];
+        f32 axisExtent = centroidMax[axis] - axisMin;
+        
+        // every centroid is in the same place along this axis, so there is nothing to split
+        if (axisExtent <= 0.0f)
+            continue;
+        
+        f32 binScale = binCount/axisExtent;
+        
+        for (u32 i = 0; i < binCount; ++i)
+        {
+            bins[i].bounds = empty_bounds();
+            bins[i].count = 0;
+        }
+        
+        for (u32 i = startIndex; i < endIndex; ++i)
+        {
+            u32 binIndex = sah_bin_index(primitives[i].centroid[axis], axisMin, binScale, binCount);
+            
+            grow_bounds(&bins[binIndex].bounds, &primitives[i].bounds);
+            ++bins[binIndex].count;
+        }
+        
+        // sweep from the right to find the area of everything right of each split plane...
+        BVHBounds rightBounds = empty_bounds();
+        u32 rightCount = 0;
+        for (u32 i = binCount - 1; i > 0; --i)
+        {
+            if (bins[i].count > 0)
+            {
+                grow_bounds(&rightBounds, &bins[i].bounds);
+                rightCount += bins[i].count;
+            }
+            
+            rightAreas[i] = rightCount > 0 ? surface_area(&rightBounds) : 0.0f;
+        }
+        
+        // ...then sweep from the left, where each split plane sits between bin (split - 1) and bin split
+        BVHBounds leftBounds = empty_bounds();
+        u32 leftCount = 0;
+        for (u32 split = 1; split < binCount; ++split)
+        {
+            SAHBin* bin = bins + split - 1;
+            if (bin->count > 0)
+            {
+                grow_bounds(&leftBounds, &bin->bounds);
+                leftCount += bin->count;
+            }
+            
+            rightCount = count - leftCount;
+            if (leftCount == 0 || rightCount == 0)
+                continue;
+            
+            f32 cost = settings->traversalCost + (sah_leaf_cost(leftCount)*surface_area(&leftBounds) + sah_leaf_cost(rightCount)*rightAreas[split])/nodeArea;
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = split;
+            }
+        }
+    }
+    
+    u32 midIndex = 0;
+    
+    if (bestSplit == 0)
+    {
+        // all the centroids are in the same spot, so any split is as good as another
+        if (count <= settings->maxLeafSize)
+            return new_leaf_node(builder, startIndex, endIndex, &nodeBounds);
+        
+        midIndex = (startIndex + endIndex)/2;
+    }
+    else
+    {
+        if (bestCost >= leafCost && count <= settings->maxLeafSize)
+            return new_leaf_node(builder, startIndex, endIndex, &nodeBounds);
+        
+        // partition the primitives in place around the chosen split plane
+        f32 axisMin = centroidMin[bestAxis];
+        f32 binScale = binCount/(centroidMax[bestAxis] - axisMin);
+        
+        midIndex = startIndex;
+        for (u32 i = startIndex; i < endIndex; ++i)
+        {
+            if (sah_bin_index(primitives[i].centroid[bestAxis], axisMin, binScale, binCount) < bestSplit)
+            {
+                SWAP(primitives[i], primitives[midIndex], BVHPrimitive);
+                ++midIndex;
+            }
+        }
+        
+        assert(midIndex > startIndex && midIndex < endIndex);
+    }
+    
+    // the box of the node is already known, so the children can be attached whenever they finish building
+    BVHNode* result = new_node(builder);
+    result->boundingBox = Rect3f::from_bounds(nodeBounds.min, nodeBounds.max);
+    
+    build_binned_sah_child(builder, startIndex, midIndex, depth + 1, &result->left);
+    build_binned_sah_child(builder, midIndex, endIndex, depth + 1, &result->right);
+    
+    return result;
+}
+
+static void build_bvh_task(TP_CALLBACK_INSTANCE* instance, void* data)
+{
+    UNREFERENCED_PARAMETER(instance);
+    
+    BVHBuildTask* task = (BVHBuildTask*)data;
+    BVHBuilder* builder = task->builder;
+    
+    *task->outNode = build_binned_sah_node(builder, task->startIndex, task->endIndex, task->depth);
+    
+    if (InterlockedDecrement(&builder->pendingTasks) == 0)
+        SetEvent(builder->tasksFinished);
+}
+
+static void build_binned_sah_child(BVHBuilder* builder, u32 startIndex, u32 endIndex, u32 depth, BVHNode** outNode)
+{
+    u32 taskIndex = builder->maxTaskCount;
+    if (builder->threadEnvironment && endIndex - startIndex >= BVH_PARALLEL_BUILD_MIN_OBJECTS)
+        taskIndex = (u32)InterlockedIncrement(&builder->taskCount) - 1;
+    
+    // NOTE: lopsided splits can leave more large subtrees than the tasks were sized for, those are built right here
+    if (taskIndex < builder->maxTaskCount)
+    {
+        BVHBuildTask* task = builder->tasks + taskIndex;
+        task->builder = builder;
+        task->startIndex = startIndex;
+        task->endIndex = endIndex;
+        task->depth = depth;
+        task->outNode = outNode;
+        
+        // NOTE: the task that submits this one is still pending, so the count can't reach 0 before this
+        InterlockedIncrement(&builder->pendingTasks);
+        
+        BOOL submitted = TrySubmitThreadpoolCallback(build_bvh_task, task, builder->threadEnvironment);
+        assert(submitted);
+        UNREFERENCED_PARAMETER(submitted);
+    }
+    else
+        *outNode = build_binned_sah_node(builder, startIndex, endIndex, depth);
+}
+
+// builds the tree over the primitives, which get reordered and then freed
+static BVH build_bvh_from_primitives(BVHPrimitive* primitives, u32 objectCount, BVHBuildSettings* settings)
+{
+    BVH result = {};
+    result.objectCount = objectCount;
+    result.settings = *settings;
+    
+    BVHBuilder builder = {};
+    builder.settings = &result.settings;
+    builder.primitives = primitives;
+    
+    // a binary tree with one object per leaf is the largest tree any of the builders can make
+    builder.nodes = (BVHNode*)memory_alloc((2*objectCount - 1)*sizeof(BVHNode));
+    
+    if (settings->method == BVHBuildSettings::Method::BINNED_SAH && settings->threadCount > 1)
+    {
+        // large subtrees are built as separate tasks on a thread pool, while this thread builds the top of the tree
+        TP_POOL* threadPool = CreateThreadpool(0);
+        assert(threadPool);
+        
+        SetThreadpoolThreadMinimum(threadPool, settings->threadCount);
+        SetThreadpoolThreadMaximum(threadPool, settings->threadCount);
+        
+        TP_CALLBACK_ENVIRON threadEnvironment;
+        InitializeThreadpoolEnvironment(&threadEnvironment);
+        SetThreadpoolCallbackPool(&threadEnvironment, threadPool);
+        
+        builder.threadEnvironment = &threadEnvironment;
+        // enough tasks for a balanced tree, build_binned_sah_child copes with running out
+        builder.maxTaskCount = 2*(objectCount/BVH_PARALLEL_BUILD_MIN_OBJECTS) + 1;
+        builder.tasks = (BVHBuildTask*)memory_alloc(builder.maxTaskCount*sizeof(BVHBuildTask));
+        builder.tasksFinished = CreateEvent(0, TRUE, FALSE, 0);
+        
+        // this thread counts as a pending task until it's done with its part of the tree
+        builder.pendingTasks = 1;
+        
+        result.root = build_binned_sah_node(&builder, 0, objectCount, 0);
+        
+        if (InterlockedDecrement(&builder.pendingTasks) == 0)
+            SetEvent(builder.tasksFinished);
+        
+        WaitForSingleObject(builder.tasksFinished, INFINITE);
+        
+        CloseHandle(builder.tasksFinished);
+        memory_free(builder.tasks);
+        
+        DestroyThreadpoolEnvironment(&threadEnvironment);
+        CloseThreadpool(threadPool);
+    }
+    else if (settings->method == BVHBuildSettings::Method::BINNED_SAH)
+        result.root = build_binned_sah_node(&builder, 0, objectCount, 0);
+    else
+        result.root = build_median_split_node(&builder, 0, objectCount);
+    
+    result.nodes = builder.nodes;
+    result.nodeCount = (u32)builder.nodeCount;
+    
+    result.objectIndices = (u32*)memory_alloc(objectCount*sizeof(u32));
+    for (u32 i = 0; i < objectCount; ++i)
+        result.objectIndices[i] = builder.primitives[i].objectIndex;
+    
+    memory_free(builder.primitives);
+    
+    return result;
+}
+
+static void init_bvh_primitive(BVHPrimitive* primitive, Rect3f box, u32 objectIndex)
+{
+    primitive->bounds.min = v3f(box.left(), box.bottom(), box.back());
+    primitive->bounds.max = v3f(box.right(), box.top(), box.front());
+    primitive->centroid = box.pos;
+    primitive->objectIndex = objectIndex;
+}
+
+BVH build_bvh(SphereObject* objects, u32 objectCount, BVHBuildSettings* settings)
+{
+    assert(objects);
+    assert(settings);
+    assert(objectCount > 0);
+    
+    BVHPrimitive* primitives = (BVHPrimitive*)memory_alloc(objectCount*sizeof(BVHPrimitive));
+    for (u32 i = 0; i < objectCount; ++i)
+        init_bvh_primitive(primitives + i, objects[i].get_bounding_box(settings->startTime, settings->endTime), i);
+    
+    BVH result = build_bvh_from_primitives(primitives, objectCount, settings);
+    result.objects = objects;
+    return result;
+}
+
+BVH build_bvh(Rect3f* boxes, u32 boxCount, BVHBuildSettings* settings)
+{
+    assert(boxes);
+    assert(settings);
+    assert(boxCount > 0);
+    
+    BVHPrimitive* primitives = (BVHPrimitive*)memory_alloc(boxCount*sizeof(BVHPrimitive));
+    for (u32 i = 0; i < boxCount; ++i)
+        init_bvh_primitive(primitives + i, boxes[i], i);
+    
+    return build_bvh_from_primitives(primitives, boxCount, settings);
+}
+
+void free_bvh(BVH* bvh)
+{
+    memory_free(bvh->nodes);
+    memory_free(bvh->objectIndices);
+    *bvh = {};
+}
+
+/*
+* Refitting
+*/
+
+// a subtree handed off to the thread pool while refitting
+struct BVHRefitTask
+{
+    struct BVHRefitter* refitter;
+    BVHNode* node;
+    
+    // the subtree's share of the SAH cost, before dividing by the area of the root
+    f32 weightedArea;
+};
+
+struct BVHRefitter
+{
+    BVH* bvh;
+    
+    // subtrees starting this deep in the tree are refit as separate tasks, everything above them afterwards
+    u32 taskDepth;
+    
+    BVHRefitTask* tasks;
+    u32 taskCount;
+    
+    volatile LONG pendingTasks;
+    HANDLE tasksFinished;
+};
+
+// Refits every node under node bottom-up, leaving the subtrees at stopDepth alone. Returns the sum of the refit
+// nodes' areas, each weighted by the cost of visiting the node.
+static f32 refit_bvh_node(BVH* bvh, BVHNode* node, u32 depth, u32 stopDepth)
+{
+    if (depth == stopDepth)
+        return 0.0f;
+    
+    BVHBuildSettings* settings = &bvh->settings;
+    f32 result = 0.0f;
+    
+    if (!node->left)
+    {
+        Rect3f box = bvh->objects[bvh->objectIndices[node->firstObject]].get_bounding_box(settings->startTime, settings->endTime);
+        for (u32 i = 1; i < node->objectCount; ++i)
+        {
+            SphereObject* object = bvh->objects + bvh->objectIndices[node->firstObject + i];
+            box = bounding_box(box, object->get_bounding_box(settings->startTime, settings->endTime));
+        }
+        
+        node->boundingBox = box;
+        result = surface_area(box)*sah_leaf_cost(node->objectCount);
+    }
+    else
+    {
+        result += refit_bvh_node(bvh, node->left, depth + 1, stopDepth);
+        result += refit_bvh_node(bvh, node->right, depth + 1, stopDepth);
+        
+        node->boundingBox = bounding_box(node->left->boundingBox, node->right->boundingBox);
+        result += surface_area(node->boundingBox)*settings->traversalCost;
+    }
+    
+    return result;
+}
+
+static void refit_bvh_task(TP_CALLBACK_INSTANCE* instance, void* data)
+{
+    UNREFERENCED_PARAMETER(instance);
+    
+    BVHRefitTask* task = (BVHRefitTask*)data;
+    BVHRefitter* refitter = task->refitter;
+    
+    task->weightedArea = refit_bvh_node(refitter->bvh, task->node, 0, 0xFFFFFFFF);
+    
+    if (InterlockedDecrement(&refitter->pendingTasks) == 0)
+        SetEvent(refitter->tasksFinished);
+}
+
+// makes a task for every node at the refitter's task depth
+static void gather_bvh_refit_tasks(BVHRefitter* refitter, BVHNode* node, u32 depth)
+{
+    if (depth == refitter->taskDepth)
+    {
+        BVHRefitTask* task = refitter->tasks + refitter->taskCount++;
+        task->refitter = refitter;
+        task->node = node;
+        task->weightedArea = 0.0f;
+    }
+    else if (node->left)
+    {
+        gather_bvh_refit_tasks(refitter, node->left, depth + 1);
+        gather_bvh_refit_tasks(refitter, node->right, depth + 1);
+    }
+}
+
+f32 refit_bvh(BVH* bvh, f32 startTime, f32 endTime)
+{
+    assert(bvh && bvh->root);
+    assert(startTime <= endTime);
+    
+    bvh->settings.startTime = startTime;
+    bvh->settings.endTime = endTime;
+    
+    f32 weightedArea = 0.0f;
+    
+    if (bvh->settings.threadCount > 1 && bvh->objectCount >= BVH_PARALLEL_REFIT_MIN_OBJECTS)
+    {
+        BVHRefitter refitter = {};
+        refitter.bvh = bvh;
+        
+        // cut the tree deep enough to give every thread a few subtrees, so uneven ones still balance out
+        while ((1u << refitter.taskDepth) < 4*bvh->settings.threadCount)
+            ++refitter.taskDepth;
+        
+        refitter.tasks = (BVHRefitTask*)memory_alloc((1 << refitter.taskDepth)*sizeof(BVHRefitTask));
+        gather_bvh_refit_tasks(&refitter, bvh->root, 0);
+        
+        if (refitter.taskCount > 0)
+        {
+            TP_POOL* threadPool = CreateThreadpool(0);
+            assert(threadPool);
+            
+            SetThreadpoolThreadMinimum(threadPool, bvh->settings.threadCount);
+            SetThreadpoolThreadMaximum(threadPool, bvh->settings.threadCount);
+            
+            TP_CALLBACK_ENVIRON threadEnvironment;
+            InitializeThreadpoolEnvironment(&threadEnvironment);
+            SetThreadpoolCallbackPool(&threadEnvironment, threadPool);
+            
+            refitter.tasksFinished = CreateEvent(0, TRUE, FALSE, 0);
+            refitter.pendingTasks = (LONG)refitter.taskCount;
+            
+            for (u32 i = 0; i < refitter.taskCount; ++i)
+            {
+                BOOL submitted = TrySubmitThreadpoolCallback(refit_bvh_task, refitter.tasks + i, &threadEnvironment);
+                assert(submitted);
+                UNREFERENCED_PARAMETER(submitted);
+            }
+            
+            WaitForSingleObject(refitter.tasksFinished, INFINITE);
+            
+            CloseHandle(refitter.tasksFinished);
+            DestroyThreadpoolEnvironment(&threadEnvironment);
+            CloseThreadpool(threadPool);
+        }
+        
+        // NOTE: summing in task order rather than as tasks finish keeps the cost the same from run to run
+        for (u32 i = 0; i < refitter.taskCount; ++i)
+            weightedArea += refitter.tasks[i].weightedArea;
+        
+        // the top of the tree can only be refit once all the subtrees under it are
+        weightedArea += refit_bvh_node(bvh, bvh->root, 0, refitter.taskDepth);
+        
+        memory_free(refitter.tasks);
+    }
+    else
+        weightedArea = refit_bvh_node(bvh, bvh->root, 0, 0xFFFFFFFF);
+    
+    return weightedArea/surface_area(bvh->root->boundingBox);
+}
+
+/*
+* Build Report
+*/
+
+static void gather_bvh_stats(BVHNode* node, u32 depth, f32 rootArea, f32 traversalCost, BVHStats* stats, u64* leafDepthSum)
+{
+    ++stats->nodeCount;
+    stats->maxDepth = MAX_VALUE(stats->maxDepth, depth);
+    
+    f32 areaRatio = surface_area(node->boundingBox)/rootArea;
+    
+    if (!node->left)
+    {
+        ++stats->leafCount;
+        *leafDepthSum += depth;
+        
+        stats->sahCost += areaRatio*sah_leaf_cost(node->objectCount);
+        ++stats->leafSizeHistogram[MIN_VALUE(node->objectCount, BVH_LEAF_HISTOGRAM_SIZE)];
+    }
+    else
+    {
+        stats->sahCost += areaRatio*traversalCost;
+        
+        gather_bvh_stats(node->left, depth + 1, rootArea, traversalCost, stats, leafDepthSum);
+        gather_bvh_stats(node->right, depth + 1, rootArea, traversalCost, stats, leafDepthSum);
+    }
+}
+
+BVHStats compute_bvh_stats(BVH* bvh)
+{
+    assert(bvh && bvh->root);
+    
+    BVHStats result = {};
+    u64 leafDepthSum = 0;
+    
+    gather_bvh_stats(bvh->root, 0, surface_area(bvh->root->boundingBox), bvh->settings.traversalCost, &result, &leafDepthSum);
+    
+    result.averageLeafDepth = (f32)leafDepthSum/result.leafCount;
+    
+    return result;
+}
+
+void print_bvh_stats(BVHStats* stats)
+{
+    printf("BVH SAH cost: %.2f\n", stats->sahCost);
+    printf("BVH nodes: %u (%u leaves)\n", stats->nodeCount, stats->leafCount);
+    printf("BVH depth: %u max, %.2f average leaf depth\n", stats->maxDepth, stats->averageLeafDepth);
+    
+    printf("BVH leaf sizes:");
+    for (u32 i = 1; i <= BVH_LEAF_HISTOGRAM_SIZE; ++i)
+    {
+        if (stats->leafSizeHistogram[i] == 0)
+            continue;
+        
+        if (i == BVH_LEAF_HISTOGRAM_SIZE)
+            printf(" [%u+]: %u", i, stats->leafSizeHistogram[i]);
+        else
+            printf(" [%u]: %u", i, stats->leafSizeHistogram[i]);
+    }
+    printf("\n");
+}
+
+/*
+* Flattening
+*/
+
+static u32 flatten_bvh_node(BVHNode* node, LinearBVHNode* nodes, u32* nextIndex)
+{
+    u32 nodeIndex = (*nextIndex)++;
+    LinearBVHNode* linearNode = nodes + nodeIndex;
+    
+    Rect3f box = node->boundingBox;
+    linearNode->boundsMin = v3f(box.left(), box.bottom(), box.back());
+    linearNode->boundsMax = v3f(box.right(), box.top(), box.front());
+    
+    if (!node->left)
+    {
+        linearNode->firstObject = node->firstObject;
+        linearNode->objectCount = node->objectCount;
+    }
+    else
+    {
+        // the left child is always stored directly after its parent, so only the right one needs an offset
+        flatten_bvh_node(node->left, nodes, nextIndex);
+        linearNode->rightChild = flatten_bvh_node(node->right, nodes, nextIndex);
+        linearNode->objectCount = 0;
+    }
+    
+    return nodeIndex;
+}
+
+LinearBVH flatten_bvh(BVH* bvh)
+{
+    assert(bvh && bvh->root);
+    
+    LinearBVH result = {};
+    result.objects = bvh->objects;
+    result.objectCount = bvh->objectCount;
+    
+    // NOTE: memory_alloc hands out whole pages, so the nodes always start on a cache line boundary
+    result.nodes = (LinearBVHNode*)memory_alloc(bvh->nodeCount*sizeof(LinearBVHNode));
+    
+    u32 nextIndex = 0;
+    flatten_bvh_node(bvh->root, result.nodes, &nextIndex);
+    result.nodeCount = nextIndex;
+    assert(result.nodeCount == bvh->nodeCount);
+    
+    result.objectIndices = (u32*)memory_alloc(bvh->objectCount*sizeof(u32));
+    for (u32 i = 0; i < bvh->objectCount; ++i)
+        result.objectIndices[i] = bvh->objectIndices[i];
+    
+    result.spheres = copy_leaf_spheres(bvh->objects, bvh->objectIndices, bvh->objectCount);
+    
+    return result;
+}
+
+void free_linear_bvh(LinearBVH* bvh)
+{
+    memory_free(bvh->nodes);
+    memory_free(bvh->objectIndices);
+    free_sphere_arrays(&bvh->spheres);
+    *bvh = {};
+}
+
+SphereArrays copy_leaf_spheres(SphereObject* objects, u32* objectIndices, u32 objectCount)
+{
+    SphereArrays result = {};
+    
+    if (!objects)
+        return result;
+    
+    // NOTE: memory_alloc clears the memory, so the padding past the last sphere is all zero sized spheres
+    void* data = memory_alloc(sphere_arrays_size(objectCount));
+    point_sphere_arrays(&result, data, objectCount);
+    
+    for (u32 i = 0; i < objectCount; ++i)
+    {
+        SphereObject* object = objects + objectIndices[i];
+        
+        for (u32 axis = 0; axis < 3; ++axis)
+        {
+            result.pos[axis][i] = object->sphere.pos.e[axis];
+            result.velocity[axis][i] = object->velocity.e[axis];
+        }
+        
+        result.radius[i] = object->sphere.radius;
+        
+        if (object->velocity.x != 0.0f || object->velocity.y != 0.0f || object->velocity.z != 0.0f)
+            result.moving = true;
+    }
+    
+    return result;
+}
+
+void free_sphere_arrays(SphereArrays* spheres)
+{
+    // all the arrays share the allocation the first one starts
+    if (spheres->pos[0])
+        memory_free(spheres->pos[0]);
+    
+    *spheres = {};
+}
+
+/*
+* Traversal
+*/
+
+// slab test against a node's box, only counting hits that enter the box before tMax
+static inline bool hit_test(v3f origin, v3f inverseDir, LinearBVHNode* node, f32 tMax, f32* outTEntry)
+{
+    f32 tx0 = (node->boundsMin.x - origin.x)*inverseDir.x;
+    f32 tx1 = (node->boundsMax.x - origin.x)*inverseDir.x;
+    f32 ty0 = (node->boundsMin.y - origin.y)*inverseDir.y;
+    f32 ty1 = (node->boundsMax.y - origin.y)*inverseDir.y;
+    f32 tz0 = (node->boundsMin.z - origin.z)*inverseDir.z;
+    f32 tz1 = (node->boundsMax.z - origin.z)*inverseDir.z;
+    
+    f32 tEntry = MAX_VALUE(MAX_VALUE(MIN_VALUE(tx0, tx1), MIN_VALUE(ty0, ty1)), MAX_VALUE(MIN_VALUE(tz0, tz1), 0.0f));
+    f32 tExit = MIN_VALUE(MIN_VALUE(MAX_VALUE(tx0, tx1), MAX_VALUE(ty0, ty1)), MIN_VALUE(MAX_VALUE(tz0, tz1), tMax));
+    
+    *outTEntry = tEntry;
+    return tEntry <= tExit;
+}
+
+static inline void intersect_leaf(Ray ray, SphereObject* objects, u32* objectIndices, SphereArrays* spheres, u32 firstObject, u32 objectCount,
+                                  f32 time, f32* tClosest, SphereObject** outObject)
+{
+    const f32 MIN_T = 0.001f;
+    
+    if (spheres)
+    {
+        for (u32 batchStart = firstObject; batchStart < firstObject + objectCount; batchStart += SPHERE_BATCH_SIZE)
+        {
+            u32 batchCount = MIN_VALUE(firstObject + objectCount - batchStart, SPHERE_BATCH_SIZE);
+            COUNT_SPHERE_BATCH(spheres, batchStart, batchCount);
+            
+            // NOTE: this branch goes the same way for every leaf of a tree, so it's practically free
+            u32 hitIndex = spheres->moving ? intersection_test<true>(ray, spheres, batchStart, batchCount, time, MIN_T, tClosest)
+                                           : intersection_test<false>(ray, spheres, batchStart, batchCount, time, MIN_T, tClosest);
+            if (hitIndex != SPHERE_BATCH_MISS)
+                *outObject = objects + objectIndices[hitIndex];
+        }
+        
+        return;
+    }
+    
+    for (u32 i = 0; i < objectCount; ++i)
+    {
+        SphereObject* object = objects + objectIndices[firstObject + i];
+        COUNT_OBJECT_TEST(object);
+        
+        Sphere testSphere = object->sphere;
+        testSphere.pos += time*object->velocity;
+        
+        f32 t = intersection_test(ray, testSphere);
+        if (t > MIN_T && t < *tClosest)
+        {
+            *tClosest = t;
+            *outObject = object;
+        }
+    }
+}
+
+static f32 intersection_test(Ray ray, LinearBVH* bvh, f32 time, f32 tMax, SphereObject** outObject)
+{
+    struct StackEntry
+    {
+        u32 nodeIndex;
+        f32 tEntry;
+    };
+    
+    StackEntry stack[BVH_MAX_STACK_SIZE];
+    u32 stackSize = 0;
+    
+    f32 tClosest = tMax;
+    v3f inverseDir = v3f(1.0f/ray.dir.x, 1.0f/ray.dir.y, 1.0f/ray.dir.z);
+    
+    COUNT_TRAVERSAL_RAY();
+    
+    f32 tRoot = 0.0f;
+    if (!hit_test(ray.origin, inverseDir, bvh->nodes, tClosest, &tRoot))
+        return F32_MAX;
+    
+    u32 nodeIndex = 0;
+    
+    for (;;)
+    {
+        LinearBVHNode* node = bvh->nodes + nodeIndex;
+        COUNT_NODE_VISIT(node);
+        
+        if (node->objectCount > 0) // reached a leaf node
+            intersect_leaf(ray, bvh->objects, bvh->objectIndices, &bvh->spheres, node->firstObject, node->objectCount, time, &tClosest, outObject);
+        else
+        {
+            u32 leftIndex = nodeIndex + 1;
+            u32 rightIndex = node->rightChild;
+            
+            f32 tLeft = 0.0f;
+            f32 tRight = 0.0f;
+            bool hitLeft = hit_test(ray.origin, inverseDir, bvh->nodes + leftIndex, tClosest, &tLeft);
+            bool hitRight = hit_test(ray.origin, inverseDir, bvh->nodes + rightIndex, tClosest, &tRight);
+            
+            if (hitLeft && hitRight)
+            {
+                // visit the nearer child first, the farther one can often be skipped once we know what is closest
+                assert(stackSize < ARRAY_LENGTH(stack));
+                
+                if (tLeft <= tRight)
+                {
+                    stack[stackSize++] = {rightIndex, tRight};
+                    nodeIndex = leftIndex;
+                }
+                else
+                {
+                    stack[stackSize++] = {leftIndex, tLeft};
+                    nodeIndex = rightIndex;
+                }
+                
+                continue;
+            }
+            else if (hitLeft)
+            {
+                nodeIndex = leftIndex;
+                continue;
+            }
+            else if (hitRight)
+            {
+                nodeIndex = rightIndex;
+                continue;
+            }
+        }
+        
+        // pop the next subtree, skipping any that start past the closest hit we've found since pushing it
+        bool foundNode = false;
+        while (stackSize > 0 && !foundNode)
+        {
+            StackEntry entry = stack[--stackSize];
+            if (entry.tEntry < tClosest)
+            {
+                nodeIndex = entry.nodeIndex;
+                foundNode = true;
+            }
+        }
+        
+        if (!foundNode)
+            break;
+    }
+    
+    return tClosest < tMax ? tClosest : F32_MAX;
+}
+
+static inline bool occluded_leaf(Ray ray, SphereObject* objects, u32* objectIndices, SphereArrays* spheres, u32 firstObject, u32 objectCount,
+                                 f32 time, f32 tMax)
+{
+    const f32 MIN_T = 0.001f;
+    
+    if (spheres)
+    {
+        for (u32 batchStart = firstObject; batchStart < firstObject + objectCount; batchStart += SPHERE_BATCH_SIZE)
+        {
+            u32 batchCount = MIN_VALUE(firstObject + objectCount - batchStart, SPHERE_BATCH_SIZE);
+            COUNT_SPHERE_BATCH(spheres, batchStart, batchCount);
+            
+            f32 tClosest = tMax;
+            u32 hitIndex = spheres->moving ? intersection_test<true>(ray, spheres, batchStart, batchCount, time, MIN_T, &tClosest)
+                                           : intersection_test<false>(ray, spheres, batchStart, batchCount, time, MIN_T, &tClosest);
+            if (hitIndex != SPHERE_BATCH_MISS)
+                return true;
+        }
+        
+        return false;
+    }
+    
+    for (u32 i = 0; i < objectCount; ++i)
+    {
+        SphereObject* object = objects + objectIndices[firstObject + i];
+        COUNT_OBJECT_TEST(object);
+        
+        Sphere testSphere = object->sphere;
+        testSphere.pos += time*object->velocity;
+        
+        f32 t = intersection_test(ray, testSphere);
+        if (t > MIN_T && t < tMax)
+            return true;
+    }
+    
+    return false;
+}
+
+static bool occlusion_test(Ray ray, LinearBVH* bvh, f32 time, f32 tMax)
+{
+    // NOTE: each node visited leaves at most one child behind on the stack
+    u32 stack[BVH_MAX_STACK_SIZE + 1];
+    u32 stackSize = 0;
+    
+    v3f inverseDir = v3f(1.0f/ray.dir.x, 1.0f/ray.dir.y, 1.0f/ray.dir.z);
+    
+    COUNT_TRAVERSAL_RAY();
+    
+    f32 tEntry = 0.0f;
+    if (!hit_test(ray.origin, inverseDir, bvh->nodes, tMax, &tEntry))
+        return false;
+    
+    stack[stackSize++] = 0;
+    
+    while (stackSize > 0)
+    {
+        u32 nodeIndex = stack[--stackSize];
+        LinearBVHNode* node = bvh->nodes + nodeIndex;
+        COUNT_NODE_VISIT(node);
+        
+        if (node->objectCount > 0)
+        {
+            if (occluded_leaf(ray, bvh->objects, bvh->objectIndices, &bvh->spheres, node->firstObject, node->objectCount, time, tMax))
+                return true;
+            
+            continue;
+        }
+        
+        u32 leftIndex = nodeIndex + 1;
+        u32 rightIndex = node->rightChild;
+        
+        if (hit_test(ray.origin, inverseDir, bvh->nodes + rightIndex, tMax, &tEntry))
+            stack[stackSize++] = rightIndex;
+        if (hit_test(ray.origin, inverseDir, bvh->nodes + leftIndex, tMax, &tEntry))
+            stack[stackSize++] = leftIndex;
+        
+        assert(stackSize <= ARRAY_LENGTH(stack));
+    }
+    
+    return false;
+}
\ No newline at end of file
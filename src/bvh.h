@@ -0,0 +1,169 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "types.h"
+#include "geometry.h"
+#include "traversal_stats.h"
+
+// deepest a tree can be while still being traversable, every interior node on the way down can push one entry, so
+// the builders make a leaf of whatever is left once they get this deep
+#define BVH_MAX_STACK_SIZE 64
+
+// subtrees with fewer objects than this are built on the thread that reached them, instead of as a new task
+#define BVH_PARALLEL_BUILD_MIN_OBJECTS 4096
+
+// trees with fewer objects than this are refit on the calling thread, since refitting is too cheap to be worth splitting up
+#define BVH_PARALLEL_REFIT_MIN_OBJECTS 65536
+
+// leaves can be any size, but the build report only gives each size up to this its own bucket
+#define BVH_LEAF_HISTOGRAM_SIZE 16
+
+struct BVHBuildSettings
+{
+    enum Method
+    {
+        MEDIAN_SPLIT, // sort along a random axis and split at the median object, one object per leaf
+        BINNED_SAH // split where the surface area heuristic estimates the cheapest traversal
+    };
+    
+    Method method;
+    
+    // the SAH builder will stop splitting once a node holds this many objects or less and splitting
+    // wouldn't make traversal any cheaper
+    u32 maxLeafSize;
+    
+    // number of buckets the object centroids are sorted into when evaluating split positions
+    u32 binCount;
+    
+    // cost of visiting an interior node, relative to the cost of testing a leaf's batch of spheres
+    f32 traversalCost;
+    
+    // number of threads the SAH builder can spread the build across, the median split builder is always single threaded
+    u32 threadCount;
+    
+    // the interval that the bounding boxes need to cover for moving objects
+    f32 startTime;
+    f32 endTime;
+    
+    // a refit tree is rebuilt from scratch once its SAH cost grows past this multiple of its cost when it was built
+    f32 maxRefitCostGrowth;
+    
+    static BVHBuildSettings median_split(f32 startTime = 0.0f, f32 endTime = 0.0f);
+    static BVHBuildSettings binned_sah(f32 startTime = 0.0f, f32 endTime = 0.0f);
+};
+
+struct BVHNode
+{
+    Rect3f boundingBox;
+    
+    // only valid in the leaf nodes, the range of BVH::objectIndices that the leaf holds
+    u32 firstObject;
+    u32 objectCount;
+    
+    BVHNode* left;
+    BVHNode* right;
+};
+
+struct BVH
+{
+    BVHNode* root;
+    
+    // all nodes are allocated as a single block
+    BVHNode* nodes;
+    u32 nodeCount;
+    
+    // the objects the tree was built from, and the order they appear in the leaves
+    SphereObject* objects;
+    u32* objectIndices;
+    u32 objectCount;
+    
+    BVHBuildSettings settings;
+};
+
+// A node of the flattened tree. Nodes are stored depth-first, so the left child of an interior node
+// always directly follows it and only the right child needs an index. Each node is 32 bytes, so two nodes
+// share a 64 byte cache line, and a parent and its left child are usually fetched together.
+struct alignas(32) LinearBVHNode
+{
+    v3f boundsMin;
+    v3f boundsMax;
+    
+    union
+    {
+        u32 firstObject; // leaf nodes, index into LinearBVH::objectIndices
+        u32 rightChild; // interior nodes, index into LinearBVH::nodes
+    };
+    
+    u32 objectCount; // 0 for interior nodes
+};
+
+// the pointer-free form of a BVH that is used for rendering
+struct LinearBVH
+{
+    LinearBVHNode* nodes;
+    u32 nodeCount;
+    
+    SphereObject* objects;
+    u32* objectIndices;
+    u32 objectCount;
+    
+    // the objects' spheres in the same order as objectIndices, so a leaf's spheres sit side by side
+    SphereArrays spheres;
+};
+
+// a summary of the quality of a built tree, mostly useful for comparing build methods
+struct BVHStats
+{
+    // expected cost of tracing a ray through the tree, in units of sphere batch tests
+    f32 sahCost;
+    
+    u32 nodeCount;
+    u32 leafCount;
+    
+    u32 maxDepth;
+    f32 averageLeafDepth;
+    
+    // number of leaves holding each object count, the last bucket collects every larger leaf
+    u32 leafSizeHistogram[BVH_LEAF_HISTOGRAM_SIZE + 1];
+};
+
+BVH build_bvh(SphereObject* objects, u32 objectCount, BVHBuildSettings* settings);
+
+// builds a tree over any set of boxes, where the tree has no objects and its object indices are indices into boxes
+BVH build_bvh(Rect3f* boxes, u32 boxCount, BVHBuildSettings* settings);
+void free_bvh(BVH* bvh);
+
+BVHStats compute_bvh_stats(BVH* bvh);
+void print_bvh_stats(BVHStats* stats);
+
+// Updates the box of every node in place so the tree covers where its objects are over a new interval, without
+// changing its structure. Returns the SAH cost of the refit tree, which grows as the objects drift away from
+// where the tree was built for them.
+f32 refit_bvh(BVH* bvh, f32 startTime, f32 endTime);
+
+LinearBVH flatten_bvh(BVH* bvh);
+void free_linear_bvh(LinearBVH* bvh);
+
+// Copies the spheres of the objects out into arrays, in the order objectIndices lists them, for the flattened layouts to
+// test their leaves against. A tree built over boxes has no objects, and gets no spheres.
+SphereArrays copy_leaf_spheres(SphereObject* objects, u32* objectIndices, u32 objectCount);
+void free_sphere_arrays(SphereArrays* spheres);
+
+// Tests every object in a leaf, updating tClosest and outObject if any of them are hit closer than tClosest. When
+// spheres is given the leaf's spheres are read from it a batch at a time, otherwise from the objects one by one.
+static inline void intersect_leaf(Ray ray, SphereObject* objects, u32* objectIndices, SphereArrays* spheres, u32 firstObject, u32 objectCount,
+                                  f32 time, f32* tClosest, SphereObject** outObject);
+
+// returns the distance to the closest object hit before tMax, or F32_MAX if nothing was hit
+static f32 intersection_test(Ray ray, LinearBVH* bvh, f32 time, f32 tMax, SphereObject** outObject);
+
+// true if any object in a leaf is hit before tMax, read the same way as in intersect_leaf
+static inline bool occluded_leaf(Ray ray, SphereObject* objects, u32* objectIndices, SphereArrays* spheres, u32 firstObject, u32 objectCount,
+                                 f32 time, f32 tMax);
+
+// Returns true if the ray hits any object before tMax, for shadow rays, which only need to know whether something is
+// in the way. The traversal stops at the first hit it finds instead of looking for the closest one, so it doesn't
+// bother visiting the nearer child first either.
+static bool occlusion_test(Ray ray, LinearBVH* bvh, f32 time, f32 tMax);
+
+#endif //BVH_H
@@ -0,0 +1,337 @@
+#include "bvh_cache.h"
+
+#define BVH_CACHE_MAGIC 'CHVB'
+
+/*
+* Hashing
+*/
+
+// 64 bit FNV-1a, which is plenty for telling scenes apart and needs no tables
+static u64 hash_bytes(u64 hash, void* data, u32 size)
+{
+    u8* bytes = (u8*)data;
+    
+    for (u32 i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ull;
+    }
+    
+    return hash;
+}
+
+static u64 hash_u32(u64 hash, u32 value)
+{
+    return hash_bytes(hash, &value, sizeof(value));
+}
+
+static u64 hash_f32(u64 hash, f32 value)
+{
+    return hash_bytes(hash, &value, sizeof(value));
+}
+
+u64 hash_scene_bvh(World* world, BVHBuildSettings* settings, SceneBVH::Layout layout)
+{
+    assert(world);
+    assert(settings);
+    
+    u64 hash = 0xCBF29CE484222325ull;
+    
+    hash = hash_u32(hash, BVH_CACHE_VERSION);
+    hash = hash_u32(hash, (u32)layout);
+    
+    // NOTE: the thread count is left out on purpose, the tree comes out the same however many threads build it
+    hash = hash_u32(hash, (u32)settings->method);
+    hash = hash_u32(hash, settings->maxLeafSize);
+    hash = hash_u32(hash, settings->binCount);
+    hash = hash_f32(hash, settings->traversalCost);
+    hash = hash_f32(hash, settings->startTime);
+    hash = hash_f32(hash, settings->endTime);
+    
+    hash = hash_u32(hash, world->objectCount);
+    for (u32 i = 0; i < world->objectCount; ++i)
+    {
+        SphereObject* object = world->objects + i;
+        
+        // hashing each value on its own keeps any padding in the structs out of the hash
+        for (u32 axis = 0; axis < 3; ++axis)
+        {
+            hash = hash_f32(hash, object->sphere.pos.e[axis]);
+            hash = hash_f32(hash, object->velocity.e[axis]);
+        }
+        hash = hash_f32(hash, object->sphere.radius);
+    }
+    
+    return hash;
+}
+
+/*
+* Cache Files
+*/
+
+static char* cache_file_name(char* cachePrefix, u64 sceneHash)
+{
+    u32 resultSize = string_length(cachePrefix) + 32;
+    char* result = (char*)memory_alloc(resultSize);
+    snprintf(result, resultSize, "%s%016llx.bvh", cachePrefix, (unsigned long long)sceneHash);
+    return result;
+}
+
+static inline u32 align_cache_offset(u32 offset)
+{
+    return (offset + BVH_CACHE_ALIGNMENT - 1) & ~(BVH_CACHE_ALIGNMENT - 1);
+}
+
+// the size of a node in each layout that can be cached, or 0 for the ones that can't
+static u32 cache_node_size(SceneBVH::Layout layout)
+{
+    u32 result = 0;
+    
+    switch (layout)
+    {
+        case SceneBVH::Layout::BINARY:
+            result = sizeof(LinearBVHNode);
+            break;
+        case SceneBVH::Layout::WIDE_4:
+            result = sizeof(WideBVHNode<4>);
+            break;
+        case SceneBVH::Layout::WIDE_8:
+            result = sizeof(WideBVHNode<8>);
+            break;
+        case SceneBVH::Layout::MOTION:
+            result = sizeof(MotionBVHNode);
+            break;
+        case SceneBVH::Layout::DYNAMIC:
+            // NOTE: dynamic BVHs are edited in place and have free lists, so there's nothing to gain from caching them
+            result = 0;
+            break;
+    }
+    
+    return result;
+}
+
+// all the cacheable layouts share the same names for their arrays, so one function can point any of them at a mapped file
+template <typename LayoutBVH>
+static void point_layout_at_cache(LayoutBVH* layoutBVH, u8* view, BVHCacheHeader* header, SphereObject* objects)
+{
+    layoutBVH->nodes = (decltype(layoutBVH->nodes))(view + header->nodesOffset);
+    layoutBVH->nodeCount = header->nodeCount;
+    layoutBVH->objects = objects;
+    layoutBVH->objectIndices = (u32*)(view + header->objectIndicesOffset);
+    layoutBVH->objectCount = header->objectCount;
+    point_sphere_arrays(&layoutBVH->spheres, view + header->spheresOffset, header->objectCount);
+    layoutBVH->spheres.moving = header->movingSpheres != 0;
+}
+
+template <typename LayoutBVH>
+static void get_layout_arrays(LayoutBVH* layoutBVH, void** outNodes, u32* outNodeCount, u32** outObjectIndices, void** outSpheres, u32* outMovingSpheres)
+{
+    *outNodes = layoutBVH->nodes;
+    *outNodeCount = layoutBVH->nodeCount;
+    *outObjectIndices = layoutBVH->objectIndices;
+    
+    // all the sphere arrays share one block, starting with the first
+    *outSpheres = layoutBVH->spheres.pos[0];
+    *outMovingSpheres = layoutBVH->spheres.moving ? 1 : 0;
+}
+
+bool load_cached_scene_bvh(char* cachePrefix, World* world, BVHBuildSettings* settings, SceneBVH::Layout layout,
+                           SceneBVH* outBVH, BVHStats* outStats)
+{
+    assert(world);
+    assert(settings);
+    assert(outBVH);
+    
+    u32 nodeSize = cache_node_size(layout);
+    if (nodeSize == 0 || world->objectCount == 0)
+        return false;
+    
+    u64 sceneHash = hash_scene_bvh(world, settings, layout);
+    char* fileName = cache_file_name(cachePrefix, sceneHash);
+    
+    HANDLE file = CreateFile(fileName, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    memory_free(fileName);
+    
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    
+    LARGE_INTEGER fileSize = {};
+    GetFileSizeEx(file, &fileSize);
+    
+    HANDLE mapping = 0;
+    u8* view = 0;
+    
+    if (fileSize.QuadPart >= (s64)sizeof(BVHCacheHeader))
+    {
+        mapping = CreateFileMapping(file, 0, PAGE_READONLY, 0, 0, 0);
+        if (mapping)
+            view = (u8*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+    
+    bool valid = false;
+    BVHCacheHeader* header = (BVHCacheHeader*)view;
+    
+    if (header)
+    {
+        // anything that doesn't match exactly gets rebuilt, including files from older versions of the renderer
+        valid = header->magic == BVH_CACHE_MAGIC &&
+                header->version == BVH_CACHE_VERSION &&
+                header->sceneHash == sceneHash &&
+                header->layout == (u32)layout &&
+                header->nodeSize == nodeSize &&
+                header->objectCount == world->objectCount &&
+                header->nodesOffset % BVH_CACHE_ALIGNMENT == 0 &&
+                (s64)header->nodesOffset + (s64)header->nodeCount*nodeSize <= fileSize.QuadPart &&
+                (s64)header->objectIndicesOffset + (s64)(header->objectCount*sizeof(u32)) <= fileSize.QuadPart &&
+                header->spheresOffset % BVH_CACHE_ALIGNMENT == 0 &&
+                (s64)header->spheresOffset + (s64)sphere_arrays_size(header->objectCount) <= fileSize.QuadPart;
+    }
+    
+    if (!valid)
+    {
+        if (view)
+            UnmapViewOfFile(view);
+        if (mapping)
+            CloseHandle(mapping);
+        CloseHandle(file);
+        
+        return false;
+    }
+    
+    SceneBVH result = {};
+    result.layout = layout;
+    result.objectCount = world->objectCount;
+    result.cacheView = view;
+    result.cacheFile = file;
+    result.cacheMapping = mapping;
+    result.builtCost = header->stats.sahCost;
+    result.cost = header->stats.sahCost;
+    
+    switch (layout)
+    {
+        case SceneBVH::Layout::BINARY:
+            point_layout_at_cache(&result.binary, view, header, world->objects);
+            break;
+        case SceneBVH::Layout::WIDE_4:
+            point_layout_at_cache(&result.wide4, view, header, world->objects);
+            break;
+        case SceneBVH::Layout::WIDE_8:
+            point_layout_at_cache(&result.wide8, view, header, world->objects);
+            break;
+        case SceneBVH::Layout::MOTION:
+            point_layout_at_cache(&result.motion, view, header, world->objects);
+            result.motion.startTime = header->startTime;
+            result.motion.endTime = header->endTime;
+            break;
+        case SceneBVH::Layout::DYNAMIC:
+            assert(!"dynamic BVHs are never cached");
+            break;
+    }
+    
+    // NOTE: instances are cheap to build and aren't part of the cache
+    result.instances = build_instance_bvh(world, settings);
+    
+    if (outStats)
+        *outStats = header->stats;
+    
+    *outBVH = result;
+    return true;
+}
+
+void save_cached_scene_bvh(char* cachePrefix, World* world, BVHBuildSettings* settings, SceneBVH* bvh, BVHStats* stats)
+{
+    assert(world);
+    assert(settings);
+    assert(bvh);
+    assert(stats);
+    
+    u32 nodeSize = cache_node_size(bvh->layout);
+    if (nodeSize == 0 || bvh->objectCount == 0)
+        return;
+    
+    BVHCacheHeader header = {};
+    header.magic = BVH_CACHE_MAGIC;
+    header.version = BVH_CACHE_VERSION;
+    header.sceneHash = hash_scene_bvh(world, settings, bvh->layout);
+    header.layout = (u32)bvh->layout;
+    header.nodeSize = nodeSize;
+    header.objectCount = bvh->objectCount;
+    header.startTime = settings->startTime;
+    header.endTime = settings->endTime;
+    header.stats = *stats;
+    
+    void* nodes = 0;
+    u32* objectIndices = 0;
+    void* spheres = 0;
+    
+    switch (bvh->layout)
+    {
+        case SceneBVH::Layout::BINARY:
+            get_layout_arrays(&bvh->binary, &nodes, &header.nodeCount, &objectIndices, &spheres, &header.movingSpheres);
+            break;
+        case SceneBVH::Layout::WIDE_4:
+            get_layout_arrays(&bvh->wide4, &nodes, &header.nodeCount, &objectIndices, &spheres, &header.movingSpheres);
+            break;
+        case SceneBVH::Layout::WIDE_8:
+            get_layout_arrays(&bvh->wide8, &nodes, &header.nodeCount, &objectIndices, &spheres, &header.movingSpheres);
+            break;
+        case SceneBVH::Layout::MOTION:
+            get_layout_arrays(&bvh->motion, &nodes, &header.nodeCount, &objectIndices, &spheres, &header.movingSpheres);
+            break;
+        case SceneBVH::Layout::DYNAMIC:
+            break;
+    }
+    
+    u32 nodesSize = header.nodeCount*nodeSize;
+    u32 objectIndicesSize = header.objectCount*sizeof(u32);
+    u32 spheresSize = sphere_arrays_size(header.objectCount);
+    
+    header.nodesOffset = align_cache_offset(sizeof(BVHCacheHeader));
+    header.objectIndicesOffset = align_cache_offset(header.nodesOffset + nodesSize);
+    header.spheresOffset = align_cache_offset(header.objectIndicesOffset + objectIndicesSize);
+    
+    char* fileName = cache_file_name(cachePrefix, header.sceneHash);
+    char* tempFileName = concat_strings(fileName, ".tmp");
+    
+    // NOTE: the file is written under a temporary name and then moved into place, so another process can never map
+    // a half written file, and a second process writing the same file at once just fails to open the temporary one
+    HANDLE file = CreateFile(tempFileName, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+    
+    if (file != INVALID_HANDLE_VALUE)
+    {
+        u8 padding[BVH_CACHE_ALIGNMENT] = {};
+        DWORD bytesWritten = 0;
+        u32 totalWritten = 0;
+        
+        WriteFile(file, &header, sizeof(header), &bytesWritten, 0);
+        totalWritten += bytesWritten;
+        WriteFile(file, padding, header.nodesOffset - totalWritten, &bytesWritten, 0);
+        totalWritten += bytesWritten;
+        
+        WriteFile(file, nodes, nodesSize, &bytesWritten, 0);
+        totalWritten += bytesWritten;
+        WriteFile(file, padding, header.objectIndicesOffset - totalWritten, &bytesWritten, 0);
+        totalWritten += bytesWritten;
+        
+        WriteFile(file, objectIndices, objectIndicesSize, &bytesWritten, 0);
+        totalWritten += bytesWritten;
+        WriteFile(file, padding, header.spheresOffset - totalWritten, &bytesWritten, 0);
+        totalWritten += bytesWritten;
+        
+        WriteFile(file, spheres, spheresSize, &bytesWritten, 0);
+        totalWritten += bytesWritten;
+        
+        CloseHandle(file);
+        
+        if (totalWritten == header.spheresOffset + spheresSize)
+            MoveFileEx(tempFileName, fileName, MOVEFILE_REPLACE_EXISTING);
+        else
+        {
+            printf("WARNING: Couldn't write the BVH cache file %s\n", fileName);
+            DeleteFile(tempFileName);
+        }
+    }
+    
+    memory_free(tempFileName);
+    memory_free(fileName);
+}
\ No newline at end of file
@@ -0,0 +1,57 @@
+#ifndef BVH_CACHE_H
+#define BVH_CACHE_H
+
+#include "types.h"
+#include "scene_bvh.h"
+
+// bump this whenever the file layout, any of the node structs or the trees the builders make change, so older cache
+// files are ignored
+#define BVH_CACHE_VERSION 4
+
+// every section of the file starts on a boundary this size, so the mapped nodes keep their alignment
+#define BVH_CACHE_ALIGNMENT 64
+
+// The start of a cache file. It's followed by the layout's nodes, its object indices and then its sphere arrays,
+// exactly as they are laid out in memory, so a mapped file can be traced against as is.
+struct BVHCacheHeader
+{
+    u32 magic;
+    u32 version;
+    
+    // hash of everything the BVH was built from, see hash_scene_bvh
+    u64 sceneHash;
+    
+    u32 layout;
+    u32 nodeSize;
+    u32 nodeCount;
+    u32 objectCount;
+    
+    // 1 if any of the spheres have a velocity, see SphereArrays::moving
+    u32 movingSpheres;
+    
+    // offsets from the start of the file
+    u32 nodesOffset;
+    u32 objectIndicesOffset;
+    u32 spheresOffset;
+    
+    // the interval the boxes cover, only the motion layout needs these
+    f32 startTime;
+    f32 endTime;
+    
+    // the build report for the tree the layout was made from
+    BVHStats stats;
+};
+
+// A hash of the world's spheres, the build settings and the layout, everything that decides what BVH gets built.
+// Materials are left out, since they don't change the tree.
+u64 hash_scene_bvh(World* world, BVHBuildSettings* settings, SceneBVH::Layout layout);
+
+// Maps the cache file for the world into memory and points outBVH's layout straight at it, without copying or fixing
+// up anything. Returns false if there is no cache file for this world, settings and layout, or it is out of date.
+bool load_cached_scene_bvh(char* cachePrefix, World* world, BVHBuildSettings* settings, SceneBVH::Layout layout,
+                           SceneBVH* outBVH, BVHStats* outStats = 0);
+
+// writes the BVH's layout out to the cache file for the world, so the next run can load it instead of building it
+void save_cached_scene_bvh(char* cachePrefix, World* world, BVHBuildSettings* settings, SceneBVH* bvh, BVHStats* stats);
+
+#endif //BVH_CACHE_H
@@ -1,5 +1,6 @@
 #include "camera.h"
 #include "geometry.h"
+#include "sampler.h"
 #include "utils.h"
 
 Camera::Camera()
@@ -54,7 +55,7 @@ void Camera::set_lens(f32 apertureSize, f32 focusPlaneDist)
     this->focusDistance = focusPlaneDist;
 }
 
-Ray Camera::get_ray(f32 u, f32 v)
+v3f Camera::image_plane_target(f32 u, f32 v, v3f* outHorizontal, v3f* outVertical)
 {
     v3f planePos = image_plane_pos();
     v2f planeDim = image_plane_dim();
@@ -69,11 +70,33 @@ Ray Camera::get_ray(f32 u, f32 v)
     v3f topLeft = planePos - horizontal*(planeDim.w/2.0f)*focusDistance + vertical*(planeDim.h/2.0f)*focusDistance;
     v3f rayTarget = topLeft + u*horizontal*planeDim.w*focusDistance - v*vertical*planeDim.h*focusDistance;
     
+    *outHorizontal = horizontal;
+    *outVertical = vertical;
+    return rayTarget;
+}
+
+Ray Camera::get_ray(f32 u, f32 v, Sampler* sampler)
+{
+    v3f horizontal = v3f();
+    v3f vertical = v3f();
+    v3f rayTarget = image_plane_target(u, v, &horizontal, &vertical);
+    
     // starting ray from a random point on the lens, if the aperture is set
     assert(lensRadius >= 0.0f);
-    v3f pointOnLens = random_point_in_unit_circle()*lensRadius;
+    v3f pointOnLens = random_point_in_unit_circle(sampler)*lensRadius;
     v3f lensOffset = pointOnLens.x*horizontal + pointOnLens.y*vertical;
     
     Ray result = Ray(pos + lensOffset, normalize(rayTarget - (pos + lensOffset)));
     return result;
+}
+
+Ray Camera::get_pinhole_ray(f32 u, f32 v)
+{
+    assert(lensRadius == 0.0f);
+    
+    v3f horizontal = v3f();
+    v3f vertical = v3f();
+    v3f rayTarget = image_plane_target(u, v, &horizontal, &vertical);
+    
+    return Ray(pos, normalize(rayTarget - pos));
 }
\ No newline at end of file
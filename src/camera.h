@@ -3,8 +3,9 @@
 
 #include "types.h"
 
-// forward declaration for return type
+// forward declarations for return and parameter types
 struct Ray;
+struct Sampler;
 
 struct Camera
 {
@@ -30,11 +31,19 @@ struct Camera
     void set_lens(f32 aperture, f32 focusDistance);
     
     // get ray from camera pos intersecting through (u, v) coords on image plane with origin in top-left
-    Ray get_ray(f32 u, f32 v);
+    Ray get_ray(f32 u, f32 v, Sampler* sampler);
+    
+    // the same ray get_ray gives when there's no aperture, without picking a point on the lens
+    Ray get_pinhole_ray(f32 u, f32 v);
+    
+    bool has_lens() { return lensRadius > 0.0f; }
     
     private:
     
     f32 lensRadius;
+    
+    // the point on the focus plane that (u, v) looks at, and the directions the image plane spans
+    v3f image_plane_target(f32 u, f32 v, v3f* outHorizontal, v3f* outVertical);
 };
 
 #endif //CAMERA_H
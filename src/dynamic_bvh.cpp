@@ -0,0 +1,611 @@
+#include "dynamic_bvh.h"
+
+/*
+* Nodes
+*/
+
+static inline BVHBounds dynamic_node_bounds(DynamicBVHNode* node)
+{
+    BVHBounds result;
+    result.min = node->boundsMin;
+    result.max = node->boundsMax;
+    return result;
+}
+
+static inline BVHBounds union_bounds(BVHBounds a, BVHBounds b)
+{
+    grow_bounds(&a, &b);
+    return a;
+}
+
+static inline f32 bounds_area(BVHBounds bounds)
+{
+    return surface_area(&bounds);
+}
+
+static inline bool is_leaf(DynamicBVHNode* node)
+{
+    return node->left == DYNAMIC_BVH_NULL_NODE;
+}
+
+static u32 allocate_dynamic_node(DynamicBVH* bvh)
+{
+    if (bvh->freeList == DYNAMIC_BVH_NULL_NODE)
+    {
+        u32 newCapacity = MAX_VALUE(bvh->nodeCapacity*2, 1024);
+        DynamicBVHNode* newNodes = (DynamicBVHNode*)memory_alloc(newCapacity*sizeof(DynamicBVHNode));
+        assert(newNodes);
+        
+        for (u32 i = 0; i < bvh->nodeCapacity; ++i)
+            newNodes[i] = bvh->nodes[i];
+        
+        // the new half of the array all goes on the free list
+        for (u32 i = bvh->nodeCapacity; i < newCapacity; ++i)
+            newNodes[i].parent = i + 1 < newCapacity ? i + 1 : DYNAMIC_BVH_NULL_NODE;
+        
+        if (bvh->nodes)
+            memory_free(bvh->nodes);
+        
+        bvh->freeList = bvh->nodeCapacity;
+        bvh->nodes = newNodes;
+        bvh->nodeCapacity = newCapacity;
+    }
+    
+    u32 result = bvh->freeList;
+    DynamicBVHNode* node = bvh->nodes + result;
+    bvh->freeList = node->parent;
+    
+    *node = {};
+    node->parent = DYNAMIC_BVH_NULL_NODE;
+    node->left = DYNAMIC_BVH_NULL_NODE;
+    node->right = DYNAMIC_BVH_NULL_NODE;
+    
+    return result;
+}
+
+static void free_dynamic_node(DynamicBVH* bvh, u32 nodeIndex)
+{
+    bvh->nodes[nodeIndex].parent = bvh->freeList;
+    bvh->freeList = nodeIndex;
+}
+
+static u32 make_dynamic_leaf(DynamicBVH* bvh, u32 objectIndex)
+{
+    u32 result = allocate_dynamic_node(bvh);
+    DynamicBVHNode* leaf = bvh->nodes + result;
+    
+    Rect3f box = bvh->objects[objectIndex].get_bounding_box(bvh->startTime, bvh->endTime);
+    leaf->boundsMin = v3f(box.left(), box.bottom(), box.back());
+    leaf->boundsMax = v3f(box.right(), box.top(), box.front());
+    leaf->objectIndex = objectIndex;
+    
+    assert(objectIndex < bvh->objectLeavesCapacity);
+    bvh->objectLeaves[objectIndex] = result;
+    
+    return result;
+}
+
+// recomputes a node's box and height from its children
+static void refit_dynamic_node(DynamicBVH* bvh, u32 nodeIndex)
+{
+    DynamicBVHNode* node = bvh->nodes + nodeIndex;
+    DynamicBVHNode* left = bvh->nodes + node->left;
+    DynamicBVHNode* right = bvh->nodes + node->right;
+    BVHBounds bounds = union_bounds(dynamic_node_bounds(left), dynamic_node_bounds(right));
+    
+    node->boundsMin = bounds.min;
+    node->boundsMax = bounds.max;
+    node->height = MAX_VALUE(left->height, right->height) + 1;
+}
+
+/*
+* Conversion
+*/
+
+// gives each object in the range its own leaf, under a balanced subtree
+static u32 convert_bvh_leaf(DynamicBVH* bvh, u32* objectIndices, u32 startIndex, u32 endIndex)
+{
+    if (endIndex - startIndex == 1)
+        return make_dynamic_leaf(bvh, objectIndices[startIndex]);
+    
+    u32 midIndex = (startIndex + endIndex)/2;
+    u32 left = convert_bvh_leaf(bvh, objectIndices, startIndex, midIndex);
+    u32 right = convert_bvh_leaf(bvh, objectIndices, midIndex, endIndex);
+    
+    u32 result = allocate_dynamic_node(bvh);
+    bvh->nodes[result].left = left;
+    bvh->nodes[result].right = right;
+    bvh->nodes[left].parent = result;
+    bvh->nodes[right].parent = result;
+    refit_dynamic_node(bvh, result);
+    
+    return result;
+}
+
+static u32 convert_bvh_node(DynamicBVH* bvh, BVH* tree, BVHNode* node)
+{
+    if (!node->left)
+        return convert_bvh_leaf(bvh, tree->objectIndices, node->firstObject, node->firstObject + node->objectCount);
+    
+    u32 left = convert_bvh_node(bvh, tree, node->left);
+    u32 right = convert_bvh_node(bvh, tree, node->right);
+    
+    u32 result = allocate_dynamic_node(bvh);
+    bvh->nodes[result].left = left;
+    bvh->nodes[result].right = right;
+    bvh->nodes[left].parent = result;
+    bvh->nodes[right].parent = result;
+    refit_dynamic_node(bvh, result);
+    
+    return result;
+}
+
+DynamicBVH make_dynamic_bvh(BVH* bvh)
+{
+    assert(bvh && bvh->root);
+    
+    DynamicBVH result = {};
+    result.root = DYNAMIC_BVH_NULL_NODE;
+    result.freeList = DYNAMIC_BVH_NULL_NODE;
+    result.objects = bvh->objects;
+    result.objectCount = bvh->objectCount;
+    result.startTime = bvh->settings.startTime;
+    result.endTime = bvh->settings.endTime;
+    
+    result.objectLeavesCapacity = MAX_VALUE(bvh->objectCount*2, 1024);
+    result.objectLeaves = (u32*)memory_alloc(result.objectLeavesCapacity*sizeof(u32));
+    
+    result.root = convert_bvh_node(&result, bvh, bvh->root);
+    
+    return result;
+}
+
+void free_dynamic_bvh(DynamicBVH* bvh)
+{
+    if (bvh->nodes)
+        memory_free(bvh->nodes);
+    if (bvh->objectLeaves)
+        memory_free(bvh->objectLeaves);
+    
+    *bvh = {};
+}
+
+/*
+* Editing
+*/
+
+// Tries swapping a child of nodeIndex with one of its grandchildren on the other side, keeping the swap that shrinks
+// the surface area of the rearranged child the most. The box of nodeIndex itself never changes.
+static void rotate_dynamic_node(DynamicBVH* bvh, u32 nodeIndex)
+{
+    DynamicBVHNode* node = bvh->nodes + nodeIndex;
+    
+    u32 children[2] = {node->left, node->right};
+    
+    f32 bestSaving = 0.0f;
+    u32 bestSide = 0;
+    u32 bestGrandchild = 0;
+    
+    for (u32 side = 0; side < 2; ++side)
+    {
+        // the child staying put, whose grandchildren are candidates for swapping with the other child
+        DynamicBVHNode* child = bvh->nodes + children[side];
+        if (is_leaf(child))
+            continue;
+        
+        BVHBounds otherBounds = dynamic_node_bounds(bvh->nodes + children[1 - side]);
+        u32 grandchildren[2] = {child->left, child->right};
+        f32 childArea = bounds_area(dynamic_node_bounds(child));
+        
+        for (u32 i = 0; i < 2; ++i)
+        {
+            // after the swap, the child holds the other child and whichever grandchild wasn't swapped out
+            BVHBounds rotated = union_bounds(otherBounds, dynamic_node_bounds(bvh->nodes + grandchildren[1 - i]));
+            f32 saving = childArea - bounds_area(rotated);
+            
+            if (saving > bestSaving)
+            {
+                bestSaving = saving;
+                bestSide = side;
+                bestGrandchild = i;
+            }
+        }
+    }
+    
+    if (bestSaving <= 0.0f)
+        return;
+    
+    u32 childIndex = children[bestSide];
+    u32 otherIndex = children[1 - bestSide];
+    DynamicBVHNode* child = bvh->nodes + childIndex;
+    
+    u32 grandchildIndex = bestGrandchild == 0 ? child->left : child->right;
+    
+    // the grandchild moves up to take the other child's place, and the other child moves down into the grandchild's
+    if (bestSide == 0)
+        node->right = grandchildIndex;
+    else
+        node->left = grandchildIndex;
+    
+    if (bestGrandchild == 0)
+        child->left = otherIndex;
+    else
+        child->right = otherIndex;
+    
+    bvh->nodes[grandchildIndex].parent = nodeIndex;
+    bvh->nodes[otherIndex].parent = childIndex;
+    
+    // NOTE: the node's box stays the same, but its height can change with the child's
+    refit_dynamic_node(bvh, childIndex);
+    refit_dynamic_node(bvh, nodeIndex);
+}
+
+// refits every node from nodeIndex up to the root, rotating each one to keep the tree in good shape
+static void refit_dynamic_ancestors(DynamicBVH* bvh, u32 nodeIndex)
+{
+    while (nodeIndex != DYNAMIC_BVH_NULL_NODE)
+    {
+        refit_dynamic_node(bvh, nodeIndex);
+        rotate_dynamic_node(bvh, nodeIndex);
+        
+        nodeIndex = bvh->nodes[nodeIndex].parent;
+    }
+}
+
+// Walks down the tree to the node that the new leaf should be paired with. At each node it compares the cost of pairing
+// the leaf with the node itself against the cheapest the cost could be after going down into either child, where the
+// cost is the surface area added to the tree, including what the nodes on the way down grow by.
+static u32 find_best_sibling(DynamicBVH* bvh, BVHBounds leafBounds)
+{
+    u32 nodeIndex = bvh->root;
+    
+    while (!is_leaf(bvh->nodes + nodeIndex))
+    {
+        DynamicBVHNode* node = bvh->nodes + nodeIndex;
+        
+        f32 area = bounds_area(dynamic_node_bounds(node));
+        f32 combinedArea = bounds_area(union_bounds(dynamic_node_bounds(node), leafBounds));
+        
+        // a new parent here would cover both, and every ancestor already grows to fit the leaf
+        f32 siblingCost = 2.0f*combinedArea;
+        f32 inheritedCost = 2.0f*(combinedArea - area);
+        
+        f32 childCosts[2];
+        u32 children[2] = {node->left, node->right};
+        
+        for (u32 i = 0; i < 2; ++i)
+        {
+            DynamicBVHNode* child = bvh->nodes + children[i];
+            f32 childCombinedArea = bounds_area(union_bounds(dynamic_node_bounds(child), leafBounds));
+            
+            if (is_leaf(child))
+                childCosts[i] = childCombinedArea + inheritedCost;
+            else
+                childCosts[i] = childCombinedArea - bounds_area(dynamic_node_bounds(child)) + inheritedCost;
+        }
+        
+        if (siblingCost < childCosts[0] && siblingCost < childCosts[1])
+            break;
+        
+        nodeIndex = childCosts[0] <= childCosts[1] ? children[0] : children[1];
+    }
+    
+    return nodeIndex;
+}
+
+// puts every interior node below nodeIndex, and nodeIndex itself, back on the free list, leaving the leaves alone
+static void free_dynamic_interior_nodes(DynamicBVH* bvh, u32 nodeIndex)
+{
+    DynamicBVHNode* node = bvh->nodes + nodeIndex;
+    if (is_leaf(node))
+        return;
+    
+    free_dynamic_interior_nodes(bvh, node->left);
+    free_dynamic_interior_nodes(bvh, node->right);
+    free_dynamic_node(bvh, nodeIndex);
+}
+
+// links the existing leaves back together with the shape of a tree built over them, where the tree's object indices
+// are the leaves' node indices
+static u32 relink_dynamic_node(DynamicBVH* bvh, BVH* tree, BVHNode* node)
+{
+    if (!node->left)
+        return tree->objectIndices[node->firstObject];
+    
+    u32 left = relink_dynamic_node(bvh, tree, node->left);
+    u32 right = relink_dynamic_node(bvh, tree, node->right);
+    
+    u32 result = allocate_dynamic_node(bvh);
+    bvh->nodes[result].left = left;
+    bvh->nodes[result].right = right;
+    bvh->nodes[left].parent = result;
+    bvh->nodes[right].parent = result;
+    refit_dynamic_node(bvh, result);
+    
+    return result;
+}
+
+// Swaps the tree for a balanced one when edits have made it too tall to traverse. The leaves are kept as they are,
+// boxes included, and only the interior is rebuilt, with a median split since that always halves the leaves.
+static void rebalance_dynamic_bvh(DynamicBVH* bvh)
+{
+    if (bvh->root == DYNAMIC_BVH_NULL_NODE || bvh->nodes[bvh->root].height <= DYNAMIC_BVH_MAX_HEIGHT)
+        return;
+    
+    u32 leafCount = bvh->objectCount;
+    BVHPrimitive* primitives = (BVHPrimitive*)memory_alloc(leafCount*sizeof(BVHPrimitive));
+    for (u32 i = 0; i < leafCount; ++i)
+    {
+        u32 leafIndex = bvh->objectLeaves[i];
+        BVHBounds bounds = dynamic_node_bounds(bvh->nodes + leafIndex);
+        
+        primitives[i].bounds = bounds;
+        primitives[i].centroid = 0.5f*(bounds.min + bounds.max);
+        primitives[i].objectIndex = leafIndex;
+    }
+    
+    free_dynamic_interior_nodes(bvh, bvh->root);
+    
+    BVHBuildSettings settings = BVHBuildSettings::median_split(bvh->startTime, bvh->endTime);
+    BVH tree = build_bvh_from_primitives(primitives, leafCount, &settings);
+    
+    bvh->root = relink_dynamic_node(bvh, &tree, tree.root);
+    bvh->nodes[bvh->root].parent = DYNAMIC_BVH_NULL_NODE;
+    
+    free_bvh(&tree);
+}
+
+void insert_dynamic_bvh_object(DynamicBVH* bvh, World* world, u32 objectIndex)
+{
+    assert(world);
+    assert(objectIndex < world->objectCount);
+    
+    bvh->objects = world->objects;
+    bvh->objectCount = world->objectCount;
+    
+    if (objectIndex >= bvh->objectLeavesCapacity)
+    {
+        u32 newCapacity = MAX_VALUE(bvh->objectLeavesCapacity*2, objectIndex + 1);
+        u32* newLeaves = (u32*)memory_alloc(newCapacity*sizeof(u32));
+        assert(newLeaves);
+        
+        for (u32 i = 0; i < bvh->objectLeavesCapacity; ++i)
+            newLeaves[i] = bvh->objectLeaves[i];
+        
+        if (bvh->objectLeaves)
+            memory_free(bvh->objectLeaves);
+        
+        bvh->objectLeaves = newLeaves;
+        bvh->objectLeavesCapacity = newCapacity;
+    }
+    
+    u32 leafIndex = make_dynamic_leaf(bvh, objectIndex);
+    
+    if (bvh->root == DYNAMIC_BVH_NULL_NODE)
+    {
+        bvh->root = leafIndex;
+        return;
+    }
+    
+    u32 siblingIndex = find_best_sibling(bvh, dynamic_node_bounds(bvh->nodes + leafIndex));
+    u32 oldParent = bvh->nodes[siblingIndex].parent;
+    
+    u32 newParent = allocate_dynamic_node(bvh);
+    bvh->nodes[newParent].parent = oldParent;
+    bvh->nodes[newParent].left = siblingIndex;
+    bvh->nodes[newParent].right = leafIndex;
+    bvh->nodes[siblingIndex].parent = newParent;
+    bvh->nodes[leafIndex].parent = newParent;
+    
+    if (oldParent == DYNAMIC_BVH_NULL_NODE)
+        bvh->root = newParent;
+    else if (bvh->nodes[oldParent].left == siblingIndex)
+        bvh->nodes[oldParent].left = newParent;
+    else
+        bvh->nodes[oldParent].right = newParent;
+    
+    refit_dynamic_ancestors(bvh, newParent);
+    rebalance_dynamic_bvh(bvh);
+}
+
+void remove_dynamic_bvh_object(DynamicBVH* bvh, World* world, u32 objectIndex)
+{
+    assert(world);
+    assert(objectIndex < world->objectCount);
+    
+    u32 leafIndex = bvh->objectLeaves[objectIndex];
+    u32 parentIndex = bvh->nodes[leafIndex].parent;
+    
+    if (parentIndex == DYNAMIC_BVH_NULL_NODE)
+        bvh->root = DYNAMIC_BVH_NULL_NODE;
+    else
+    {
+        // the leaf's sibling takes the place of their parent
+        DynamicBVHNode* parent = bvh->nodes + parentIndex;
+        u32 siblingIndex = parent->left == leafIndex ? parent->right : parent->left;
+        u32 grandparentIndex = parent->parent;
+        
+        bvh->nodes[siblingIndex].parent = grandparentIndex;
+        
+        if (grandparentIndex == DYNAMIC_BVH_NULL_NODE)
+            bvh->root = siblingIndex;
+        else
+        {
+            if (bvh->nodes[grandparentIndex].left == parentIndex)
+                bvh->nodes[grandparentIndex].left = siblingIndex;
+            else
+                bvh->nodes[grandparentIndex].right = siblingIndex;
+            
+            refit_dynamic_ancestors(bvh, grandparentIndex);
+        }
+        
+        free_dynamic_node(bvh, parentIndex);
+    }
+    
+    free_dynamic_node(bvh, leafIndex);
+    
+    // mirror World::remove_sphere moving the last object into the gap
+    u32 lastIndex = world->objectCount - 1;
+    if (objectIndex != lastIndex)
+    {
+        u32 lastLeaf = bvh->objectLeaves[lastIndex];
+        bvh->nodes[lastLeaf].objectIndex = objectIndex;
+        bvh->objectLeaves[objectIndex] = lastLeaf;
+    }
+    
+    bvh->objectCount = lastIndex;
+    rebalance_dynamic_bvh(bvh);
+}
+
+/*
+* Report
+*/
+
+static f32 dynamic_node_cost(DynamicBVH* bvh, u32 nodeIndex, f32 traversalCost)
+{
+    DynamicBVHNode* node = bvh->nodes + nodeIndex;
+    f32 area = bounds_area(dynamic_node_bounds(node));
+    
+    if (is_leaf(node))
+        return area*sah_leaf_cost(1);
+    
+    return area*traversalCost + dynamic_node_cost(bvh, node->left, traversalCost) + dynamic_node_cost(bvh, node->right, traversalCost);
+}
+
+f32 dynamic_bvh_cost(DynamicBVH* bvh, f32 traversalCost)
+{
+    if (bvh->root == DYNAMIC_BVH_NULL_NODE)
+        return 0.0f;
+    
+    return dynamic_node_cost(bvh, bvh->root, traversalCost)/bounds_area(dynamic_node_bounds(bvh->nodes + bvh->root));
+}
+
+/*
+* Traversal
+*/
+
+static inline bool hit_test(v3f origin, v3f inverseDir, DynamicBVHNode* node, f32 tMax, f32* outTEntry)
+{
+    f32 tx0 = (node->boundsMin.x - origin.x)*inverseDir.x;
+    f32 tx1 = (node->boundsMax.x - origin.x)*inverseDir.x;
+    f32 ty0 = (node->boundsMin.y - origin.y)*inverseDir.y;
+    f32 ty1 = (node->boundsMax.y - origin.y)*inverseDir.y;
+    f32 tz0 = (node->boundsMin.z - origin.z)*inverseDir.z;
+    f32 tz1 = (node->boundsMax.z - origin.z)*inverseDir.z;
+    
+    f32 tEntry = MAX_VALUE(MAX_VALUE(MIN_VALUE(tx0, tx1), MIN_VALUE(ty0, ty1)), MAX_VALUE(MIN_VALUE(tz0, tz1), 0.0f));
+    f32 tExit = MIN_VALUE(MIN_VALUE(MAX_VALUE(tx0, tx1), MAX_VALUE(ty0, ty1)), MIN_VALUE(MAX_VALUE(tz0, tz1), tMax));
+    
+    *outTEntry = tEntry;
+    return tEntry <= tExit;
+}
+
+static f32 intersection_test(Ray ray, DynamicBVH* bvh, f32 time, f32 tMax, SphereObject** outObject)
+{
+    struct StackEntry
+    {
+        u32 nodeIndex;
+        f32 tEntry;
+    };
+    
+    // NOTE: every node on the way down leaves at most its farther child behind, and the last one pushes both
+    StackEntry stack[DYNAMIC_BVH_MAX_HEIGHT + 1];
+    u32 stackSize = 0;
+    
+    if (bvh->root == DYNAMIC_BVH_NULL_NODE)
+        return F32_MAX;
+    
+    f32 tClosest = tMax;
+    v3f inverseDir = v3f(1.0f/ray.dir.x, 1.0f/ray.dir.y, 1.0f/ray.dir.z);
+    
+    COUNT_TRAVERSAL_RAY();
+    
+    f32 tRoot = 0.0f;
+    if (!hit_test(ray.origin, inverseDir, bvh->nodes + bvh->root, tClosest, &tRoot))
+        return F32_MAX;
+    
+    stack[stackSize++] = {bvh->root, tRoot};
+    
+    while (stackSize > 0)
+    {
+        StackEntry entry = stack[--stackSize];
+        if (entry.tEntry >= tClosest)
+            continue;
+        
+        DynamicBVHNode* node = bvh->nodes + entry.nodeIndex;
+        COUNT_NODE_VISIT(node);
+        
+        if (is_leaf(node))
+        {
+            intersect_leaf(ray, bvh->objects, &node->objectIndex, 0, 0, 1, time, &tClosest, outObject);
+            continue;
+        }
+        
+        f32 tLeft = 0.0f;
+        f32 tRight = 0.0f;
+        bool hitLeft = hit_test(ray.origin, inverseDir, bvh->nodes + node->left, tClosest, &tLeft);
+        bool hitRight = hit_test(ray.origin, inverseDir, bvh->nodes + node->right, tClosest, &tRight);
+        
+        assert(stackSize + 2 <= ARRAY_LENGTH(stack));
+        
+        // push the farther child first, so the nearer one is visited next
+        if (hitLeft && hitRight && tLeft <= tRight)
+        {
+            stack[stackSize++] = {node->right, tRight};
+            stack[stackSize++] = {node->left, tLeft};
+        }
+        else if (hitLeft && hitRight)
+        {
+            stack[stackSize++] = {node->left, tLeft};
+            stack[stackSize++] = {node->right, tRight};
+        }
+        else if (hitLeft)
+            stack[stackSize++] = {node->left, tLeft};
+        else if (hitRight)
+            stack[stackSize++] = {node->right, tRight};
+    }
+    
+    return tClosest < tMax ? tClosest : F32_MAX;
+}
+
+static bool occlusion_test(Ray ray, DynamicBVH* bvh, f32 time, f32 tMax)
+{
+    u32 stack[DYNAMIC_BVH_MAX_HEIGHT + 1];
+    u32 stackSize = 0;
+    
+    if (bvh->root == DYNAMIC_BVH_NULL_NODE)
+        return false;
+    
+    v3f inverseDir = v3f(1.0f/ray.dir.x, 1.0f/ray.dir.y, 1.0f/ray.dir.z);
+    
+    COUNT_TRAVERSAL_RAY();
+    
+    f32 tEntry = 0.0f;
+    if (!hit_test(ray.origin, inverseDir, bvh->nodes + bvh->root, tMax, &tEntry))
+        return false;
+    
+    stack[stackSize++] = bvh->root;
+    
+    while (stackSize > 0)
+    {
+        DynamicBVHNode* node = bvh->nodes + stack[--stackSize];
+        COUNT_NODE_VISIT(node);
+        
+        if (is_leaf(node))
+        {
+            if (occluded_leaf(ray, bvh->objects, &node->objectIndex, 0, 0, 1, time, tMax))
+                return true;
+            
+            continue;
+        }
+        
+        assert(stackSize + 2 <= ARRAY_LENGTH(stack));
+        
+        if (hit_test(ray.origin, inverseDir, bvh->nodes + node->right, tMax, &tEntry))
+            stack[stackSize++] = node->right;
+        if (hit_test(ray.origin, inverseDir, bvh->nodes + node->left, tMax, &tEntry))
+            stack[stackSize++] = node->left;
+    }
+    
+    return false;
+}
\ No newline at end of file
@@ -0,0 +1,82 @@
+#ifndef DYNAMIC_BVH_H
+#define DYNAMIC_BVH_H
+
+#include "types.h"
+#include "bvh.h"
+
+// marks a missing parent or child, and the end of the free list
+#define DYNAMIC_BVH_NULL_NODE 0xFFFFFFFF
+
+// The tallest the tree can get before its traversal stacks could overflow, which push both children of a node at once.
+// Rotations keep it close to a built tree's height, but nothing stops edits from going past this, so the tree is
+// rebuilt balanced if they do.
+#define DYNAMIC_BVH_MAX_HEIGHT (BVH_MAX_STACK_SIZE*2 - 1)
+
+// A node of a BVH that can have objects added and removed one at a time. Every leaf holds a single object,
+// and nodes can be anywhere in the array, so each one links to its parent and both children.
+struct DynamicBVHNode
+{
+    v3f boundsMin;
+    v3f boundsMax;
+    
+    // for nodes on the free list this is the next free node instead
+    u32 parent;
+    
+    // DYNAMIC_BVH_NULL_NODE for leaves
+    u32 left;
+    u32 right;
+    
+    // only valid in leaves, index into DynamicBVH::objects
+    u32 objectIndex;
+    
+    // the most nodes there are below this one on the way down to a leaf, 0 for leaves
+    u32 height;
+};
+
+struct DynamicBVH
+{
+    DynamicBVHNode* nodes;
+    u32 nodeCapacity;
+    u32 root;
+    
+    // unused nodes are linked together through their parent index
+    u32 freeList;
+    
+    // NOTE: this has to be kept pointing at the world's objects, since adding a sphere can move them
+    SphereObject* objects;
+    u32 objectCount;
+    
+    // the leaf holding each object, indexed the same as the objects
+    u32* objectLeaves;
+    u32 objectLeavesCapacity;
+    
+    // the interval that the boxes of moving objects cover
+    f32 startTime;
+    f32 endTime;
+};
+
+// starts off a dynamic tree with the structure of a built one, which gives it a much better shape than adding
+// each object one at a time would
+DynamicBVH make_dynamic_bvh(BVH* bvh);
+void free_dynamic_bvh(DynamicBVH* bvh);
+
+// Adds the world's object at objectIndex to the tree. The object is placed next to whichever node makes the tree's
+// surface area grow the least, and the tree is rotated on the way back up to undo any damage. Either edit rebuilds
+// the tree if it leaves it taller than DYNAMIC_BVH_MAX_HEIGHT.
+void insert_dynamic_bvh_object(DynamicBVH* bvh, World* world, u32 objectIndex);
+
+// Removes the world's object at objectIndex from the tree. It has to be called before World::remove_sphere, and
+// moves the leaf of the world's last object over to objectIndex to match what World::remove_sphere does.
+void remove_dynamic_bvh_object(DynamicBVH* bvh, World* world, u32 objectIndex);
+
+// The SAH cost of the tree as it is now, with the same leaf costs as BVHStats::sahCost. Every leaf holds a single
+// object though, so it's only comparable with a built tree that has been split down to one object per leaf too.
+f32 dynamic_bvh_cost(DynamicBVH* bvh, f32 traversalCost);
+
+// returns the distance to the closest object hit before tMax, or F32_MAX if nothing was hit
+static f32 intersection_test(Ray ray, DynamicBVH* bvh, f32 time, f32 tMax, SphereObject** outObject);
+
+// returns true if the ray hits any object before tMax, stopping at the first one it finds
+static bool occlusion_test(Ray ray, DynamicBVH* bvh, f32 time, f32 tMax);
+
+#endif //DYNAMIC_BVH_H
@@ -0,0 +1,219 @@
+#include "environment.h"
+
+// where dir lands on the map, in [0, 1)^2
+static inline v2f environment_coordinates(v3f dir)
+{
+    f32 phi = atan2f(dir.z, dir.x);
+    f32 theta = acosf(MAX_VALUE(-1.0f, MIN_VALUE(dir.y, 1.0f)));
+    return v2f((phi + MATH_PI)/(2.0f*MATH_PI), theta/MATH_PI);
+}
+
+// the density over solid angle of a point picked evenly over the pixel of the map at the given height, for each
+// unit of the pixel's chance of being picked
+static inline f32 pixel_solid_angle_pdf(EnvironmentMap* map, f32 sinTheta)
+{
+    return (f32)(map->width*map->height)/(2.0f*MATH_PI*MATH_PI*sinTheta);
+}
+
+// reads the next number from the text header of a PFM, skipping the whitespace before it
+static char* parse_header_number(char* text, char* end, f64* outNumber)
+{
+    while (text < end && (*text == ' ' || *text == '\t' || *text == '\r' || *text == '\n'))
+        ++text;
+    
+    char* numberEnd = text;
+    while (numberEnd < end && *numberEnd != ' ' && *numberEnd != '\t' && *numberEnd != '\r' && *numberEnd != '\n')
+        ++numberEnd;
+    
+    if (numberEnd == text || numberEnd == end)
+        return 0;
+    
+    char number[64] = {};
+    memcpy(number, text, MIN_VALUE((u32)(numberEnd - text), (u32)sizeof(number) - 1));
+    *outNumber = atof(number);
+    
+    return numberEnd;
+}
+
+static bool load_environment_map(char* fileName, EnvironmentMap* outMap)
+{
+    HANDLE file = CreateFile(fileName, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    
+    LARGE_INTEGER fileSize = {};
+    GetFileSizeEx(file, &fileSize);
+    
+    u32 dataSize = (u32)fileSize.QuadPart;
+    char* data = (char*)memory_alloc(dataSize);
+    
+    DWORD bytesRead = 0;
+    ReadFile(file, data, dataSize, &bytesRead, 0);
+    CloseHandle(file);
+    
+    // the header is PF or Pf, the width and height, and a scale whose sign gives the byte order, then a single
+    // whitespace character before the pixels
+    char* end = data + bytesRead;
+    f64 width = 0.0;
+    f64 height = 0.0;
+    f64 scale = 0.0;
+    
+    bool valid = bytesRead > 2 && data[0] == 'P' && (data[1] == 'F' || data[1] == 'f');
+    u32 channels = valid && data[1] == 'F' ? 3 : 1;
+    
+    char* text = valid ? data + 2 : 0;
+    if (text)
+        text = parse_header_number(text, end, &width);
+    if (text)
+        text = parse_header_number(text, end, &height);
+    if (text)
+        text = parse_header_number(text, end, &scale);
+    
+    u32 mapWidth = (u32)width;
+    u32 mapHeight = (u32)height;
+    valid = text && mapWidth > 0 && mapHeight > 0 && (u64)(end - text - 1) >= (u64)mapWidth*mapHeight*channels*sizeof(f32);
+    
+    // NOTE: only little endian maps are read, the kind a negative scale marks, which is what every common tool writes
+    if (valid && scale >= 0.0)
+    {
+        printf("WARNING: The environment map %s is big endian, which isn't supported\n", fileName);
+        valid = false;
+    }
+    
+    if (!valid)
+    {
+        memory_free(data);
+        return false;
+    }
+    
+    f32* values = (f32*)memory_alloc(mapWidth*mapHeight*channels*sizeof(f32));
+    memcpy(values, text + 1, mapWidth*mapHeight*channels*sizeof(f32));
+    memory_free(data);
+    
+    EnvironmentMap result = {};
+    result.width = mapWidth;
+    result.height = mapHeight;
+    result.pixels = (v4f*)memory_alloc((mapWidth + 1)*mapHeight*sizeof(v4f));
+    
+    // NOTE: PFM rows go from the bottom up, the map's go from the top down
+    for (u32 y = 0; y < mapHeight; ++y)
+    {
+        f32* row = values + (mapHeight - 1 - y)*mapWidth*channels;
+        v4f* pixels = result.pixels + y*(mapWidth + 1);
+        
+        for (u32 x = 0; x < mapWidth; ++x)
+        {
+            f32* value = row + x*channels;
+            pixels[x] = channels == 3 ? v4f(value[0], value[1], value[2]) : v4f(value[0], value[0], value[0]);
+        }
+        
+        pixels[mapWidth] = pixels[0];
+    }
+    
+    memory_free(values);
+    
+    // each pixel is weighted by the brightest pixel around it, times how much of the sphere its row covers
+    f32* weights = (f32*)memory_alloc(mapWidth*mapHeight*sizeof(f32));
+    for (u32 y = 0; y < mapHeight; ++y)
+    {
+        f32 sinTheta = sinf(((f32)y + 0.5f)/mapHeight*MATH_PI);
+        
+        for (u32 x = 0; x < mapWidth; ++x)
+        {
+            f32 brightest = 0.0f;
+            for (u32 neighbourY = (y > 0 ? y - 1 : 0); neighbourY <= MIN_VALUE(y + 1, mapHeight - 1); ++neighbourY)
+            {
+                for (u32 offset = 0; offset < 3; ++offset)
+                {
+                    u32 neighbourX = (x + mapWidth + offset - 1) % mapWidth;
+                    v4f colour = result.pixels[neighbourY*(mapWidth + 1) + neighbourX];
+                    brightest = MAX_VALUE(brightest, (colour.r + colour.g + colour.b)/3.0f);
+                }
+            }
+            
+            weights[y*mapWidth + x] = MAX_VALUE(brightest, 0.0f)*sinTheta;
+        }
+    }
+    
+    result.table = build_alias_table(weights, mapWidth*mapHeight);
+    memory_free(weights);
+    
+    *outMap = result;
+    return true;
+}
+
+static void free_environment_map(EnvironmentMap* map)
+{
+    if (map->pixels)
+    {
+        memory_free(map->pixels);
+        free_alias_table(&map->table);
+    }
+    
+    *map = {};
+}
+
+static v4f environment_light(EnvironmentMap* map, v3f dir)
+{
+    v2f coordinates = environment_coordinates(dir);
+    
+    // NOTE: pixel centres are at half way, so the blend is between the pixels either side of the point
+    f32 x = coordinates.x*map->width - 0.5f;
+    f32 y = coordinates.y*map->height - 0.5f;
+    
+    f32 floorX = floorf(x);
+    f32 floorY = floorf(y);
+    f32 blendX = x - floorX;
+    f32 blendY = y - floorY;
+    
+    // left of the first pixel's centre blends with the last pixel, which the extra pixel at the end of each row
+    // covers, and above the top row or below the bottom one there's nothing to blend with
+    s32 left = (s32)floorX;
+    u32 x0 = left < 0 ? map->width - 1 : MIN_VALUE((u32)left, map->width - 1);
+    s32 top = (s32)floorY;
+    s32 lastRow = (s32)map->height - 1;
+    u32 y0 = (u32)MAX_VALUE(0, MIN_VALUE(top, lastRow));
+    u32 y1 = (u32)MAX_VALUE(0, MIN_VALUE(top + 1, lastRow));
+    
+    v4f* row0 = map->pixels + y0*(map->width + 1) + x0;
+    v4f* row1 = map->pixels + y1*(map->width + 1) + x0;
+    
+    v4f upper = row0[0]*(1.0f - blendX) + row0[1]*blendX;
+    v4f lower = row1[0]*(1.0f - blendX) + row1[1]*blendX;
+    v4f result = upper*(1.0f - blendY) + lower*blendY;
+    result.a = 1.0f;
+    
+    return result;
+}
+
+static bool sample_environment(EnvironmentMap* map, v2f pickSample, v2f jitter, v3f* outDir, f32* outPdf)
+{
+    u32 pixel = sample_alias_table(&map->table, pickSample.x, pickSample.y);
+    u32 pixelX = pixel % map->width;
+    u32 pixelY = pixel/map->width;
+    
+    f32 phi = ((f32)pixelX + jitter.x)/map->width*2.0f*MATH_PI - MATH_PI;
+    f32 theta = ((f32)pixelY + jitter.y)/map->height*MATH_PI;
+    
+    f32 sinTheta = sinf(theta);
+    if (sinTheta <= 0.0f)
+        return false;
+    
+    *outDir = v3f(sinTheta*cosf(phi), cosf(theta), sinTheta*sinf(phi));
+    *outPdf = map->table.probabilities[pixel]*pixel_solid_angle_pdf(map, sinTheta);
+    return *outPdf > 0.0f;
+}
+
+static f32 environment_pdf(EnvironmentMap* map, v3f dir)
+{
+    v2f coordinates = environment_coordinates(dir);
+    
+    f32 sinTheta = sqrtf(MAX_VALUE(0.0f, 1.0f - dir.y*dir.y));
+    if (sinTheta <= 0.0f)
+        return 0.0f;
+    
+    u32 pixelX = MIN_VALUE((u32)(coordinates.x*map->width), map->width - 1);
+    u32 pixelY = MIN_VALUE((u32)(coordinates.y*map->height), map->height - 1);
+    
+    return map->table.probabilities[pixelY*map->width + pixelX]*pixel_solid_angle_pdf(map, sinTheta);
+}
\ No newline at end of file
@@ -0,0 +1,38 @@
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include "types.h"
+#include "alias_table.h"
+
+// An HDR picture of everything around the scene, which rays that miss everything see instead of the sky gradient.
+// It's a lat-long map, with x going once around the y axis and y going from straight up at the top row to straight
+// down at the bottom one.
+struct EnvironmentMap
+{
+    u32 width;
+    u32 height;
+    
+    // Row by row from the top, with each row one pixel longer than the map is wide. The extra pixel is a copy of the
+    // row's first, so a bilinear lookup never has to wrap around, and only ever reads from two neighbouring rows.
+    v4f* pixels;
+    
+    // Picks pixels in proportion to how much light they send into the scene. Each pixel's weight is its brightest
+    // neighbour's, since a bilinear lookup inside a pixel can blend in light from any of them.
+    AliasTable table;
+};
+
+// Loads a Portable Float Map, the PF format for colour and Pf for greyscale. Returns false if the file can't be read.
+static bool load_environment_map(char* fileName, EnvironmentMap* outMap);
+static void free_environment_map(EnvironmentMap* map);
+
+// the light arriving from the map along dir, blended between the four closest pixels
+static v4f environment_light(EnvironmentMap* map, v3f dir);
+
+// Picks a direction with the alias table, then a point inside the pixel with jitter. Returns false if it lands on
+// one of the poles, where the map squashes a whole row into a point.
+static bool sample_environment(EnvironmentMap* map, v2f pickSample, v2f jitter, v3f* outDir, f32* outPdf);
+
+// the density over solid angle that sample_environment picks dir with
+static f32 environment_pdf(EnvironmentMap* map, v3f dir);
+
+#endif //ENVIRONMENT_H
@@ -36,6 +36,11 @@ Rect3f bounding_box(Sphere sphere)
     return result;
 }
 
+f32 surface_area(Rect3f rect)
+{
+    return 8.0f*(rect.halfWidth*rect.halfHeight + rect.halfWidth*rect.halfLength + rect.halfHeight*rect.halfLength);
+}
+
 static f32 intersection_test(Ray ray, Sphere sphere)
 {
     f32 tResult = F32_MAX;
@@ -67,6 +72,118 @@ static f32 intersection_test(Ray ray, Sphere sphere)
     return tResult;
 }
 
+u32 sphere_arrays_size(u32 count)
+{
+    // each array gets SPHERE_BATCH_SIZE - 1 spare entries past its last sphere, rounded up so they all stay 32 byte aligned
+    u32 stride = (count + 2*SPHERE_BATCH_SIZE - 2) & ~(SPHERE_BATCH_SIZE - 1);
+    return 7*stride*sizeof(f32);
+}
+
+void point_sphere_arrays(SphereArrays* spheres, void* data, u32 count)
+{
+    u32 stride = sphere_arrays_size(count)/(7*sizeof(f32));
+    f32* array = (f32*)data;
+    
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+        spheres->pos[axis] = array;
+        array += stride;
+    }
+    
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+        spheres->velocity[axis] = array;
+        array += stride;
+    }
+    
+    spheres->radius = array;
+    spheres->count = count;
+}
+
+#ifdef __AVX__
+static inline f32 min_lane(__m256 values)
+{
+    __m128 result = _mm_min_ps(_mm256_castps256_ps128(values), _mm256_extractf128_ps(values, 1));
+    result = _mm_min_ps(result, _mm_movehl_ps(result, result));
+    result = _mm_min_ss(result, _mm_shuffle_ps(result, result, 1));
+    
+    return _mm_cvtss_f32(result);
+}
+#endif
+
+#ifdef __AVX2__
+template <bool Moving>
+static inline u32 intersection_test(Ray ray, SphereArrays* spheres, u32 first, u32 count, f32 time, f32 tMin, f32* tClosest)
+{
+    assert(count <= SPHERE_BATCH_SIZE);
+    assert(first + count <= spheres->count);
+    assert(Moving || !spheres->moving);
+    
+    __m256 batchTime = _mm256_set1_ps(time);
+    __m256 radius = _mm256_loadu_ps(spheres->radius + first);
+    
+    // the same quadratic as the single sphere test, with b halved since the ray's direction is normalized
+    __m256 halfB = _mm256_setzero_ps();
+    __m256 c = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_mul_ps(radius, radius));
+    
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+        __m256 center = _mm256_loadu_ps(spheres->pos[axis] + first);
+        center = Moving ? _mm256_fmadd_ps(batchTime, _mm256_loadu_ps(spheres->velocity[axis] + first), center) : center;
+        
+        __m256 offset = _mm256_sub_ps(_mm256_set1_ps(ray.origin.e[axis]), center);
+        
+        halfB = _mm256_fmadd_ps(_mm256_set1_ps(ray.dir.e[axis]), offset, halfB);
+        c = _mm256_fmadd_ps(offset, offset, c);
+    }
+    
+    __m256 discriminant = _mm256_fmsub_ps(halfB, halfB, c);
+    __m256 t = _mm256_sub_ps(_mm256_sub_ps(_mm256_setzero_ps(), halfB), _mm256_sqrt_ps(discriminant));
+    
+    // NOTE: the lanes past count hold whatever spheres follow the batch, so they're masked off along with the misses
+    __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256 inBatch = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32((s32)count), lanes));
+    __m256 hit = _mm256_and_ps(_mm256_and_ps(inBatch, _mm256_cmp_ps(discriminant, _mm256_setzero_ps(), _CMP_GE_OQ)),
+                               _mm256_and_ps(_mm256_cmp_ps(t, _mm256_set1_ps(tMin), _CMP_GT_OQ), _mm256_cmp_ps(t, _mm256_set1_ps(*tClosest), _CMP_LT_OQ)));
+    
+    u32 hitMask = (u32)_mm256_movemask_ps(hit);
+    if (!hitMask)
+        return SPHERE_BATCH_MISS;
+    
+    __m256 hitT = _mm256_blendv_ps(_mm256_set1_ps(F32_MAX), t, hit);
+    f32 tHit = min_lane(hitT);
+    u32 closestMask = hitMask & (u32)_mm256_movemask_ps(_mm256_cmp_ps(hitT, _mm256_set1_ps(tHit), _CMP_EQ_OQ));
+    
+    *tClosest = tHit;
+    return first + _tzcnt_u32(closestMask);
+}
+#else
+template <bool Moving>
+static inline u32 intersection_test(Ray ray, SphereArrays* spheres, u32 first, u32 count, f32 time, f32 tMin, f32* tClosest)
+{
+    assert(count <= SPHERE_BATCH_SIZE);
+    assert(first + count <= spheres->count);
+    assert(Moving || !spheres->moving);
+    
+    u32 result = SPHERE_BATCH_MISS;
+    
+    for (u32 i = first; i < first + count; ++i)
+    {
+        v3f pos = v3f(spheres->pos[0][i], spheres->pos[1][i], spheres->pos[2][i]);
+        pos = Moving ? pos + time*v3f(spheres->velocity[0][i], spheres->velocity[1][i], spheres->velocity[2][i]) : pos;
+        
+        f32 t = intersection_test(ray, Sphere(pos, spheres->radius[i]));
+        if (t > tMin && t < *tClosest)
+        {
+            *tClosest = t;
+            result = i;
+        }
+    }
+    
+    return result;
+}
+#endif
+
 static f32 intersection_test(Ray ray, Plane plane)
 {
     f32 tResult = F32_MAX;
@@ -1,8 +1,16 @@
 #ifndef GEOMETRY_H
 #define GEOMETRY_H
 
+#include <immintrin.h>
+
 #include "types.h"
 
+// number of spheres tested against a ray at once, one for each lane of an AVX register
+#define SPHERE_BATCH_SIZE 8
+
+// returned by the batch sphere test when none of the spheres are hit
+#define SPHERE_BATCH_MISS 0xFFFFFFFF
+
 struct Ray
 {
     Ray(v3f rayOrigin, v3f rayDir, bool normalized = true);
@@ -22,6 +30,21 @@ struct Sphere
     f32 radius;
 };
 
+// A list of spheres, possibly moving, with each part stored in its own array so a batch of neighbouring spheres
+// can be loaded straight into SIMD registers. Every array has room for SPHERE_BATCH_SIZE - 1 entries past count,
+// so a batch starting at any sphere can always be loaded in full.
+struct SphereArrays
+{
+    f32* pos[3];
+    f32* velocity[3];
+    f32* radius;
+    
+    u32 count;
+    
+    // false when every velocity is zero, so the spheres can be tested without moving them to the ray's time
+    bool moving;
+};
+
 struct Plane
 {
     v3f normal;
@@ -58,6 +81,8 @@ struct Rect3f
 Rect3f bounding_box(Rect3f rect1, Rect3f rect2);
 Rect3f bounding_box(Sphere sphere);
 
+f32 surface_area(Rect3f rect);
+
 // reflect a direction vector about a normal
 static inline v3f reflect_direction(v3f dir, v3f normal)
 {
@@ -73,9 +98,22 @@ static inline Ray reflect_ray(Ray ray, v3f point, v3f normal)
 }
 
 
+// the number of bytes needed to store the arrays for count spheres
+u32 sphere_arrays_size(u32 count);
+
+// sets up the arrays for count spheres inside data, which must be sphere_arrays_size(count) bytes
+void point_sphere_arrays(SphereArrays* spheres, void* data, u32 count);
+
 static f32 intersection_test(Ray ray, Sphere sphere);
 static f32 intersection_test(Ray ray, Plane plane);
 
+// Tests the ray against count spheres starting at first, each moved to where it is at time, all at once. count can
+// be at most SPHERE_BATCH_SIZE. If any of them are hit after tMin and closer than tClosest, tClosest is moved up to
+// the closest hit and its index in spheres is returned, otherwise returns SPHERE_BATCH_MISS.
+// NOTE: with Moving false the velocities aren't even loaded, which is only right if spheres->moving is false
+template <bool Moving>
+static inline u32 intersection_test(Ray ray, SphereArrays* spheres, u32 first, u32 count, f32 time, f32 tMin, f32* tClosest);
+
 static bool hit_test(Ray ray, Rect3f rect);
 
 #endif //GEOMETRY_H
@@ -0,0 +1,262 @@
+#include "instance_bvh.h"
+
+/*
+* Building
+*/
+
+// the world space box around a box in the instance's space
+static Rect3f instance_bounding_box(Instance* instance, v3f localMin, v3f localMax)
+{
+    v3f boundsMin = v3f(F32_MAX, F32_MAX, F32_MAX);
+    v3f boundsMax = v3f(F32_MIN, F32_MIN, F32_MIN);
+    
+    for (u32 corner = 0; corner < 8; ++corner)
+    {
+        v3f localCorner = v3f((corner & 1) ? localMax.x : localMin.x,
+                              (corner & 2) ? localMax.y : localMin.y,
+                              (corner & 4) ? localMax.z : localMin.z);
+        v3f worldCorner = instance->to_world(localCorner);
+        
+        for (u32 axis = 0; axis < 3; ++axis)
+        {
+            boundsMin.e[axis] = MIN_VALUE(boundsMin.e[axis], worldCorner.e[axis]);
+            boundsMax.e[axis] = MAX_VALUE(boundsMax.e[axis], worldCorner.e[axis]);
+        }
+    }
+    
+    return Rect3f::from_bounds(boundsMin, boundsMax);
+}
+
+InstanceBVH build_instance_bvh(World* world, BVHBuildSettings* settings)
+{
+    assert(world);
+    assert(settings);
+    
+    InstanceBVH result = {};
+    if (world->instanceCount == 0)
+        return result;
+    
+    result.prototypeCount = world->prototypeCount;
+    result.prototypeBVHs = (LinearBVH*)memory_alloc(world->prototypeCount*sizeof(LinearBVH));
+    
+    for (u32 i = 0; i < world->prototypeCount; ++i)
+    {
+        Prototype* prototype = world->prototypes + i;
+        if (prototype->objectCount == 0)
+            continue;
+        
+        BVH tree = build_bvh(prototype->objects, prototype->objectCount, settings);
+        result.prototypeBVHs[i] = flatten_bvh(&tree);
+        free_bvh(&tree);
+    }
+    
+    result.instances = world->instances;
+    result.instanceCount = world->instanceCount;
+    
+    Rect3f* instanceBoxes = (Rect3f*)memory_alloc(world->instanceCount*sizeof(Rect3f));
+    for (u32 i = 0; i < world->instanceCount; ++i)
+    {
+        Instance* instance = world->instances + i;
+        LinearBVH* prototypeBVH = result.prototypeBVHs + instance->prototype;
+        
+        // NOTE: an instance of an empty prototype gets an empty box at its position, which rays can never hit
+        if (prototypeBVH->nodeCount > 0)
+            instanceBoxes[i] = instance_bounding_box(instance, prototypeBVH->nodes[0].boundsMin, prototypeBVH->nodes[0].boundsMax);
+        else
+            instanceBoxes[i] = Rect3f::from_bounds(instance->pos, instance->pos);
+    }
+    
+    BVH topLevelTree = build_bvh(instanceBoxes, world->instanceCount, settings);
+    result.topLevel = flatten_bvh(&topLevelTree);
+    free_bvh(&topLevelTree);
+    
+    memory_free(instanceBoxes);
+    
+    return result;
+}
+
+void free_instance_bvh(InstanceBVH* bvh)
+{
+    for (u32 i = 0; i < bvh->prototypeCount; ++i)
+    {
+        if (bvh->prototypeBVHs[i].nodes)
+            free_linear_bvh(bvh->prototypeBVHs + i);
+    }
+    
+    if (bvh->prototypeBVHs)
+        memory_free(bvh->prototypeBVHs);
+    if (bvh->topLevel.nodes)
+        free_linear_bvh(&bvh->topLevel);
+    
+    *bvh = {};
+}
+
+/*
+* Traversal
+*/
+
+// the ray in the instance's space, where distances along it are 1/scale of what they are in world space
+static inline Ray to_instance_space(Ray ray, Instance* instance)
+{
+    // the axes are orthonormal, so moving into the instance's space only needs dot products, and the direction
+    // stays normalized while distances shrink by the scale
+    f32 inverseScale = 1.0f/instance->scale;
+    v3f offset = ray.origin - instance->pos;
+    
+    v3f localOrigin = inverseScale*v3f(dot(offset, instance->axes[0]), dot(offset, instance->axes[1]), dot(offset, instance->axes[2]));
+    v3f localDir = v3f(dot(ray.dir, instance->axes[0]), dot(ray.dir, instance->axes[1]), dot(ray.dir, instance->axes[2]));
+    return Ray(localOrigin, localDir);
+}
+
+// traces the ray through a single instance, with tClosest and the distance returned both in world space
+static void intersect_instance(Ray ray, InstanceBVH* bvh, u32 instanceIndex, f32 time, f32* tClosest, SphereObject** outObject, Instance** outInstance)
+{
+    Instance* instance = bvh->instances + instanceIndex;
+    LinearBVH* prototypeBVH = bvh->prototypeBVHs + instance->prototype;
+    if (prototypeBVH->nodeCount == 0)
+        return;
+    
+    Ray localRay = to_instance_space(ray, instance);
+    
+    SphereObject* hitObject = 0;
+    f32 tLocal = intersection_test(localRay, prototypeBVH, time, *tClosest/instance->scale, &hitObject);
+    
+    if (tLocal != F32_MAX && tLocal*instance->scale < *tClosest)
+    {
+        *tClosest = tLocal*instance->scale;
+        *outObject = hitObject;
+        *outInstance = instance;
+    }
+}
+
+static f32 intersection_test(Ray ray, InstanceBVH* bvh, f32 time, f32 tMax, SphereObject** outObject, Sphere* outSphere)
+{
+    if (bvh->instanceCount == 0)
+        return F32_MAX;
+    
+    struct StackEntry
+    {
+        u32 nodeIndex;
+        f32 tEntry;
+    };
+    
+    // NOTE: both children are pushed at once, so the deepest interior node can leave one more entry than it has ancestors
+    StackEntry stack[BVH_MAX_STACK_SIZE + 1];
+    u32 stackSize = 0;
+    
+    f32 tClosest = tMax;
+    v3f inverseDir = v3f(1.0f/ray.dir.x, 1.0f/ray.dir.y, 1.0f/ray.dir.z);
+    
+    Instance* hitInstance = 0;
+    LinearBVHNode* nodes = bvh->topLevel.nodes;
+    
+    f32 tRoot = 0.0f;
+    if (!hit_test(ray.origin, inverseDir, nodes, tClosest, &tRoot))
+        return F32_MAX;
+    
+    stack[stackSize++] = {0, tRoot};
+    
+    while (stackSize > 0)
+    {
+        StackEntry entry = stack[--stackSize];
+        if (entry.tEntry >= tClosest)
+            continue;
+        
+        LinearBVHNode* node = nodes + entry.nodeIndex;
+        
+        if (node->objectCount > 0)
+        {
+            for (u32 i = 0; i < node->objectCount; ++i)
+            {
+                u32 instanceIndex = bvh->topLevel.objectIndices[node->firstObject + i];
+                intersect_instance(ray, bvh, instanceIndex, time, &tClosest, outObject, &hitInstance);
+            }
+            
+            continue;
+        }
+        
+        u32 leftIndex = entry.nodeIndex + 1;
+        u32 rightIndex = node->rightChild;
+        
+        f32 tLeft = 0.0f;
+        f32 tRight = 0.0f;
+        bool hitLeft = hit_test(ray.origin, inverseDir, nodes + leftIndex, tClosest, &tLeft);
+        bool hitRight = hit_test(ray.origin, inverseDir, nodes + rightIndex, tClosest, &tRight);
+        
+        assert(stackSize + 2 <= ARRAY_LENGTH(stack));
+        
+        // push the farther child first, so the nearer one is visited next
+        if (hitLeft && hitRight && tLeft <= tRight)
+        {
+            stack[stackSize++] = {rightIndex, tRight};
+            stack[stackSize++] = {leftIndex, tLeft};
+        }
+        else if (hitLeft && hitRight)
+        {
+            stack[stackSize++] = {leftIndex, tLeft};
+            stack[stackSize++] = {rightIndex, tRight};
+        }
+        else if (hitLeft)
+            stack[stackSize++] = {leftIndex, tLeft};
+        else if (hitRight)
+            stack[stackSize++] = {rightIndex, tRight};
+    }
+    
+    if (!hitInstance)
+        return F32_MAX;
+    
+    SphereObject* object = *outObject;
+    *outSphere = Sphere(hitInstance->to_world(object->pos(time)), object->sphere.radius*hitInstance->scale);
+    
+    return tClosest;
+}
+
+static bool occlusion_test(Ray ray, InstanceBVH* bvh, f32 time, f32 tMax)
+{
+    if (bvh->instanceCount == 0)
+        return false;
+    
+    u32 stack[BVH_MAX_STACK_SIZE + 1];
+    u32 stackSize = 0;
+    
+    v3f inverseDir = v3f(1.0f/ray.dir.x, 1.0f/ray.dir.y, 1.0f/ray.dir.z);
+    LinearBVHNode* nodes = bvh->topLevel.nodes;
+    
+    f32 tEntry = 0.0f;
+    if (!hit_test(ray.origin, inverseDir, nodes, tMax, &tEntry))
+        return false;
+    
+    stack[stackSize++] = 0;
+    
+    while (stackSize > 0)
+    {
+        u32 nodeIndex = stack[--stackSize];
+        LinearBVHNode* node = nodes + nodeIndex;
+        
+        if (node->objectCount > 0)
+        {
+            for (u32 i = 0; i < node->objectCount; ++i)
+            {
+                Instance* instance = bvh->instances + bvh->topLevel.objectIndices[node->firstObject + i];
+                LinearBVH* prototypeBVH = bvh->prototypeBVHs + instance->prototype;
+                
+                if (prototypeBVH->nodeCount > 0 && occlusion_test(to_instance_space(ray, instance), prototypeBVH, time, tMax/instance->scale))
+                    return true;
+            }
+            
+            continue;
+        }
+        
+        u32 leftIndex = nodeIndex + 1;
+        u32 rightIndex = node->rightChild;
+        
+        if (hit_test(ray.origin, inverseDir, nodes + rightIndex, tMax, &tEntry))
+            stack[stackSize++] = rightIndex;
+        if (hit_test(ray.origin, inverseDir, nodes + leftIndex, tMax, &tEntry))
+            stack[stackSize++] = leftIndex;
+        
+        assert(stackSize <= ARRAY_LENGTH(stack));
+    }
+    
+    return false;
+}
\ No newline at end of file
@@ -0,0 +1,33 @@
+#ifndef INSTANCE_BVH_H
+#define INSTANCE_BVH_H
+
+#include "types.h"
+#include "bvh.h"
+
+// A two level BVH for the world's instances. Each prototype gets a bottom level BVH in its own space, built once
+// no matter how many times it is placed, and a top level BVH is built over the world space boxes of the instances.
+// Rays are moved into an instance's space to be traced against its prototype's BVH.
+struct InstanceBVH
+{
+    // indexed the same as World::prototypes
+    LinearBVH* prototypeBVHs;
+    u32 prototypeCount;
+    
+    Instance* instances;
+    u32 instanceCount;
+    
+    // the object indices of the top level are indices into instances
+    LinearBVH topLevel;
+};
+
+InstanceBVH build_instance_bvh(World* world, BVHBuildSettings* settings);
+void free_instance_bvh(InstanceBVH* bvh);
+
+// Returns the distance to the closest instanced sphere hit before tMax, or F32_MAX if nothing was hit. Since the
+// object is the prototype's, outSphere is filled with where the sphere that was hit actually is at the ray's time.
+static f32 intersection_test(Ray ray, InstanceBVH* bvh, f32 time, f32 tMax, SphereObject** outObject, Sphere* outSphere);
+
+// returns true if the ray hits any instanced sphere before tMax, stopping at the first one it finds
+static bool occlusion_test(Ray ray, InstanceBVH* bvh, f32 time, f32 tMax);
+
+#endif //INSTANCE_BVH_H
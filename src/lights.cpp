@@ -0,0 +1,390 @@
+#include "lights.h"
+
+// the total power of a light, its radiance times its surface area times pi
+static f32 light_power(World* world, SphereObject* object)
+{
+    v4f emission = emitted_light(world->materials + object->material);
+    f32 radius = object->sphere.radius;
+    return (emission.r + emission.g + emission.b)/3.0f*4.0f*MATH_PI*radius*radius*MATH_PI;
+}
+
+// Builds the node for the lights between startIndex and endIndex, and the ones below it, and returns the box around
+// them. The lights are split in half along the longest axis of their centres, which keeps the tree as shallow as it
+// can be, so every trail fits.
+static BVHBounds build_light_node(LightSet* lights, BVHPrimitive* primitives, f32* powers, u32 startIndex, u32 endIndex, u32 trail,
+                                  u32 depth)
+{
+    assert(depth < 32);
+    
+    u32 nodeIndex = lights->nodeCount++;
+    LightNode* node = lights->nodes + nodeIndex;
+    
+    BVHBounds bounds = primitives[startIndex].bounds;
+    
+    if (endIndex - startIndex == 1)
+    {
+        u32 light = primitives[startIndex].objectIndex;
+        
+        node->power = powers[light];
+        node->index = light;
+        node->leaf = true;
+        
+        lights->trails[light] = trail;
+    }
+    else
+    {
+        BVHBounds centroidBounds = empty_bounds();
+        for (u32 i = startIndex; i < endIndex; ++i)
+        {
+            BVHBounds centroid = { primitives[i].centroid, primitives[i].centroid };
+            grow_bounds(&centroidBounds, &centroid);
+        }
+        
+        v3f extent = centroidBounds.max - centroidBounds.min;
+        u32 splitAxis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        u32 midIndex = (startIndex + endIndex)/2;
+        select_bvh_primitive(primitives, startIndex, endIndex, midIndex, splitAxis);
+        
+        bounds = build_light_node(lights, primitives, powers, startIndex, midIndex, trail, depth + 1);
+        
+        u32 secondChild = lights->nodeCount;
+        BVHBounds secondBounds = build_light_node(lights, primitives, powers, midIndex, endIndex, trail | (1u << depth), depth + 1);
+        grow_bounds(&bounds, &secondBounds);
+        
+        node->power = lights->nodes[nodeIndex + 1].power + lights->nodes[secondChild].power;
+        node->index = secondChild;
+        node->leaf = false;
+    }
+    
+    node->centre = 0.5f*(bounds.min + bounds.max);
+    node->radiusSquared = 0.25f*norm_squared(bounds.max - bounds.min);
+    return bounds;
+}
+
+static void build_light_set(World* world)
+{
+    LightSet* lights = &world->lights;
+    free_light_set(lights);
+    
+    for (u32 i = 0; i < world->objectCount; ++i)
+    {
+        if (world->materials[world->objects[i].material].type == Material::Type::EMISSIVE)
+            ++lights->count;
+    }
+    
+    if (lights->count == 0)
+        return;
+    
+    lights->objects = (u32*)memory_alloc(lights->count*sizeof(u32));
+    
+    u32 lightIndex = 0;
+    for (u32 i = 0; i < world->objectCount; ++i)
+    {
+        if (world->materials[world->objects[i].material].type == Material::Type::EMISSIVE)
+            lights->objects[lightIndex++] = i;
+    }
+    
+    f32* powers = (f32*)memory_alloc(lights->count*sizeof(f32));
+    BVHPrimitive* primitives = (BVHPrimitive*)memory_alloc(lights->count*sizeof(BVHPrimitive));
+    
+    for (u32 i = 0; i < lights->count; ++i)
+    {
+        SphereObject* object = world->objects + lights->objects[i];
+        powers[i] = light_power(world, object);
+        
+        Rect3f box = object->get_bounding_box(world->startTime, world->endTime);
+        primitives[i].bounds.min = v3f(box.left(), box.bottom(), box.back());
+        primitives[i].bounds.max = v3f(box.right(), box.top(), box.front());
+        primitives[i].centroid = box.pos;
+        primitives[i].objectIndex = i;
+    }
+    
+    lights->powerTable = build_alias_table(powers, lights->count);
+    
+    lights->nodes = (LightNode*)memory_alloc((2*lights->count - 1)*sizeof(LightNode));
+    lights->trails = (u32*)memory_alloc(lights->count*sizeof(u32));
+    build_light_node(lights, primitives, powers, 0, lights->count, 0, 0);
+    
+    memory_free(powers);
+    memory_free(primitives);
+}
+
+static void free_light_set(LightSet* lights)
+{
+    if (lights->count > 0)
+    {
+        memory_free(lights->objects);
+        free_alias_table(&lights->powerTable);
+        memory_free(lights->nodes);
+        memory_free(lights->trails);
+    }
+    
+    *lights = {};
+}
+
+// The most light the node's lights could send to a surface at point facing normal, up to a constant factor. The
+// surface's cosine is taken towards whichever part of the node's sphere is closest to its normal, so a node that's
+// entirely behind the surface gets nothing. Spheres give off light in every direction, so the lights' side doesn't
+// narrow it down any further.
+static inline f32 light_importance(LightNode* node, v3f point, v3f normal)
+{
+    f32 radiusSquared = node->radiusSquared;
+    
+    v3f toCentre = node->centre - point;
+    f32 distanceSquared = norm_squared(toCentre);
+    
+    f32 cosine = 1.0f;
+    if (distanceSquared > radiusSquared)
+    {
+        f32 cosCentre = dot(normal, toCentre)/sqrtf(distanceSquared);
+        
+        f32 sinBoundSquared = radiusSquared/distanceSquared;
+        f32 cosBound = sqrtf(1.0f - sinBoundSquared);
+        
+        // NOTE: if the normal points inside the cone around the sphere, some part of it is straight in front of the surface
+        if (cosCentre < cosBound)
+        {
+            f32 sinCentre = sqrtf(MAX_VALUE(0.0f, 1.0f - cosCentre*cosCentre));
+            cosine = cosCentre*cosBound + sinCentre*sqrtf(sinBoundSquared);
+            
+            if (cosine <= 0.0f)
+                return 0.0f;
+        }
+    }
+    
+    // NOTE: the distance is kept from going under the box's size, or a point right next to or inside a node would
+    // make it infinitely important
+    return node->power*cosine/MAX_VALUE(distanceSquared, radiusSquared);
+}
+
+// the chance of picking the first of the interior node's children, 0 if neither could light the point
+static inline f32 first_child_chance(LightSet* lights, u32 nodeIndex, v3f point, v3f normal)
+{
+    f32 firstImportance = light_importance(lights->nodes + nodeIndex + 1, point, normal);
+    f32 secondImportance = light_importance(lights->nodes + lights->nodes[nodeIndex].index, point, normal);
+    
+    f32 total = firstImportance + secondImportance;
+    return total > 0.0f ? firstImportance/total : -1.0f;
+}
+
+// Walks down the light BVH from the root, picking a child at each level with the sample, which is stretched back
+// over [0, 1) after each pick. Returns the light, or count if none of them could light the point.
+static u32 pick_light_bvh(LightSet* lights, v3f point, v3f normal, f32 sample, f32* outProbability)
+{
+    u32 nodeIndex = 0;
+    f32 probability = 1.0f;
+    
+    while (!lights->nodes[nodeIndex].leaf)
+    {
+        f32 firstChance = first_child_chance(lights, nodeIndex, point, normal);
+        if (firstChance < 0.0f)
+            return lights->count;
+        
+        if (sample < firstChance)
+        {
+            sample /= firstChance;
+            probability *= firstChance;
+            nodeIndex = nodeIndex + 1;
+        }
+        else
+        {
+            sample = (sample - firstChance)/(1.0f - firstChance);
+            probability *= 1.0f - firstChance;
+            nodeIndex = lights->nodes[nodeIndex].index;
+        }
+        
+        // rounding can leave the stretched sample right on 1
+        sample = MIN_VALUE(sample, 0.99999994f);
+    }
+    
+    *outProbability = probability;
+    return lights->nodes[nodeIndex].index;
+}
+
+// the chance pick_light_bvh has of picking the light, following its trail down the tree
+static f32 light_bvh_probability(LightSet* lights, u32 light, v3f point, v3f normal)
+{
+    u32 trail = lights->trails[light];
+    u32 nodeIndex = 0;
+    f32 probability = 1.0f;
+    
+    for (u32 depth = 0; !lights->nodes[nodeIndex].leaf; ++depth)
+    {
+        f32 firstChance = first_child_chance(lights, nodeIndex, point, normal);
+        if (firstChance < 0.0f)
+            return 0.0f;
+        
+        if (trail & (1u << depth))
+        {
+            probability *= 1.0f - firstChance;
+            nodeIndex = lights->nodes[nodeIndex].index;
+        }
+        else
+        {
+            probability *= firstChance;
+            nodeIndex = nodeIndex + 1;
+        }
+    }
+    
+    return probability;
+}
+
+// The chance of a shadow ray going to the environment map instead of one of the spheres. With both, they get half
+// each, since there's no telling how bright the map is next to the spheres until it's been sampled.
+static inline f32 environment_chance(World* world)
+{
+    if (!world->environment.pixels)
+        return 0.0f;
+    
+    return world->lights.count > 0 ? 0.5f : 1.0f;
+}
+
+// The cosine of the angle between the centre of the sphere and its edge, as seen from point, and the solid angle of
+// the cone it fills. Returns false if point is inside the sphere, where it doesn't fill a cone.
+static inline bool light_cone(Sphere sphere, v3f point, f32* outCosMax, f32* outSolidAngle)
+{
+    f32 distanceSquared = distance_squared(point, sphere.pos);
+    f32 radiusSquared = sphere.radius*sphere.radius;
+    if (distanceSquared <= radiusSquared)
+        return false;
+    
+    // NOTE: 1 - cosMax is worked out from the sine, since for a far away light cosMax rounds to 1 and the solid angle to 0
+    f32 sinSquared = radiusSquared/distanceSquared;
+    *outCosMax = sqrtf(1.0f - sinSquared);
+    *outSolidAngle = 2.0f*MATH_PI*sinSquared/(1.0f + *outCosMax);
+    return true;
+}
+
+static bool sample_light(World* world, LightSet::Selection selection, v3f point, v3f normal, f32 time, Sampler* sampler,
+                         LightSample* outSample)
+{
+    LightSet* lights = &world->lights;
+    EnvironmentMap* environment = &world->environment;
+    if (lights->count == 0 && !environment->pixels)
+        return false;
+    
+    // NOTE: the direction takes the first pair of dimensions and picking the light the second
+    v2f coneSample = sample_v2f(sampler);
+    v2f pickSample = sample_v2f(sampler);
+    
+    // the environment map is picked first, with the rest of the pick stretched back over [0, 1) for the spheres
+    f32 environmentChance = environment_chance(world);
+    if (pickSample.x < environmentChance)
+    {
+        pickSample.x /= environmentChance;
+        
+        f32 pdf = 0.0f;
+        if (!sample_environment(environment, pickSample, coneSample, &outSample->dir, &pdf))
+            return false;
+        
+        outSample->distance = F32_MAX;
+        outSample->emission = environment_light(environment, outSample->dir);
+        outSample->pdf = environmentChance*pdf;
+        return true;
+    }
+    
+    pickSample.x = MIN_VALUE((pickSample.x - environmentChance)/(1.0f - environmentChance), 0.99999994f);
+    
+    u32 light = 0;
+    f32 pickProbability = 0.0f;
+    switch (selection)
+    {
+        case LightSet::Selection::BVH:
+            light = pick_light_bvh(lights, point, normal, pickSample.x, &pickProbability);
+            if (light == lights->count)
+                return false;
+            break;
+        case LightSet::Selection::POWER:
+            light = sample_alias_table(&lights->powerTable, pickSample.x, pickSample.y);
+            pickProbability = lights->powerTable.probabilities[light];
+            break;
+        case LightSet::Selection::UNIFORM:
+            light = MIN_VALUE((u32)(pickSample.x*lights->count), lights->count - 1);
+            pickProbability = 1.0f/lights->count;
+            break;
+    }
+    
+    SphereObject* object = world->objects + lights->objects[light];
+    Sphere sphere = Sphere(object->pos(time), object->sphere.radius);
+    
+    f32 cosMax = 0.0f;
+    f32 solidAngle = 0.0f;
+    if (pickProbability <= 0.0f || !light_cone(sphere, point, &cosMax, &solidAngle))
+        return false;
+    
+    v3f toCentre = sphere.pos - point;
+    v3f dir = warp_uniform_cone(coneSample, cosMax, normalize(toCentre));
+    
+    // a direction right at the edge of the cone can miss by rounding, in which case it only grazes the sphere
+    f32 distance = intersection_test(Ray(point, dir), sphere);
+    if (distance == F32_MAX)
+        distance = dot(toCentre, dir);
+    
+    outSample->dir = dir;
+    outSample->distance = distance;
+    outSample->emission = emitted_light(world->materials + object->material);
+    outSample->pdf = (1.0f - environmentChance)*pickProbability/solidAngle;
+    return true;
+}
+
+static f32 light_pdf(World* world, LightSet::Selection selection, SphereObject* object, v3f point, v3f normal, f32 time)
+{
+    LightSet* lights = &world->lights;
+    
+    // NOTE: every one of the world's own spheres with an emissive material is a light, and nothing else is
+    if (!object || object < world->objects || object >= world->objects + world->objectCount)
+        return 0.0f;
+    if (world->materials[object->material].type != Material::Type::EMISSIVE)
+        return 0.0f;
+    
+    // the lights are in the same order as the objects, so the light can be found with a binary search
+    u32 objectIndex = (u32)(object - world->objects);
+    u32 low = 0;
+    u32 high = lights->count;
+    while (low < high)
+    {
+        u32 middle = (low + high)/2;
+        if (lights->objects[middle] < objectIndex)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    
+    if (low == lights->count || lights->objects[low] != objectIndex)
+        return 0.0f;
+    
+    f32 pickProbability = 0.0f;
+    switch (selection)
+    {
+        case LightSet::Selection::BVH:
+            pickProbability = light_bvh_probability(lights, low, point, normal);
+            break;
+        case LightSet::Selection::POWER:
+            pickProbability = lights->powerTable.probabilities[low];
+            break;
+        case LightSet::Selection::UNIFORM:
+            pickProbability = 1.0f/lights->count;
+            break;
+    }
+    
+    f32 cosMax = 0.0f;
+    f32 solidAngle = 0.0f;
+    if (pickProbability <= 0.0f || !light_cone(Sphere(object->pos(time), object->sphere.radius), point, &cosMax, &solidAngle))
+        return 0.0f;
+    
+    return (1.0f - environment_chance(world))*pickProbability/solidAngle;
+}
+
+static f32 environment_light_pdf(World* world, v3f dir)
+{
+    if (!world->environment.pixels)
+        return 0.0f;
+    
+    return environment_chance(world)*environment_pdf(&world->environment, dir);
+}
+
+static v4f emitted_light(Material* material)
+{
+    v4f colour = material->colour;
+    return v4f(colour.r*material->brightness, colour.g*material->brightness, colour.b*material->brightness);
+}
\ No newline at end of file
@@ -0,0 +1,95 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include "types.h"
+#include "geometry.h"
+#include "sampler.h"
+#include "alias_table.h"
+
+struct World;
+struct SphereObject;
+struct Material;
+
+// One node of the light BVH, laid out depth first like LinearBVH, with the first child right after its parent.
+// Each leaf holds one light.
+struct LightNode
+{
+    // the sphere around the box around the node's lights, which covers everywhere they go over the render interval
+    v3f centre;
+    f32 radiusSquared;
+    
+    // the total power of the node's lights
+    f32 power;
+    
+    // the second child for interior nodes, and the light for leaves, as an index into LightSet::objects
+    u32 index;
+    bool leaf;
+};
+
+// The spheres with emissive materials, which paths aim shadow rays at, and what sample_light picks between them with.
+// Instanced spheres are never sampled, but still give off light when they're hit.
+struct LightSet
+{
+    enum Selection
+    {
+        BVH, // walks down the light BVH, picking each child by how much light it could send the point, see light_importance
+        POWER, // picks in proportion to each light's total power, with an alias table, wherever the point is
+        UNIFORM // every light is as likely as any other
+    };
+    
+    // indices into World::objects, in order
+    u32 count;
+    u32* objects;
+    
+    // picks lights by power
+    AliasTable powerTable;
+    
+    u32 nodeCount;
+    LightNode* nodes;
+    
+    // For each light, which child the way down to it takes at each level of the BVH, as a bit for each level with
+    // the root's in the lowest bit. Set means the second child.
+    u32* trails;
+};
+
+// the names the light selections go by on the command line, in the order of LightSet::Selection
+static const char* LIGHT_SELECTION_NAMES[] = { "bvh", "power", "uniform" };
+
+// a direction from a point on a surface towards one of the world's lights
+struct LightSample
+{
+    v3f dir;
+    
+    // how far along dir the light's surface is, F32_MAX for the environment map
+    f32 distance;
+    
+    // the light it gives off towards the point
+    v4f emission;
+    
+    // the density dir was picked with over solid angle, including the chance of picking that light
+    f32 pdf;
+};
+
+// Finds the world's emissive spheres, and builds the structures for picking between them. Needs to be called again
+// whenever spheres are added, removed or given new materials.
+static void build_light_set(World* world);
+static void free_light_set(LightSet* lights);
+
+// Picks one of the world's lights with the given selection, then a direction towards it from point, evenly over the
+// cone its sphere fills. The normal is the surface's at point, which light from behind can't reach. The world's
+// environment map counts as one more light, which is sampled with its own alias table. Returns false if there are
+// no lights that could light the point, or point is inside the one picked.
+static bool sample_light(World* world, LightSet::Selection selection, v3f point, v3f normal, f32 time, Sampler* sampler,
+                         LightSample* outSample);
+
+// The density sample_light would pick the direction from point towards the object with. It's 0 for any object that
+// isn't one of the world's lights, like an instanced sphere, since sample_light could never have found it.
+static f32 light_pdf(World* world, LightSet::Selection selection, SphereObject* object, v3f point, v3f normal, f32 time);
+
+// the density sample_light would pick dir with by picking the environment map, 0 if the world doesn't have one
+static f32 environment_light_pdf(World* world, v3f dir);
+
+// the light an emissive material gives off
+static v4f emitted_light(Material* material);
+
+#endif //LIGHTS_H
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <assert.h>
 #include <math.h>
+#include <stdlib.h>
 
 #define WIN32_LEAN_AND_MEAN
 #define NOMINMAX
@@ -13,9 +14,27 @@
 #include "image.h"
 #include "file_io.h"
 #include "geometry.cpp"
+#include "warps.cpp"
+#include "sampler.cpp"
+#include "alias_table.cpp"
+#include "environment.cpp"
 #include "camera.cpp"
 #include "render_world.cpp"
+#include "shading.cpp"
 #include "scene_init.cpp"
+#include "traversal_stats.cpp"
+#include "ray_packet.cpp"
+#include "bvh.cpp"
+#include "lights.cpp"
+#include "wide_bvh.cpp"
+#include "motion_bvh.cpp"
+#include "dynamic_bvh.cpp"
+#include "instance_bvh.cpp"
+#include "scene_bvh.cpp"
+#include "bvh_cache.cpp"
+#include "wavefront.cpp"
+#include "adaptive_sampling.cpp"
+#include "progressive.cpp"
 
 #define FILE_EXT ".bmp"
 
@@ -25,6 +44,7 @@
 #define END_TIMED_SECTION(tag) LARGE_INTEGER endTime_##tag = {}; QueryPerformanceCounter(&endTime_##tag);
 #define PRINT_TIMED_SECTION_RESULT(tag, message, frequency) printf("%s %f seconds\n", message, (endTime_##tag.QuadPart - startTime_##tag.QuadPart) / (f64)frequency.QuadPart)
 
+// the defaults for the render options, which can all be changed on the command line
 // it seems like the sweet spot of pixel block size might be between 16 & 32
 #define PIXEL_BLOCK_SIZE 32
 #define NUM_THREADS 16
@@ -41,271 +61,281 @@
 #define IMAGE_WIDTH 800
 #endif
 
-struct BVH
-{
-    Rect3f boundingBox;
-    SphereObject* object; // only valid in the leaf nodes
-    
-    BVH* left;
-    BVH* right;
-};
+// paths whose throughput has dropped below this are ended at random, see survives_roulette
+#define ROULETTE_THRESHOLD 0.1f
+
+// with a time limit, the image is rendered in passes of this many samples per pixel until the time runs out
+#define TIME_LIMIT_PASS_SAMPLES 4
+#define UNLIMITED_SAMPLES 0xFFFFFFFF
+
+// 1 = binned surface area heuristic builder, 0 = the original random axis median split builder
+#define USE_SAH_BVH 1
+
+// children per BVH node, 2, 4 (SSE) or 8 (AVX)
+#define BVH_WIDTH 8
+
+// 1 = scenes with moving objects use a binary BVH whose boxes follow the objects through the render interval,
+// instead of boxes covering everywhere the objects go
+#define USE_MOTION_BVH 1
+
+// 1 = built BVHs are saved next to the executable and memory mapped back in by later runs of the same scene,
+// instead of being built every time
+#define USE_BVH_CACHE 1
+#define BVH_CACHE_PREFIX "bvh_cache_"
+
+// 1 = camera rays for each block of PACKET_WIDTH x PACKET_HEIGHT pixels are traced through the BVH together,
+// 0 = every ray is traced on its own. Only the wide BVH layouts trace packets, bounces are always traced alone.
+#define USE_RAY_PACKETS 1
+#define PACKET_WIDTH 4
+#define PACKET_HEIGHT (RAY_PACKET_SIZE/PACKET_WIDTH)
+
+// number of frames to render, each one starting ANIMATION_FRAME_TIME after the last with the objects carried along
+// by their velocity, and the BVH refit between frames instead of being rebuilt
+#define ANIMATION_FRAME_COUNT 1
+#define ANIMATION_FRAME_TIME 1.0f
+
+// 1 = instead of rendering normally, time moving spheres around between renders with a dynamic BVH against
+// rebuilding the BVH after every round of edits
+#define DYNAMIC_BVH_BENCHMARK 0
+#define DYNAMIC_BVH_BENCHMARK_ROUNDS 8
+#define DYNAMIC_BVH_BENCHMARK_EDITS 256
+
+// 1 = instead of rendering normally, render a reference image with lots of samples, then render the image with each
+// sampler at doubling samples per pixel and print how far each one is from the reference, so the cheapest sampler
+// for a kind of scene can be picked
+#define SAMPLER_BENCHMARK 0
+#define SAMPLER_BENCHMARK_REFERENCE_SAMPLES 1024
+#define SAMPLER_BENCHMARK_MAX_SAMPLES 64
+
+// 1 = instead of rendering normally, render a reference image with lots of samples, then render the image at
+// doubling samples per pixel with bounces picked evenly over the hemisphere and with bounces picked by the BSDF,
+// and print how far each one is from the reference
+#define BSDF_BENCHMARK 0
+#define BSDF_BENCHMARK_REFERENCE_SAMPLES 1024
+#define BSDF_BENCHMARK_MAX_SAMPLES 64
+
+// 1 = instead of rendering normally, turn more and more of the scene's spheres into lights, and for each light count
+// render a reference image with lots of samples, then render the image with each way of picking lights at the same
+// samples per pixel, and print how far each one is from the reference and how long it took
+#define LIGHT_BENCHMARK 0
+#define LIGHT_BENCHMARK_REFERENCE_SAMPLES 256
+#define LIGHT_BENCHMARK_SAMPLES 16
+#define LIGHT_BENCHMARK_MIN_LIGHTS 16
+#define LIGHT_BENCHMARK_MAX_LIGHTS 4096
+
+// the brightness of the lights is this over the light count, so the scene gets about as much light whatever the count
+#define LIGHT_BENCHMARK_TOTAL_BRIGHTNESS 1024.0f
+
+// 1 = instead of rendering, time the closed form warps in warps.h, one at a time and in batches, against drawing
+// points until one lands inside the shape
+#define WARP_BENCHMARK 0
+#define WARP_BENCHMARK_SAMPLES (1 << 22)
 
-static f32 intersection_test(Ray ray, BVH* bvh, f32 time, SphereObject** outObject)
+// how render_image traces the image, picked on the command line
+struct RenderSettings
 {
-    f32 tResult = F32_MAX;
-    const f32 MIN_T = 0.001f;
+    enum Engine
+    {
+        MEGAKERNEL, // each path is followed from the camera to the sky before the next one starts, by cast_ray
+        WAVEFRONT // all the paths of a block go through each stage of tracing together, see wavefront.h
+    };
     
-    if (!bvh)
-        return tResult;
+    Engine engine;
     
-    if (bvh->object) // reached a leaf node
-    {
-        *outObject = bvh->object;
-        
-        Sphere testSphere = bvh->object->sphere;
-        testSphere.pos += time*bvh->object->velocity;
-        
-        tResult = intersection_test(ray, testSphere);
-    }
-    else if (hit_test(ray, bvh->boundingBox))
-    {
-        SphereObject* leftObject = 0;
-        SphereObject* rightObject = 0;
-        
-        f32 tLeft = intersection_test(ray, bvh->left, time, &leftObject);
-        f32 tRight = intersection_test(ray, bvh->right, time, &rightObject);
-        
-        if (tLeft < tRight && tLeft > MIN_T)
-        {
-            tResult = tLeft;
-            *outObject = leftObject;
-        }
-        else if (tRight < tLeft && tRight > MIN_T)
-        {
-            tResult = tRight;
-            *outObject = rightObject;
-        }
-    }
+    // wavefront only, sorts each round of bounced rays so rays heading the same way through the same area are traced together
+    bool sortRays;
+    
+    PathSettings path;
+    
+    // the most samples a pixel gets, and all of them unless adaptive sampling is on
+    u32 samplesPerPixel;
+    
+    // progressive only, the image is rendered in passes of this many samples per pixel, with a checkpoint after each
+    u32 passSamples;
     
-    return tResult;
+    // the QueryPerformanceCounter value at which blocks stop taking samples, 0 if there's no time limit
+    s64 deadline;
+    
+    // where the random numbers come from, the same settings always give the same image, see Sampler
+    SamplerSettings sampler;
+    AdaptiveSettings adaptive;
+    
+    // the image is split into square blocks this many pixels across, which are handed out to threadCount threads
+    u32 blockSize;
+    u32 threadCount;
+};
+
+// Tests the world's planes when HasPlanes is set, and is empty otherwise, so the kernels below only pay for planes
+// in worlds that have some.
+template <bool HasPlanes>
+static inline void test_planes(Ray ray, World* world, SurfaceHit* hit)
+{
+    intersect_planes(ray, world, hit);
 }
 
-static void sort_render_objects(SphereObject* list, u32 startIndex, u32 endIndex, u32 sortAxis)
+template <>
+inline void test_planes<false>(Ray, World*, SurfaceHit*)
 {
-    assert(list);
-    assert(sortAxis >= 0 && sortAxis < 3);
-    assert(startIndex < endIndex);
-    
-    if (endIndex - startIndex == 1)
-        return;
-    else if (endIndex - startIndex == 2)
-    {
-        if (list[startIndex].pos()[sortAxis] > list[startIndex + 1].pos()[sortAxis])
-            SWAP(list[startIndex], list[startIndex + 1], SphereObject);
-    }
-    else
-    {
-        // just choose the first element as the pivot, though I could use any other method
-        u32 pivotIndex = startIndex;
-        
-        u32 splitIndex = startIndex + 1;
-        for (u32 i = startIndex + 1; i < endIndex; ++i)
-        {
-            if (list[i].pos()[sortAxis] < list[pivotIndex].pos()[sortAxis])
-            {
-                SWAP(list[i], list[splitIndex], SphereObject);
-                ++splitIndex;
-            }
-        }
-        
-        SWAP(list[pivotIndex], list[splitIndex - 1], SphereObject);
-        
-        sort_render_objects(list, startIndex, splitIndex, sortAxis);
-        
-        // only sort the other half if the pivot wasn't the largest element in the list
-        if (splitIndex != endIndex)
-            sort_render_objects(list, splitIndex, endIndex, sortAxis);
-    }
 }
 
-static BVH* build_bvh_tree(SphereObject* objects, u32 startIndex, u32 endIndex, f32 startTime = 0.0f, f32 endTime = 0.0f)
+// the closest of the planes and spheres the ray hits, if any
+template <bool HasPlanes>
+static SurfaceHit find_closest_hit(Ray ray, World* world, SceneBVH* bvh, f32 time)
 {
-    u32 sortAxis = random_u32(0, 3);
+    SurfaceHit hit = {};
+    hit.t = F32_MAX;
     
-    BVH* newNode = 0;
+    test_planes<HasPlanes>(ray, world, &hit);
     
-    if (endIndex - startIndex == 1)
-    {
-        newNode = (BVH*)memory_alloc(sizeof(BVH));
-        newNode->object = objects + startIndex;
-        newNode->boundingBox = objects[startIndex].get_bounding_box(startTime, endTime);
-    }
-    else
-    {
-        sort_render_objects(objects, startIndex, endIndex, sortAxis);
-        
-        u32 midIndex = (startIndex + endIndex)/2;
-        
-        BVH* leftNode = build_bvh_tree(objects, startIndex, midIndex, startTime, endTime);
-        BVH* rightNode = build_bvh_tree(objects, midIndex, endIndex, startTime, endTime);
-        
-        newNode = (BVH*)memory_alloc(sizeof(BVH));
-        newNode->left = leftNode;
-        newNode->right = rightNode;
-        newNode->boundingBox = bounding_box(leftNode->boundingBox, rightNode->boundingBox);
-    }
+    SphereObject* testObject = 0;
+    Sphere testSphere = Sphere();
+    f32 t = intersection_test(ray, bvh, time, hit.t, &testObject, &testSphere);
+    add_sphere_hit(ray, t, testObject, testSphere, world, &hit);
     
-    return newNode;
+    return hit;
 }
 
-// calculates reflectance for a material using Schlick's Approximation
-static f64 reflectance(f64 cosine, f64 refractRatio)
+// Tests the world's planes when HasPlanes is set, then the BVH, for anything in the way of the ray before tMax. Stops
+// at the first thing found, so it's cheaper than finding the closest hit.
+template <bool HasPlanes>
+static bool occluded(Ray ray, World* world, SceneBVH* bvh, f32 time, f32 tMax)
 {
-    f64 r0 = (1.0 - refractRatio) / (1.0 + refractRatio);
-    r0 = r0*r0;
+    if (HasPlanes && occluded_by_planes(ray, world, tMax))
+        return true;
     
-    return r0 + (1.0 - r0)*pow((1.0 - cosine), 5);
+    return occlusion_test(ray, bvh, time, tMax);
 }
 
-// returns colour of pixel after ray cast
-static v4f cast_ray(Ray ray, World* world, BVH* bvh, u32 maxDepth = 1, f32 time = 0.0f)
+// Follows a path on from a ray that has already been tested against the world, bouncing it off of whatever it hits
+// until it reaches the sky or a light, or is ended, and returns the light it brings back. At each diffuse or rough
+// metal surface a shadow ray is also aimed at one of the lights. Each ray traced is added to rayCount.
+template <bool HasPlanes>
+static v4f trace_path(Ray ray, SurfaceHit* firstHit, World* world, SceneBVH* bvh, PathSettings* pathSettings, Sampler* sampler,
+                      u64* rayCount, f32 time)
 {
-    v4f resultColour = v4f();
+    SurfaceHit hit = *firstHit;
     
-    if (maxDepth <= 0)
-        return Colour::BLACK;
+    // what the light arriving along the ray gets multiplied by on its way back to the camera
+    v4f throughput = Colour::WHITE;
     
-    const f32 MIN_T = 0.001f;
+    // the light the shadow rays have found so far, with the alpha of the path's sample
+    v4f light = Colour::BLACK;
     
-    f32 tClosest = F32_MAX;
-    v3f intersectNormal = v3f();
-    v3f intersectPoint = v3f();
-    Material* material = 0;
+    // NOTE: the shadow rays use the BSDF's density for their weights, so they're left out with uniform bounces
+    bool sampleLights = !pathSettings->skipLightSampling && !pathSettings->uniformBounces;
     
-    // checking for intersection
-    for (u32 i = 0; i < world->planeCount; ++i) // plane objects
-    {
-        f32 t = F32_MIN;
-        
-        Plane plane = world->planes[i].plane;
-        t = intersection_test(ray, plane);
-        
-        if (t > MIN_T && t < tClosest)
-        {
-            tClosest = t;
-            intersectPoint = ray.at(t);
-            intersectNormal= plane.normal;
-            material = &world->planes[i].material;
-        }
-    }
+    // the density the ray was picked with by the last bounce, 0 for camera rays and specular bounces, which a shadow
+    // ray couldn't have found the light it hits for
+    f32 bouncePdf = 0.0f;
     
-    SphereObject* testObject = 0;
-    f32 t = intersection_test(ray, bvh, time, &testObject);
-    if (t > MIN_T && t < tClosest)
-    {
-        assert(testObject);
-        
-        tClosest = t;
-        
-        Sphere testSphere = Sphere(testObject->sphere.pos + time*testObject->velocity, testObject->sphere.radius);
-        
-        intersectPoint = ray.at(t);
-        intersectNormal = normalize(intersectPoint - testSphere.pos);
-        
-        material = &testObject->material;
-    }
+    // the normal of the surface the last bounce left from, which the light BVH weighs the lights against
+    v3f bounceNormal = v3f();
     
-    // calculating colour for pixel
-    if (tClosest != F32_MAX && tClosest > 0)
+    for (u32 depth = 1;; ++depth)
     {
-        assert(material);
-        
-        if (material->type == Material::Type::DIFFUSE)
+        // if no collisions we draw the sky
+        if (hit.t == F32_MAX || hit.t <= 0)
         {
-            v3f scatterDirection = random_unit_vector() + intersectNormal;
-            if (near_zero(scatterDirection + intersectNormal))
-                scatterDirection = intersectNormal;
+            // the environment map is a light too, which the shadow ray from the last surface could have found
+            f32 weight = 1.0f;
+            if (sampleLights && bouncePdf > 0.0f && world->environment.pixels)
+                weight = mis_weight(bouncePdf, environment_light_pdf(world, ray.dir));
             
-            Ray reflectRay = Ray(intersectPoint, scatterDirection, false);
-            v4f rayColour = cast_ray(reflectRay, world, bvh, maxDepth - 1, time);
-            
-            // attenuate using the colour of the material
-            resultColour = hadamard(material->colour, rayColour);
+            return light + hadamard(throughput, background_colour(ray, world))*weight;
         }
-        else if (material->type == Material::Type::METAL)
+        
+        assert(hit.material);
+        
+        if (hit.material->type == Material::Type::EMISSIVE)
         {
-            // the reflected ray is calculated assuming the surface is a perfect mirror
-            v3f reflectedDir = reflect_direction(ray.dir, intersectNormal);
-            
-            if (material->roughness > 0.0f)
-            {
-                // we find a random point near the reflection point to make the reflection
-                // less clear
-                Sphere sphere = Sphere(intersectPoint + reflectedDir, material->roughness);
-                v3f randomPoint = random_point_in_sphere(&sphere);
-                
-                reflectedDir = randomPoint - intersectPoint;
-            }
-            
-            Ray reflectedRay = Ray(intersectPoint, reflectedDir, false);
+            // the shadow ray from the last surface could have found this light too, so the two share it
+            f32 weight = 1.0f;
+            if (sampleLights && bouncePdf > 0.0f)
+                weight = mis_weight(bouncePdf, light_pdf(world, pathSettings->lightSelection, hit.object, ray.origin, bounceNormal, time));
             
-            if (dot(reflectedDir, intersectNormal) > 0)
-            {
-                v4f rayColour = cast_ray(reflectedRay, world, bvh, maxDepth - 1, time);
-                resultColour = hadamard(material->colour, rayColour);
-            }
-            else
-                resultColour = Colour::BLACK;
+            return light + hadamard(throughput, emitted_light(hit.material))*weight;
         }
-        else if (material->type == Material::Type::DIALECTRIC)
+        
+        // NOTE: the last bounce would only be able to add black, so the path ends here
+        if (depth >= pathSettings->maxDepth)
+            return light;
+        
+        start_bounce(sampler, depth);
+        
+        BSDFSample bsdfSample = {};
+        bool sampled = pathSettings->uniformBounces ? sample_uniform_bounce(-ray.dir, &hit, sampler, &bsdfSample) :
+                                                      sample_bsdf(-ray.dir, &hit, sampler, &bsdfSample);
+        
+        if (sampleLights && !is_specular(hit.material))
         {
-            // TODO: make this a formal parameter somewhere
-            f32 worldIndex = 1.0f; // index of refraction of the world, air = 1.0
-            
-            f32 refractRatio = worldIndex/material->n;
-            if (dot(ray.dir, intersectNormal) > 0.0f) // if ray and normal in same direction
-                refractRatio = 1.0f/refractRatio;
-            
-            f32 cosTheta = dot(-ray.dir, intersectNormal);
-            f32 sinTheta = (f32)sqrt(1 - cosTheta*cosTheta);
-            
-            v3f newRayDir = v3f();
-            
-            bool internalReflection  = refractRatio * sinTheta > 1.0f;
-            // using Schlick's Approximation
-            bool shouldReflect = reflectance(cosTheta, refractRatio) > random_f64();
-            
-            if (internalReflection || shouldReflect)
-            {
-                // Refraction impossible, so the ray must reflect
-                newRayDir = reflect_direction(ray.dir, intersectNormal);
-            }
-            else
+            Ray shadowRay = Ray(v3f(), v3f());
+            f32 distance = 0.0f;
+            v4f directLight = v4f();
+            if (sample_direct_light(-ray.dir, &hit, world, pathSettings->lightSelection, time, sampler, &shadowRay, &distance, &directLight))
             {
-                // Refraction!
-                
-                v3f rayPerpendicular = (refractRatio)*(ray.dir + cosTheta*intersectNormal);
-                v3f rayParallel = (f32)(-sqrt( ABS_VALUE(1 - norm_squared(rayPerpendicular)))) * intersectNormal;
+                if (!occluded<HasPlanes>(shadowRay, world, bvh, time, distance))
+                    light = light + hadamard(throughput, directLight);
                 
-                newRayDir = rayPerpendicular + rayParallel;
+                ++*rayCount;
             }
-            
-            Ray newRay = Ray(intersectPoint, newRayDir, false);
-            
-            v4f rayColour = cast_ray(newRay, world, bvh, maxDepth - 1, time);
-            resultColour = hadamard(material->colour, rayColour);
         }
+        
+        if (!sampled)
+            return light;
+        
+        // the light brought back along the new direction is weighted by the BSDF, over how likely it was to be picked
+        throughput = hadamard(throughput, bsdf_weight(&bsdfSample));
+        bouncePdf = bsdfSample.specular ? 0.0f : bsdfSample.pdf;
+        bounceNormal = hit.normal;
+        
+        if (!survives_roulette(&throughput, pathSettings->rouletteThreshold, sampler))
+            return light;
+        
+        ray = Ray(hit.point, bsdfSample.lightDir);
+        hit = find_closest_hit<HasPlanes>(ray, world, bvh, time);
+        ++*rayCount;
     }
-    else
-    {
-        // if no collisions we draw a simple gradient
-        f32 ratio = 0.5f*(ray.dir.y + 1.0f);
-        resultColour = (1.0f - ratio)*Colour::WHITE + ratio*v4f(0.7f, 0.8f, 0.9f);
-    }
+}
+
+// returns colour of pixel after ray cast
+template <bool HasPlanes>
+static v4f cast_ray(Ray ray, World* world, SceneBVH* bvh, PathSettings* pathSettings, Sampler* sampler, u64* rayCount, f32 time = 0.0f)
+{
+    SurfaceHit hit = find_closest_hit<HasPlanes>(ray, world, bvh, time);
+    ++*rayCount;
+    
+    return trace_path<HasPlanes>(ray, &hit, world, bvh, pathSettings, sampler, rayCount, time);
+}
+
+// true once the deadline has passed, and never if there isn't one
+static inline bool past_deadline(s64 deadline)
+{
+    if (deadline == 0)
+        return false;
+    
+    LARGE_INTEGER now = {};
+    QueryPerformanceCounter(&now);
+    return now.QuadPart >= deadline;
+}
+
+// Picks a camera ray through a random point in the pixel, and the time it's traced at. Without motion blur every ray
+// is traced at the start of the render interval, and a pinhole camera skips sampling the lens.
+template <bool MotionBlur, bool ThinLens>
+static inline Ray camera_sample(Camera* camera, World* world, Image* image, u32 pixelX, u32 pixelY, Sampler* sampler, f32* outTime)
+{
+    v2f jitter = sample_v2f(sampler);
+    f32 u = (pixelX + jitter.x)/image->width;
+    f32 v = (pixelY - jitter.y)/image->height;
     
-    return resultColour;
+    *outTime = MotionBlur ? sample_f32(sampler, world->startTime, world->endTime) : world->startTime;
+    return ThinLens ? camera->get_ray(u, v, sampler) : camera->get_pinhole_ray(u, v);
 }
 
+struct ThreadData;
+
+// renders one block of pixels with the megakernel engine, see select_block_renderer
+typedef void (*BlockRenderer)(ThreadData* batchData);
+
 struct ThreadData
 {
     u32 startX, startY;
@@ -315,7 +345,17 @@ struct ThreadData
     
     Camera* camera;
     World* world;
-    BVH* bvh;
+    SceneBVH* bvh;
+    
+    RenderSettings* settings;
+    BlockRenderer renderBlock;
+    
+    // the megakernel engine adds samples to each pixel's running totals until it has sampleTarget of them
+    Accumulation* accumulation;
+    u32 sampleTarget;
+    
+    // the number of rays the block traced, for reporting rays per second
+    u64 rayCount;
 };
 
 void thread_batch_finished(void* objectContext, void* cleanupContext)
@@ -331,125 +371,241 @@ void thread_batch_finished(void* objectContext, void* cleanupContext)
     printf("Progress: %.2f%%\n", (f32)(*completedBlocks)/(f32)(*totalBlocks)*100.0f);
 }
 
-void run_thread_batch(TP_CALLBACK_INSTANCE* instance, void* data, TP_WORK* work)
+// The megakernel engine's inner loops, with a copy for each combination of the features a scene might not use, so
+// the common cases don't pay for motion blur, lens sampling or planes at every sample.
+template <bool MotionBlur, bool ThinLens, bool HasPlanes>
+static void render_block(ThreadData* batchData)
 {
-    UNREFERENCED_PARAMETER(instance);
-    UNREFERENCED_PARAMETER(work);
-    
-    ThreadData* batchData = (ThreadData*)data;
-    
+    AdaptiveSettings* adaptive = &batchData->settings->adaptive;
+    Accumulation* accumulation = batchData->accumulation;
+    u32 sampleTarget = batchData->sampleTarget;
+    s64 deadline = batchData->settings->deadline;
+    SamplerSettings* samplerSettings = &batchData->settings->sampler;
+    u64 rayCount = 0;
+
+#if USE_RAY_PACKETS
+    for (u32 packetY = batchData->startY; packetY < batchData->endY; packetY += PACKET_HEIGHT)
+    {
+        for (u32 packetX = batchData->startX; packetX < batchData->endX; packetX += PACKET_WIDTH)
+        {
+            // NOTE: the pixels that didn't get to this pass keep what they had from the last one
+            if (past_deadline(deadline))
+                break;
+            
+            PixelEstimate estimates[RAY_PACKET_SIZE] = {};
+            
+            // the pixels still taking samples, which leaves out any past the edge of the block
+            u32 activeLanes = 0;
+            for (u32 lane = 0; lane < RAY_PACKET_SIZE; ++lane)
+            {
+                u32 pixelX = packetX + lane % PACKET_WIDTH;
+                u32 pixelY = packetY + lane/PACKET_WIDTH;
+                
+                if (pixelX < batchData->endX && pixelY < batchData->endY)
+                {
+                    estimates[lane] = accumulation->pixels[pixelY*accumulation->width + pixelX];
+                    if (estimates[lane].count < sampleTarget && !has_converged(estimates + lane, adaptive))
+                        activeLanes |= 1 << lane;
+                }
+            }
+            
+            while (activeLanes)
+            {
+                RayPacket packet;
+                Sampler samplers[RAY_PACKET_SIZE];
+                
+                for (u32 lane = 0; lane < RAY_PACKET_SIZE; ++lane)
+                {
+                    // NOTE: pixels that are done still have a ray traced to fill the packet, it just isn't followed
+                    // any further
+                    u32 pixelX = packetX + lane % PACKET_WIDTH;
+                    u32 pixelY = packetY + lane/PACKET_WIDTH;
+                    
+                    samplers[lane] = make_sampler(samplerSettings, pixelX, pixelY, estimates[lane].count);
+                    
+                    f32 rayTime;
+                    Ray ray = camera_sample<MotionBlur, ThinLens>(batchData->camera, batchData->world, batchData->outputImage,
+                                                                  pixelX, pixelY, samplers + lane, &rayTime);
+                    set_packet_ray(&packet, lane, ray, rayTime);
+                }
+                
+                finish_ray_packet(&packet);
+                
+                // NOTE: the lanes filling out the packet are traced but never followed, so only the active ones count
+                rayCount += _mm_popcnt_u32(activeLanes);
+                
+                f32 tSpheres[RAY_PACKET_SIZE];
+                SphereObject* hitObjects[RAY_PACKET_SIZE] = {};
+                Sphere hitSpheres[RAY_PACKET_SIZE];
+                intersection_test(&packet, batchData->bvh, tSpheres, hitObjects, hitSpheres);
+                
+                // only the camera rays are traced as a packet, everything after the first hit goes one ray at a time
+                for (u32 lane = 0; lane < RAY_PACKET_SIZE; ++lane)
+                {
+                    if (!(activeLanes & (1 << lane)))
+                        continue;
+                    
+                    Ray ray = get_packet_ray(&packet, lane);
+                    
+                    SurfaceHit hit = {};
+                    hit.t = F32_MAX;
+                    test_planes<HasPlanes>(ray, batchData->world, &hit);
+                    add_sphere_hit(ray, tSpheres[lane], hitObjects[lane], hitSpheres[lane], batchData->world, &hit);
+                    
+                    v4f colour = trace_path<HasPlanes>(ray, &hit, batchData->world, batchData->bvh, &batchData->settings->path, samplers + lane,
+                                                       &rayCount, packet.time[lane]);
+                    
+                    add_sample(estimates + lane, colour);
+                    if (estimates[lane].count >= sampleTarget || has_converged(estimates + lane, adaptive))
+                        activeLanes &= ~(1 << lane);
+                }
+            }
+            
+            for (u32 lane = 0; lane < RAY_PACKET_SIZE; ++lane)
+            {
+                u32 pixelX = packetX + lane % PACKET_WIDTH;
+                u32 pixelY = packetY + lane/PACKET_WIDTH;
+                
+                if (pixelX < batchData->endX && pixelY < batchData->endY)
+                {
+                    accumulation->pixels[pixelY*accumulation->width + pixelX] = estimates[lane];
+                    if (estimates[lane].count > 0)
+                        set_pixel(batchData->outputImage, pixelX, pixelY, clamp(estimates[lane].mean, 0.0f, 1.0f));
+                }
+            }
+        }
+    }
+#else
     for (u32 pixelY = batchData->startY; pixelY < batchData->endY; ++pixelY)
     {
         for (u32 pixelX = batchData->startX; pixelX < batchData->endX; ++pixelX)
         {
-            v4f pixelColour = v4f();
+            // NOTE: the pixels that didn't get to this pass keep what they had from the last one
+            if (past_deadline(deadline))
+                break;
+            
+            PixelEstimate* estimate = accumulation->pixels + pixelY*accumulation->width + pixelX;
             
-            for (u32 sampleIndex = 0; sampleIndex < SAMPLES_PER_PIXEL; ++sampleIndex)
+            while (estimate->count < sampleTarget && !has_converged(estimate, adaptive))
             {
-                f32 rayTime = random_f32(batchData->world->startTime, batchData->world->endTime);
+                Sampler sampler = make_sampler(samplerSettings, pixelX, pixelY, estimate->count);
                 
-                f32 u = (pixelX + random_f32())/batchData->outputImage->width;
-                f32 v = (pixelY - random_f32())/batchData->outputImage->height;
-                
-                Ray ray = batchData->camera->get_ray(u, v);
-                pixelColour += cast_ray(ray, batchData->world, batchData->bvh, MAX_RAY_DEPTH, rayTime);
+                f32 rayTime;
+                Ray ray = camera_sample<MotionBlur, ThinLens>(batchData->camera, batchData->world, batchData->outputImage,
+                                                              pixelX, pixelY, &sampler, &rayTime);
+                v4f colour = cast_ray<HasPlanes>(ray, batchData->world, batchData->bvh, &batchData->settings->path, &sampler, &rayCount, rayTime);
+                add_sample(estimate, colour);
             }
             
-            pixelColour = clamp(pixelColour/SAMPLES_PER_PIXEL, 0.0f, 1.0f);
-            set_pixel(batchData->outputImage, pixelX, pixelY, pixelColour);
+            if (estimate->count > 0)
+                set_pixel(batchData->outputImage, pixelX, pixelY, clamp(estimate->mean, 0.0f, 1.0f));
         }
     }
+#endif
+    
+    batchData->rayCount = rayCount;
 }
 
-int main(int argc, char** argv)
+// the render_block specialization for the features the scene and camera actually use
+static BlockRenderer select_block_renderer(Camera* camera, World* world)
 {
-    if (argc < 2)
+    static const BlockRenderer renderers[8] =
     {
-        printf("ERROR: No output file name given.\n");
-        printf("USAGE: %s file_name\n", argv[0]);
-        return 1;
-    }
-    
-    char* fileName = argv[1];
-    if (!string_ends_with(fileName, FILE_EXT))
-        fileName = concat_strings(fileName, FILE_EXT);
-    else
-        duplicate_string(argv[1]);
-    
-    LARGE_INTEGER countsPerSecond = {};
-    QueryPerformanceFrequency(&countsPerSecond);
-    
-    Image image = {};
-    image.width = IMAGE_WIDTH;
-    image.height = (u32)(image.width/ASPECT_RATIO);
-    image.pixels = (v4f*)memory_alloc(sizeof(v4f)*image.width*image.height);
-    
-    fill_image(&image, Colour::BLACK);
-    
-    printf("Setting up rendering scene...\n");
-    
-    f32 aspectRatio = (f32)image.width/image.height;
-    
-    World world = {};
-    Camera camera = {};
+        render_block<false, false, false>, render_block<false, false, true>,
+        render_block<false, true, false>, render_block<false, true, true>,
+        render_block<true, false, false>, render_block<true, false, true>,
+        render_block<true, true, false>, render_block<true, true, true>
+    };
     
-    init_test_scene_2(&world, &camera, aspectRatio);
+    bool motionBlur = world->endTime > world->startTime;
+    bool thinLens = camera->has_lens();
+    bool hasPlanes = world->planeCount > 0;
     
-    printf("Building Bounding Volume Hierarchy...\n");
-    
-    START_TIMED_SECTION(BuildBVH);
-    
-    BVH* bvh = build_bvh_tree(world.objects, 0, world.objectCount, world.startTime, world.endTime);
-    assert(bvh);
+    return renderers[(motionBlur ? 4 : 0) + (thinLens ? 2 : 0) + (hasPlanes ? 1 : 0)];
+}
+
+void run_thread_batch(TP_CALLBACK_INSTANCE* instance, void* data, TP_WORK* work)
+{
+    UNREFERENCED_PARAMETER(instance);
+    UNREFERENCED_PARAMETER(work);
     
-    END_TIMED_SECTION(BuildBVH);
-    PRINT_TIMED_SECTION_RESULT(BuildBVH, "Built BVH in ", countsPerSecond);
+    ThreadData* batchData = (ThreadData*)data;
     
-    // start the ray tracing!
+    if (batchData->settings->engine == RenderSettings::Engine::WAVEFRONT)
+    {
+        batchData->rayCount = render_wavefront_block(batchData->outputImage, batchData->startX, batchData->startY, batchData->endX,
+                                                     batchData->endY, batchData->camera, batchData->world, batchData->bvh,
+                                                     batchData->settings->samplesPerPixel, &batchData->settings->path,
+                                                     batchData->settings->sortRays, &batchData->settings->sampler);
+        flush_traversal_stats();
+        return;
+    }
     
-    printf("Path-tracing begins...\n");
+    batchData->renderBlock(batchData);
+    flush_traversal_stats();
+}
+
+// Renders the whole image, splitting it into blocks of pixels that are handed out to a thread pool. The megakernel
+// engine adds samples to the accumulation until each pixel has sampleTarget of them, or starts from nothing and takes
+// the settings' samples per pixel if there is no accumulation. Returns the number of rays either engine traced.
+static u64 render_image(Image* image, Camera* camera, World* world, SceneBVH* bvh, RenderSettings* settings,
+                         Accumulation* accumulation = 0, u32 sampleTarget = 0)
+{
+    Accumulation imageAccumulation = {};
+    if (!accumulation)
+    {
+        imageAccumulation = make_accumulation(image->width, image->height);
+        accumulation = &imageAccumulation;
+        sampleTarget = settings->samplesPerPixel;
+    }
     
-    START_TIMED_SECTION(PathTracing);
+    u32 blockSize = settings->blockSize;
     
     // allocate and initialize all the batches of work to send to threads
-    u32 blocksPerRow = image.height/PIXEL_BLOCK_SIZE;
-    u32 blocksPerCol = image.width/PIXEL_BLOCK_SIZE;
+    // NOTE: an image smaller than a block is still one block
+    u32 blocksPerRow = MAX_VALUE(image->height/blockSize, 1);
+    u32 blocksPerCol = MAX_VALUE(image->width/blockSize, 1);
     
     u32 numBlocks = blocksPerRow*blocksPerCol;
+    BlockRenderer renderBlock = select_block_renderer(camera, world);
     
     ThreadData* threadData = (ThreadData*)memory_alloc(numBlocks*sizeof(ThreadData));
     for (u32 i = 0; i < numBlocks; ++i)
     {
         // TODO: would it be better to store this data in some global state so that it isn't duplicated for each thread?
-        threadData[i].outputImage = &image;
-        threadData[i].camera = &camera;
-        threadData[i].world = &world;
+        threadData[i].outputImage = image;
+        threadData[i].camera = camera;
+        threadData[i].world = world;
         threadData[i].bvh = bvh;
+        threadData[i].settings = settings;
+        threadData[i].renderBlock = renderBlock;
+        threadData[i].accumulation = accumulation;
+        threadData[i].sampleTarget = sampleTarget;
         
         // create pixel block that thread will operate on
         u32 startBlockX = i % blocksPerCol;
         u32 startBlockY = i/blocksPerCol;
         
-        threadData[i].startX = startBlockX * PIXEL_BLOCK_SIZE;
-        threadData[i].startY = startBlockY * PIXEL_BLOCK_SIZE;
+        threadData[i].startX = startBlockX * blockSize;
+        threadData[i].startY = startBlockY * blockSize;
         
         if (startBlockX == blocksPerCol - 1)
-            threadData[i].endX = image.width;
+            threadData[i].endX = image->width;
         else
-            threadData[i].endX = threadData[i].startX + PIXEL_BLOCK_SIZE;
+            threadData[i].endX = threadData[i].startX + blockSize;
         
         if (startBlockY == blocksPerRow - 1)
-            threadData[i].endY = image.height;
+            threadData[i].endY = image->height;
         else
-            threadData[i].endY = threadData[i].startY + PIXEL_BLOCK_SIZE;
+            threadData[i].endY = threadData[i].startY + blockSize;
     }
     
     // set up thread pool
     TP_POOL* threadPool = CreateThreadpool(0);
     assert(threadPool);
     
-    SetThreadpoolThreadMinimum(threadPool, NUM_THREADS);
-    SetThreadpoolThreadMaximum(threadPool, NUM_THREADS);
+    SetThreadpoolThreadMinimum(threadPool, settings->threadCount);
+    SetThreadpoolThreadMaximum(threadPool, settings->threadCount);
     
     // set up all the various callbacks used by the thread pool
     TP_CALLBACK_ENVIRON threadEnvironment;
@@ -475,21 +631,920 @@ int main(int argc, char** argv)
     CloseThreadpoolCleanupGroup(threadCleanupGroup);
     DestroyThreadpoolEnvironment(&threadEnvironment);
     CloseThreadpool(threadPool);
+
+#if BVH_TRAVERSAL_STATS
+    TraversalStats traversalStats = get_traversal_stats();
+    print_traversal_stats(&traversalStats);
+    reset_traversal_stats();
+#endif
+    
+    u64 rayCount = 0;
+    for (u32 i = 0; i < numBlocks; ++i)
+        rayCount += threadData[i].rayCount;
     
     memory_free(threadData);
     
-    END_TIMED_SECTION(PathTracing);
+    if (imageAccumulation.pixels)
+        free_accumulation(&imageAccumulation);
+    
+    return rayCount;
+}
+
+// Each round moves DYNAMIC_BVH_BENCHMARK_EDITS random spheres to a new spot nearby, the way dragging objects around
+// in an editor would, then renders. The edits are applied to a dynamic BVH as they happen, and then the same scene is
+// rendered again after rebuilding the BVH from scratch, so both the edit times and the render times can be compared.
+static void run_dynamic_bvh_benchmark(Image* image, Camera* camera, World* world, BVHBuildSettings* settings, SceneBVH::Layout rebuildLayout,
+                                      RenderSettings* renderSettings, LARGE_INTEGER countsPerSecond)
+{
+    SceneBVH dynamicBVH = build_scene_bvh(world, settings, SceneBVH::Layout::DYNAMIC);
+    
+    f64 dynamicEditTime = 0.0;
+    f64 dynamicRenderTime = 0.0;
+    f64 rebuildTime = 0.0;
+    f64 rebuildRenderTime = 0.0;
+    
+    for (u32 round = 0; round < DYNAMIC_BVH_BENCHMARK_ROUNDS; ++round)
+    {
+        START_TIMED_SECTION(Edit);
+        
+        for (u32 i = 0; i < DYNAMIC_BVH_BENCHMARK_EDITS; ++i)
+        {
+            u32 objectIndex = random_u32(0, world->objectCount);
+            SphereObject object = world->objects[objectIndex];
+            
+            remove_dynamic_bvh_object(&dynamicBVH.dynamic, world, objectIndex);
+            world->remove_sphere(objectIndex);
+            
+            v3f offset = v3f(random_f32(-2.0f, 2.0f), 0.0f, random_f32(-2.0f, 2.0f));
+            world->add_sphere(object.sphere.pos + offset, object.sphere.radius, object.material, object.velocity);
+            insert_dynamic_bvh_object(&dynamicBVH.dynamic, world, world->objectCount - 1);
+        }
+        
+        END_TIMED_SECTION(Edit);
+        
+        // NOTE: moving a sphere changes its index, so the lights are gathered again, the same for both BVHs
+        build_light_set(world);
+        
+        START_TIMED_SECTION(DynamicRender);
+        render_image(image, camera, world, &dynamicBVH, renderSettings);
+        END_TIMED_SECTION(DynamicRender);
+        
+        START_TIMED_SECTION(Rebuild);
+        SceneBVH rebuiltBVH = build_scene_bvh(world, settings, rebuildLayout);
+        END_TIMED_SECTION(Rebuild);
+        
+        START_TIMED_SECTION(RebuildRender);
+        render_image(image, camera, world, &rebuiltBVH, renderSettings);
+        END_TIMED_SECTION(RebuildRender);
+        
+        // NOTE: the rebuilt tree's leaves test a batch of spheres for the cost of one, which the dynamic tree's leaves
+        // never hold, so it's split down to one object per leaf as well to compare the shapes of the two trees
+        DynamicBVH rebuiltSingleLeaves = make_dynamic_bvh(&rebuiltBVH.tree);
+        f32 dynamicCost = dynamic_bvh_cost(&dynamicBVH.dynamic, settings->traversalCost);
+        f32 rebuiltCost = dynamic_bvh_cost(&rebuiltSingleLeaves, settings->traversalCost);
+        free_dynamic_bvh(&rebuiltSingleLeaves);
+        
+        printf("Round %u: SAH cost with one object per leaf, dynamic BVH %.2f, rebuilt %.2f (%.2f with its batched leaves)\n",
+               round, dynamicCost, rebuiltCost, rebuiltBVH.builtCost);
+        
+        free_scene_bvh(&rebuiltBVH);
+        
+        dynamicEditTime += (endTime_Edit.QuadPart - startTime_Edit.QuadPart)/(f64)countsPerSecond.QuadPart;
+        dynamicRenderTime += (endTime_DynamicRender.QuadPart - startTime_DynamicRender.QuadPart)/(f64)countsPerSecond.QuadPart;
+        rebuildTime += (endTime_Rebuild.QuadPart - startTime_Rebuild.QuadPart)/(f64)countsPerSecond.QuadPart;
+        rebuildRenderTime += (endTime_RebuildRender.QuadPart - startTime_RebuildRender.QuadPart)/(f64)countsPerSecond.QuadPart;
+    }
+    
+    f64 rounds = (f64)DYNAMIC_BVH_BENCHMARK_ROUNDS;
+    printf("%u edits per round, average over %u rounds:\n", DYNAMIC_BVH_BENCHMARK_EDITS, DYNAMIC_BVH_BENCHMARK_ROUNDS);
+    printf("Dynamic BVH: %f seconds editing + %f seconds rendering = %f seconds\n",
+           dynamicEditTime/rounds, dynamicRenderTime/rounds, (dynamicEditTime + dynamicRenderTime)/rounds);
+    printf("Rebuilt BVH: %f seconds building + %f seconds rendering = %f seconds\n",
+           rebuildTime/rounds, rebuildRenderTime/rounds, (rebuildTime + rebuildRenderTime)/rounds);
+    
+    free_scene_bvh(&dynamicBVH);
+}
+
+// the root mean square difference between the colours of two images of the same size
+static f64 image_rms_error(Image* image, Image* reference)
+{
+    assert(image->width == reference->width && image->height == reference->height);
+    
+    f64 sumSquares = 0.0;
+    for (u32 i = 0; i < image->width*image->height; ++i)
+    {
+        v4f difference = image->pixels[i] - reference->pixels[i];
+        sumSquares += difference.r*difference.r + difference.g*difference.g + difference.b*difference.b;
+    }
+    
+    return sqrt(sumSquares/(3.0*image->width*image->height));
+}
+
+// a set of render settings a benchmark compares against the others, and the name its results are printed under
+struct BenchmarkVariant
+{
+    const char* name;
+    RenderSettings settings;
+};
+
+// Renders a reference image with referenceSamples per pixel, then renders each variant at every doubling of the
+// samples per pixel from minSamples up to maxSamples, and prints how far each render is from the reference and how
+// long it took.
+static void run_error_benchmark(Image* image, Camera* camera, World* world, SceneBVH* bvh, RenderSettings* referenceSettings,
+                                u32 referenceSamples, BenchmarkVariant* variants, u32 variantCount, u32 minSamples, u32 maxSamples,
+                                LARGE_INTEGER countsPerSecond)
+{
+    Image reference = *image;
+    reference.pixels = (v4f*)memory_alloc(sizeof(v4f)*image->width*image->height);
+    
+    // NOTE: every render takes all its samples, so everything is compared at exactly the same sample counts
+    RenderSettings settings = *referenceSettings;
+    settings.adaptive.errorThreshold = 0.0f;
+    settings.deadline = 0;
+    settings.samplesPerPixel = referenceSamples;
+    settings.sampler.sampleCount = referenceSamples;
     
-    printf("Ray-tracing finished!\n");
-    PRINT_TIMED_SECTION_RESULT(PathTracing, "Time elapsed:", countsPerSecond);
-    printf("Writing output to file: %s\n", fileName);
+    // the reference gets a seed of its own so its noise has nothing in common with the renders it's compared to
+    settings.sampler.seed += 1;
+    
+    START_TIMED_SECTION(Reference);
+    render_image(&reference, camera, world, bvh, &settings);
+    END_TIMED_SECTION(Reference);
+    PRINT_TIMED_SECTION_RESULT(Reference, "Rendered the reference image in", countsPerSecond);
+    
+    for (u32 variant = 0; variant < variantCount; ++variant)
+    {
+        for (u32 samples = minSamples; samples <= maxSamples; samples *= 2)
+        {
+            settings = variants[variant].settings;
+            settings.adaptive.errorThreshold = 0.0f;
+            settings.deadline = 0;
+            settings.samplesPerPixel = samples;
+            settings.sampler.sampleCount = samples;
+            
+            START_TIMED_SECTION(Render);
+            render_image(image, camera, world, bvh, &settings);
+            END_TIMED_SECTION(Render);
+            
+            f64 seconds = (endTime_Render.QuadPart - startTime_Render.QuadPart)/(f64)countsPerSecond.QuadPart;
+            printf("%-10s %4u samples per pixel: RMS error %.5f in %f seconds\n", variants[variant].name, samples,
+                   image_rms_error(image, &reference), seconds);
+        }
+    }
     
-    write_image_to_bmp(fileName, &image);
+    memory_free(reference.pixels);
+}
+
+static void run_sampler_benchmark(Image* image, Camera* camera, World* world, SceneBVH* bvh, RenderSettings* renderSettings,
+                                  LARGE_INTEGER countsPerSecond)
+{
+    RenderSettings referenceSettings = *renderSettings;
+    referenceSettings.sampler.type = Sampler::Type::SOBOL;
+    
+    BenchmarkVariant variants[ARRAY_LENGTH(SAMPLER_NAMES)];
+    for (u32 type = 0; type < ARRAY_LENGTH(SAMPLER_NAMES); ++type)
+    {
+        variants[type].name = SAMPLER_NAMES[type];
+        variants[type].settings = *renderSettings;
+        variants[type].settings.sampler.type = (Sampler::Type)type;
+    }
+    
+    run_error_benchmark(image, camera, world, bvh, &referenceSettings, SAMPLER_BENCHMARK_REFERENCE_SAMPLES, variants, ARRAY_LENGTH(variants), 1,
+                        SAMPLER_BENCHMARK_MAX_SAMPLES, countsPerSecond);
+}
+
+static void run_bsdf_benchmark(Image* image, Camera* camera, World* world, SceneBVH* bvh, RenderSettings* renderSettings,
+                               LARGE_INTEGER countsPerSecond)
+{
+    // NOTE: uniformBounces only applies to the megakernel
+    RenderSettings referenceSettings = *renderSettings;
+    referenceSettings.engine = RenderSettings::Engine::MEGAKERNEL;
+    referenceSettings.path.uniformBounces = false;
+    
+    // NOTE: shadow rays would find most of the light either way, hiding the difference the bounces make
+    referenceSettings.path.skipLightSampling = true;
+    
+    BenchmarkVariant variants[2];
+    variants[0].name = "uniform";
+    variants[0].settings = referenceSettings;
+    variants[0].settings.path.uniformBounces = true;
+    variants[1].name = "bsdf";
+    variants[1].settings = referenceSettings;
+    
+    run_error_benchmark(image, camera, world, bvh, &referenceSettings, BSDF_BENCHMARK_REFERENCE_SAMPLES, variants, ARRAY_LENGTH(variants), 1,
+                        BSDF_BENCHMARK_MAX_SAMPLES, countsPerSecond);
+}
+
+// Each round turns lightCount of the world's spheres into lights, spread evenly through its objects, on top of the
+// lights it already had. The spheres get their own materials back before the next round.
+static void run_light_benchmark(Image* image, Camera* camera, World* world, SceneBVH* bvh, RenderSettings* renderSettings,
+                                LARGE_INTEGER countsPerSecond)
+{
+    RenderSettings referenceSettings = *renderSettings;
+    referenceSettings.path.skipLightSampling = false;
+    referenceSettings.path.lightSelection = LightSet::Selection::BVH;
+    
+    BenchmarkVariant variants[ARRAY_LENGTH(LIGHT_SELECTION_NAMES)];
+    for (u32 selection = 0; selection < ARRAY_LENGTH(LIGHT_SELECTION_NAMES); ++selection)
+    {
+        variants[selection].name = LIGHT_SELECTION_NAMES[selection];
+        variants[selection].settings = referenceSettings;
+        variants[selection].settings.path.lightSelection = (LightSet::Selection)selection;
+    }
+    
+    u32* materials = (u32*)memory_alloc(world->objectCount*sizeof(u32));
+    for (u32 i = 0; i < world->objectCount; ++i)
+        materials[i] = world->objects[i].material;
+    
+    for (u32 lightCount = LIGHT_BENCHMARK_MIN_LIGHTS; lightCount <= MIN_VALUE(world->objectCount, LIGHT_BENCHMARK_MAX_LIGHTS); lightCount *= 4)
+    {
+        u32 lightMaterial = world->add_material(Material::emissive(Colour::WHITE, LIGHT_BENCHMARK_TOTAL_BRIGHTNESS/lightCount));
+        
+        u32 stride = world->objectCount/lightCount;
+        for (u32 i = 0; i < lightCount; ++i)
+            world->objects[i*stride].material = lightMaterial;
+        
+        build_light_set(world);
+        
+        printf("%u lights:\n", world->lights.count);
+        run_error_benchmark(image, camera, world, bvh, &referenceSettings, LIGHT_BENCHMARK_REFERENCE_SAMPLES, variants, ARRAY_LENGTH(variants),
+                            LIGHT_BENCHMARK_SAMPLES, LIGHT_BENCHMARK_SAMPLES, countsPerSecond);
+        
+        for (u32 i = 0; i < world->objectCount; ++i)
+            world->objects[i].material = materials[i];
+    }
+    
+    build_light_set(world);
+    
+    memory_free(materials);
+}
+
+// the rejection loops the closed form warps replaced, kept to compare them against
+static v3f rejection_unit_vector(Sampler* sampler)
+{
+    v3f randomPoint = v3f();
+    bool found = false;
+    
+    while (!found)
+    {
+        randomPoint = v3f(sample_f32(sampler, -1.0f, 1.0f), sample_f32(sampler, -1.0f, 1.0f), sample_f32(sampler, -1.0f, 1.0f));
+        
+        if (norm(randomPoint) <= 1.0f)
+            found = true;
+    }
+    
+    return normalize(randomPoint);
+}
+
+static v2f rejection_point_in_unit_circle(Sampler* sampler)
+{
+    v2f randomPoint = v2f();
+    bool found = false;
+    
+    while (!found)
+    {
+        randomPoint = v2f(sample_f32(sampler, -1.0f, 1.0f), sample_f32(sampler, -1.0f, 1.0f));
+        
+        if (randomPoint.x*randomPoint.x + randomPoint.y*randomPoint.y <= 1.0f)
+            found = true;
+    }
+    
+    return randomPoint;
+}
+
+static void print_warp_timing(char* name, LARGE_INTEGER startTime, LARGE_INTEGER endTime, LARGE_INTEGER countsPerSecond, u64 numbersDrawn)
+{
+    f64 nanoseconds = (endTime.QuadPart - startTime.QuadPart)*1000000000.0/countsPerSecond.QuadPart;
+    printf("%-36s %6.2f ns per sample, %.2f random numbers each\n", name, nanoseconds/WARP_BENCHMARK_SAMPLES,
+           (f64)numbersDrawn/WARP_BENCHMARK_SAMPLES);
+}
+
+static void run_warp_benchmark(LARGE_INTEGER countsPerSecond)
+{
+    // NOTE: the plain random sampler is the cheapest, so it hides the least of the cost of the warps themselves.
+    // Every version draws its own numbers, since how many the rejection loops need is part of what they cost.
+    SamplerSettings samplerSettings = {};
+    samplerSettings.type = Sampler::Type::RANDOM;
+    
+    const u32 count = WARP_BENCHMARK_SAMPLES;
+    f32* arrays = (f32*)memory_alloc(8*count*sizeof(f32));
+    f32* samples[2] = { arrays, arrays + count };
+    f32* normals[3] = { arrays + 2*count, arrays + 3*count, arrays + 4*count };
+    f32* dirs[3] = { arrays + 5*count, arrays + 6*count, arrays + 7*count };
+    
+    for (u32 i = 0; i < count; ++i)
+    {
+        Sampler sampler = make_sampler(&samplerSettings, i, 1, 0);
+        v3f normal = warp_uniform_sphere(sample_v2f(&sampler));
+        for (u32 axis = 0; axis < 3; ++axis)
+            normals[axis][i] = normal.e[axis];
+    }
+    
+    // summed up and printed so none of the work can be optimized away
+    f32 checksum = 0.0f;
+    u64 numbersDrawn = 0;
+    
+    START_TIMED_SECTION(RejectionSphere);
+    for (u32 i = 0; i < count; ++i)
+    {
+        Sampler sampler = make_sampler(&samplerSettings, i, 0, 0);
+        checksum += rejection_unit_vector(&sampler).x;
+        numbersDrawn += sampler.dimension;
+    }
+    END_TIMED_SECTION(RejectionSphere);
+    print_warp_timing("Unit vector, rejection", startTime_RejectionSphere, endTime_RejectionSphere, countsPerSecond, numbersDrawn);
+    
+    START_TIMED_SECTION(Sphere);
+    for (u32 i = 0; i < count; ++i)
+    {
+        Sampler sampler = make_sampler(&samplerSettings, i, 0, 0);
+        checksum += warp_uniform_sphere(sample_v2f(&sampler)).x;
+    }
+    END_TIMED_SECTION(Sphere);
+    print_warp_timing("Unit vector, closed form", startTime_Sphere, endTime_Sphere, countsPerSecond, 2ull*count);
+    
+    START_TIMED_SECTION(SphereBatch);
+    for (u32 i = 0; i < count; ++i)
+    {
+        Sampler sampler = make_sampler(&samplerSettings, i, 0, 0);
+        v2f sample = sample_v2f(&sampler);
+        samples[0][i] = sample.x;
+        samples[1][i] = sample.y;
+    }
+    warp_uniform_sphere_batch(samples, count, dirs);
+    END_TIMED_SECTION(SphereBatch);
+    checksum += dirs[0][count/2];
+    print_warp_timing("Unit vector, closed form batch", startTime_SphereBatch, endTime_SphereBatch, countsPerSecond, 2ull*count);
+    
+    numbersDrawn = 0;
+    START_TIMED_SECTION(RejectionDisk);
+    for (u32 i = 0; i < count; ++i)
+    {
+        Sampler sampler = make_sampler(&samplerSettings, i, 0, 0);
+        checksum += rejection_point_in_unit_circle(&sampler).x;
+        numbersDrawn += sampler.dimension;
+    }
+    END_TIMED_SECTION(RejectionDisk);
+    print_warp_timing("Point in disk, rejection", startTime_RejectionDisk, endTime_RejectionDisk, countsPerSecond, numbersDrawn);
+    
+    START_TIMED_SECTION(Disk);
+    for (u32 i = 0; i < count; ++i)
+    {
+        Sampler sampler = make_sampler(&samplerSettings, i, 0, 0);
+        checksum += warp_concentric_disk(sample_v2f(&sampler)).x;
+    }
+    END_TIMED_SECTION(Disk);
+    print_warp_timing("Point in disk, closed form", startTime_Disk, endTime_Disk, countsPerSecond, 2ull*count);
+    
+    START_TIMED_SECTION(DiskBatch);
+    for (u32 i = 0; i < count; ++i)
+    {
+        Sampler sampler = make_sampler(&samplerSettings, i, 0, 0);
+        v2f sample = sample_v2f(&sampler);
+        samples[0][i] = sample.x;
+        samples[1][i] = sample.y;
+    }
+    warp_concentric_disk_batch(samples, count, dirs);
+    END_TIMED_SECTION(DiskBatch);
+    checksum += dirs[0][count/2];
+    print_warp_timing("Point in disk, closed form batch", startTime_DiskBatch, endTime_DiskBatch, countsPerSecond, 2ull*count);
+    
+    // the diffuse bounce, which used to be a unit vector added to the normal
+    numbersDrawn = 0;
+    START_TIMED_SECTION(RejectionCosine);
+    for (u32 i = 0; i < count; ++i)
+    {
+        Sampler sampler = make_sampler(&samplerSettings, i, 0, 0);
+        v3f normal = v3f(normals[0][i], normals[1][i], normals[2][i]);
+        checksum += normalize(rejection_unit_vector(&sampler) + normal).x;
+        numbersDrawn += sampler.dimension;
+    }
+    END_TIMED_SECTION(RejectionCosine);
+    print_warp_timing("Cosine hemisphere, rejection", startTime_RejectionCosine, endTime_RejectionCosine, countsPerSecond, numbersDrawn);
+    
+    START_TIMED_SECTION(Cosine);
+    for (u32 i = 0; i < count; ++i)
+    {
+        Sampler sampler = make_sampler(&samplerSettings, i, 0, 0);
+        v3f normal = v3f(normals[0][i], normals[1][i], normals[2][i]);
+        checksum += warp_cosine_hemisphere(sample_v2f(&sampler), normal).x;
+    }
+    END_TIMED_SECTION(Cosine);
+    print_warp_timing("Cosine hemisphere, closed form", startTime_Cosine, endTime_Cosine, countsPerSecond, 2ull*count);
+    
+    START_TIMED_SECTION(CosineBatch);
+    for (u32 i = 0; i < count; ++i)
+    {
+        Sampler sampler = make_sampler(&samplerSettings, i, 0, 0);
+        v2f sample = sample_v2f(&sampler);
+        samples[0][i] = sample.x;
+        samples[1][i] = sample.y;
+    }
+    warp_cosine_hemisphere_batch(samples, normals, count, dirs);
+    END_TIMED_SECTION(CosineBatch);
+    checksum += dirs[0][count/2];
+    print_warp_timing("Cosine hemisphere, closed form batch", startTime_CosineBatch, endTime_CosineBatch, countsPerSecond, 2ull*count);
+    
+    START_TIMED_SECTION(GGX);
+    for (u32 i = 0; i < count; ++i)
+    {
+        Sampler sampler = make_sampler(&samplerSettings, i, 0, 0);
+        v3f normal = v3f(normals[0][i], normals[1][i], normals[2][i]);
+        checksum += warp_ggx_normal(sample_v2f(&sampler), 0.3f, normal).x;
+    }
+    END_TIMED_SECTION(GGX);
+    print_warp_timing("GGX normal, closed form", startTime_GGX, endTime_GGX, countsPerSecond, 2ull*count);
+    
+    START_TIMED_SECTION(GGXBatch);
+    for (u32 i = 0; i < count; ++i)
+    {
+        Sampler sampler = make_sampler(&samplerSettings, i, 0, 0);
+        v2f sample = sample_v2f(&sampler);
+        samples[0][i] = sample.x;
+        samples[1][i] = sample.y;
+    }
+    warp_ggx_normal_batch(samples, 0.3f, normals, count, dirs);
+    END_TIMED_SECTION(GGXBatch);
+    checksum += dirs[0][count/2];
+    print_warp_timing("GGX normal, closed form batch", startTime_GGXBatch, endTime_GGXBatch, countsPerSecond, 2ull*count);
+    
+    printf("Checksum: %f\n", checksum);
+    
+    memory_free(arrays);
+}
+
+// inserts the frame number before the extension of the output file, so out.bmp becomes out_0001.bmp
+static char* frame_file_name(char* fileName, u32 frame)
+{
+    u32 nameLength = string_length(fileName) - string_length(FILE_EXT);
+    u32 resultSize = nameLength + string_length(FILE_EXT) + 16;
+    
+    char* result = (char*)memory_alloc(resultSize);
+    snprintf(result, resultSize, "%.*s_%04u%s", (int)nameLength, fileName, frame, FILE_EXT);
+    
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("ERROR: No output file name given.\n");
+        printf("USAGE: %s file_name [-wavefront] [-sortrays] [-scene 1-6] [-maxdepth bounces] [-roulette threshold] [-nonee]\n"
+               "       [-spp samples] [-width pixels] [-blocksize pixels] [-threads count]\n"
+               "       [-adaptive error] [-minspp samples] [-heatmap file_name] [-progressive samples] [-checkpoint file_name]\n"
+               "       [-timelimit seconds] [-seed number] [-sampler random|stratified|sobol|rank1] [-lights bvh|power|uniform]\n"
+               "       [-envmap file_name.pfm]\n", argv[0]);
+        return 1;
+    }
+    
+    char* fileName = argv[1];
+    if (!string_ends_with(fileName, FILE_EXT))
+        fileName = concat_strings(fileName, FILE_EXT);
+    else
+        duplicate_string(argv[1]);
+    
+    RenderSettings renderSettings = {};
+    renderSettings.engine = RenderSettings::Engine::MEGAKERNEL;
+    renderSettings.path.maxDepth = MAX_RAY_DEPTH;
+    renderSettings.path.rouletteThreshold = ROULETTE_THRESHOLD;
+    renderSettings.samplesPerPixel = SAMPLES_PER_PIXEL;
+    renderSettings.blockSize = PIXEL_BLOCK_SIZE;
+    renderSettings.threadCount = NUM_THREADS;
+    renderSettings.adaptive.minSamples = ADAPTIVE_MIN_SAMPLES;
+    renderSettings.sampler.type = Sampler::Type::SOBOL;
+    u32 imageWidth = IMAGE_WIDTH;
+    char* heatmapFileName = 0;
+    char* checkpointFileName = 0;
+    char* environmentFileName = 0;
+    f64 timeLimit = 0.0;
+    bool samplesGiven = false;
+    u32 sceneNumber = 2;
+    
+    for (s32 i = 2; i < argc; ++i)
+    {
+        if (strings_equal(argv[i], "-wavefront"))
+            renderSettings.engine = RenderSettings::Engine::WAVEFRONT;
+        else if (strings_equal(argv[i], "-sortrays"))
+        {
+            renderSettings.engine = RenderSettings::Engine::WAVEFRONT;
+            renderSettings.sortRays = true;
+        }
+        else if (strings_equal(argv[i], "-scene") && i + 1 < argc)
+            sceneNumber = (u32)atoi(argv[++i]);
+        else if (strings_equal(argv[i], "-maxdepth") && i + 1 < argc)
+        {
+            s32 maxDepth = atoi(argv[++i]);
+            renderSettings.path.maxDepth = (u32)MAX_VALUE(maxDepth, 1);
+        }
+        else if (strings_equal(argv[i], "-roulette") && i + 1 < argc)
+        {
+            f32 threshold = (f32)atof(argv[++i]);
+            renderSettings.path.rouletteThreshold = MAX_VALUE(threshold, 0.0f);
+        }
+        else if (strings_equal(argv[i], "-nonee"))
+            renderSettings.path.skipLightSampling = true;
+        else if (strings_equal(argv[i], "-spp") && i + 1 < argc)
+        {
+            s32 samples = atoi(argv[++i]);
+            renderSettings.samplesPerPixel = (u32)MAX_VALUE(samples, 1);
+            samplesGiven = true;
+        }
+        else if (strings_equal(argv[i], "-width") && i + 1 < argc)
+        {
+            s32 width = atoi(argv[++i]);
+            imageWidth = (u32)MAX_VALUE(width, 16);
+        }
+        else if (strings_equal(argv[i], "-blocksize") && i + 1 < argc)
+        {
+            s32 blockSize = atoi(argv[++i]);
+            renderSettings.blockSize = (u32)MAX_VALUE(blockSize, 1);
+        }
+        else if (strings_equal(argv[i], "-threads") && i + 1 < argc)
+        {
+            s32 threadCount = atoi(argv[++i]);
+            renderSettings.threadCount = (u32)MAX_VALUE(threadCount, 1);
+        }
+        else if (strings_equal(argv[i], "-adaptive"))
+        {
+            // the error threshold is optional
+            f32 threshold = ADAPTIVE_ERROR_THRESHOLD;
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                threshold = (f32)atof(argv[++i]);
+            renderSettings.adaptive.errorThreshold = MAX_VALUE(threshold, 0.0f);
+        }
+        else if (strings_equal(argv[i], "-minspp") && i + 1 < argc)
+        {
+            s32 minSamples = atoi(argv[++i]);
+            renderSettings.adaptive.minSamples = (u32)MAX_VALUE(minSamples, 2);
+        }
+        else if (strings_equal(argv[i], "-heatmap") && i + 1 < argc)
+        {
+            heatmapFileName = argv[++i];
+            if (!string_ends_with(heatmapFileName, FILE_EXT))
+                heatmapFileName = concat_strings(heatmapFileName, FILE_EXT);
+        }
+        else if (strings_equal(argv[i], "-progressive") && i + 1 < argc)
+        {
+            s32 passSamples = atoi(argv[++i]);
+            renderSettings.passSamples = (u32)MAX_VALUE(passSamples, 1);
+        }
+        else if (strings_equal(argv[i], "-checkpoint") && i + 1 < argc)
+            checkpointFileName = argv[++i];
+        else if (strings_equal(argv[i], "-seed") && i + 1 < argc)
+            renderSettings.sampler.seed = (u32)strtoul(argv[++i], 0, 10);
+        else if (strings_equal(argv[i], "-sampler") && i + 1 < argc)
+        {
+            char* samplerName = argv[++i];
+            u32 type = 0;
+            while (type < ARRAY_LENGTH(SAMPLER_NAMES) && !strings_equal(samplerName, (char*)SAMPLER_NAMES[type]))
+                ++type;
+            
+            if (type == ARRAY_LENGTH(SAMPLER_NAMES))
+            {
+                printf("ERROR: There is no %s sampler, the samplers are random, stratified, sobol and rank1\n", samplerName);
+                return 1;
+            }
+            renderSettings.sampler.type = (Sampler::Type)type;
+        }
+        else if (strings_equal(argv[i], "-lights") && i + 1 < argc)
+        {
+            char* selectionName = argv[++i];
+            u32 selection = 0;
+            while (selection < ARRAY_LENGTH(LIGHT_SELECTION_NAMES) && !strings_equal(selectionName, (char*)LIGHT_SELECTION_NAMES[selection]))
+                ++selection;
+            
+            if (selection == ARRAY_LENGTH(LIGHT_SELECTION_NAMES))
+            {
+                printf("ERROR: Lights can't be picked by %s, they can be picked by bvh, power or uniform\n", selectionName);
+                return 1;
+            }
+            renderSettings.path.lightSelection = (LightSet::Selection)selection;
+        }
+        else if (strings_equal(argv[i], "-envmap") && i + 1 < argc)
+        {
+            environmentFileName = argv[++i];
+        }
+        else if (strings_equal(argv[i], "-timelimit") && i + 1 < argc)
+        {
+            f64 seconds = atof(argv[++i]);
+            timeLimit = MAX_VALUE(seconds, 0.0);
+        }
+        else
+        {
+            printf("ERROR: Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    
+    bool adaptiveSampling = renderSettings.adaptive.errorThreshold > 0.0f;
+    // NOTE: with a time limit, the samples per pixel is only a cap if it was asked for
+    if (timeLimit > 0.0)
+    {
+        if (renderSettings.passSamples == 0)
+            renderSettings.passSamples = TIME_LIMIT_PASS_SAMPLES;
+        if (!samplesGiven)
+            renderSettings.samplesPerPixel = UNLIMITED_SAMPLES;
+    }
+    
+    // NOTE: the stratified sampler sizes its grid for the samples a pixel gets, or for each pass when there's no cap
+    renderSettings.sampler.sampleCount = renderSettings.samplesPerPixel;
+    if (renderSettings.samplesPerPixel == UNLIMITED_SAMPLES)
+        renderSettings.sampler.sampleCount = renderSettings.passSamples;
+    
+    bool progressive = renderSettings.passSamples > 0 || checkpointFileName;
+    if ((adaptiveSampling || progressive || heatmapFileName) && renderSettings.engine == RenderSettings::Engine::WAVEFRONT)
+    {
+        printf("ERROR: Adaptive sampling, progressive rendering and the heatmap only work with the megakernel engine\n");
+        return 1;
+    }
+    
+    LARGE_INTEGER countsPerSecond = {};
+    QueryPerformanceFrequency(&countsPerSecond);
+
+#if WARP_BENCHMARK
+    run_warp_benchmark(countsPerSecond);
+    return 0;
+#endif
+    
+    Image image = {};
+    image.width = imageWidth;
+    image.height = (u32)(image.width/ASPECT_RATIO);
+    image.pixels = (v4f*)memory_alloc(sizeof(v4f)*image.width*image.height);
+    
+    fill_image(&image, Colour::BLACK);
+    
+    printf("Setting up rendering scene...\n");
+    
+    f32 aspectRatio = (f32)image.width/image.height;
+    
+    World world = {};
+    Camera camera = {};
+    
+    switch (sceneNumber)
+    {
+        case 1: init_test_scene_1(&world, &camera, aspectRatio); break;
+        case 2: init_test_scene_2(&world, &camera, aspectRatio); break;
+        case 3: init_test_scene_3(&world, &camera, aspectRatio); break;
+        case 4: init_test_scene_4(&world, &camera, aspectRatio); break;
+        case 5: init_test_scene_5(&world, &camera, aspectRatio); break;
+        case 6: init_test_scene_6(&world, &camera, aspectRatio); break;
+        default:
+            printf("ERROR: There is no test scene %u\n", sceneNumber);
+            return 1;
+    }
+    
+    if (environmentFileName)
+    {
+        if (!load_environment_map(environmentFileName, &world.environment))
+        {
+            printf("ERROR: Couldn't load the environment map %s, it has to be a little endian PFM file\n", environmentFileName);
+            return 1;
+        }
+    }
+    
+    build_light_set(&world);
+    
+    printf("Rendering test scene %u with the %s engine%s\n", sceneNumber,
+           renderSettings.engine == RenderSettings::Engine::WAVEFRONT ? "wavefront" : "megakernel",
+           renderSettings.sortRays ? ", sorting bounced rays" : "");
+    printf("Paths end after %u bounces, roulette threshold %.3f\n", renderSettings.path.maxDepth, renderSettings.path.rouletteThreshold);
+    if (world.lights.count > 0 && renderSettings.path.skipLightSampling)
+        printf("%u lights, only found by bouncing into them\n", world.lights.count);
+    else if (world.lights.count > 0)
+        printf("%u lights, sampled with shadow rays picked by %s\n", world.lights.count, LIGHT_SELECTION_NAMES[renderSettings.path.lightSelection]);
+    if (world.environment.pixels)
+        printf("Lit by the %ux%u environment map %s\n", world.environment.width, world.environment.height, environmentFileName);
+    printf("Samples from the %s sampler, seed %u\n", SAMPLER_NAMES[renderSettings.sampler.type], renderSettings.sampler.seed);
+    printf("%ux%u pixels, %u pixel blocks on %u threads\n", image.width, image.height, renderSettings.blockSize, renderSettings.threadCount);
+    if (renderSettings.samplesPerPixel != UNLIMITED_SAMPLES)
+        printf("%u samples per pixel\n", renderSettings.samplesPerPixel);
+    if (adaptiveSampling)
+        printf("Adaptive sampling down to an error of %.4f, at least %u samples per pixel\n",
+               renderSettings.adaptive.errorThreshold, renderSettings.adaptive.minSamples);
+    if (timeLimit > 0.0)
+        printf("Rendering until %.2f seconds have passed\n", timeLimit);
+    if (progressive)
+        printf("Rendering in passes of %u samples per pixel%s%s\n", renderSettings.passSamples ? renderSettings.passSamples : renderSettings.samplesPerPixel,
+               checkpointFileName ? ", checkpointing to " : "", checkpointFileName ? checkpointFileName : "");
+    
+    printf("Building Bounding Volume Hierarchy...\n");
+    
+    START_TIMED_SECTION(BuildBVH);
+
+#if USE_SAH_BVH
+    BVHBuildSettings bvhSettings = BVHBuildSettings::binned_sah(world.startTime, world.endTime);
+#else
+    BVHBuildSettings bvhSettings = BVHBuildSettings::median_split(world.startTime, world.endTime);
+#endif
+    bvhSettings.threadCount = renderSettings.threadCount;
+
+#if BVH_WIDTH == 8
+    SceneBVH::Layout bvhLayout = SceneBVH::Layout::WIDE_8;
+#elif BVH_WIDTH == 4
+    SceneBVH::Layout bvhLayout = SceneBVH::Layout::WIDE_4;
+#else
+    SceneBVH::Layout bvhLayout = SceneBVH::Layout::BINARY;
+#endif
+
+#if USE_MOTION_BVH
+    // boxes covering the whole render interval get huge for fast objects, so scenes with motion get a BVH that
+    // moves its boxes to each ray's time instead
+    if (world.endTime > world.startTime)
+        bvhLayout = SceneBVH::Layout::MOTION;
+#endif
+    
+    BVHStats bvhStats = {};
+    SceneBVH bvh = {};
+
+#if USE_BVH_CACHE
+    bool loadedBVH = load_cached_scene_bvh(BVH_CACHE_PREFIX, &world, &bvhSettings, bvhLayout, &bvh, &bvhStats);
+    if (!loadedBVH)
+    {
+        bvh = build_scene_bvh(&world, &bvhSettings, bvhLayout, &bvhStats);
+        save_cached_scene_bvh(BVH_CACHE_PREFIX, &world, &bvhSettings, &bvh, &bvhStats);
+    }
+#else
+    bool loadedBVH = false;
+    bvh = build_scene_bvh(&world, &bvhSettings, bvhLayout, &bvhStats);
+#endif
+    
+    END_TIMED_SECTION(BuildBVH);
+    PRINT_TIMED_SECTION_RESULT(BuildBVH, loadedBVH ? "Loaded cached BVH in " : "Built BVH in ", countsPerSecond);
+    
+    if (world.objectCount > 0)
+        print_bvh_stats(&bvhStats);
+    
+    if (world.instanceCount > 0)
+    {
+        u64 prototypeObjectCount = 0;
+        u64 instancedObjectCount = 0;
+        
+        for (u32 i = 0; i < world.prototypeCount; ++i)
+            prototypeObjectCount += world.prototypes[i].objectCount;
+        for (u32 i = 0; i < world.instanceCount; ++i)
+            instancedObjectCount += world.prototypes[world.instances[i].prototype].objectCount;
+        
+        printf("Instances: %u of %u prototypes, %llu spheres stored for %llu spheres placed\n",
+               world.instanceCount, world.prototypeCount, (unsigned long long)prototypeObjectCount, (unsigned long long)instancedObjectCount);
+    }
+
+#if DYNAMIC_BVH_BENCHMARK
+    run_dynamic_bvh_benchmark(&image, &camera, &world, &bvhSettings, bvhLayout, &renderSettings, countsPerSecond);
+    
+    memory_free(image.pixels);
+    free_scene_bvh(&bvh);
+    world.free_objects();
+    
+    return 0;
+#endif
+
+#if SAMPLER_BENCHMARK
+    run_sampler_benchmark(&image, &camera, &world, &bvh, &renderSettings, countsPerSecond);
+    
+    memory_free(image.pixels);
+    free_scene_bvh(&bvh);
+    world.free_objects();
+    
+    return 0;
+#endif
+
+#if BSDF_BENCHMARK
+    run_bsdf_benchmark(&image, &camera, &world, &bvh, &renderSettings, countsPerSecond);
+    
+    memory_free(image.pixels);
+    free_scene_bvh(&bvh);
+    world.free_objects();
+    
+    return 0;
+#endif
+
+#if LIGHT_BENCHMARK
+    run_light_benchmark(&image, &camera, &world, &bvh, &renderSettings, countsPerSecond);
+    
+    memory_free(image.pixels);
+    free_scene_bvh(&bvh);
+    world.free_objects();
+    
+    return 0;
+#endif
+    
+    // start the ray tracing!
+    
+    printf("Path-tracing begins...\n");
+    
+    Accumulation accumulation = make_accumulation(image.width, image.height);
+    
+    for (u32 frame = 0; frame < ANIMATION_FRAME_COUNT; ++frame)
+    {
+        if (frame > 0)
+        {
+            // move the render interval on to the next frame, the objects follow along with their velocities
+            world.startTime += ANIMATION_FRAME_TIME;
+            world.endTime += ANIMATION_FRAME_TIME;
+            
+            bvhSettings.startTime = world.startTime;
+            bvhSettings.endTime = world.endTime;
+            
+            START_TIMED_SECTION(UpdateBVH);
+            bool rebuilt = update_scene_bvh(&bvh, &world, &bvhSettings);
+            END_TIMED_SECTION(UpdateBVH);
+            
+            PRINT_TIMED_SECTION_RESULT(UpdateBVH, rebuilt ? "Rebuilt BVH in" : "Refit BVH in", countsPerSecond);
+            printf("BVH SAH cost: %.2f (%.2f when built)\n", bvh.cost, bvh.builtCost);
+            
+            // the light BVH's boxes only cover the lights over the last frame's interval
+            build_light_set(&world);
+        }
+        
+        // NOTE: a checkpoint only holds one frame, so only the first frame is resumed and saved
+        bool checkpointFrame = checkpointFileName && frame == 0;
+        
+        clear_accumulation(&accumulation);
+        u32 resumedSamples = 0;
+        
+        if (checkpointFrame && load_checkpoint(checkpointFileName, &accumulation, sceneNumber, &world.environment, &renderSettings.path))
+        {
+            resumedSamples = min_sample_count(&accumulation);
+            resolve_accumulation(&accumulation, &image);
+            printf("Resumed from checkpoint %s, with at least %u samples per pixel\n", checkpointFileName, resumedSamples);
+        }
+        
+        START_TIMED_SECTION(PathTracing);
+        
+        if (timeLimit > 0.0)
+            renderSettings.deadline = startTime_PathTracing.QuadPart + (s64)(timeLimit*countsPerSecond.QuadPart);
+        
+        u64 rayCount = 0;
+        u32 samplesPerPixel = renderSettings.samplesPerPixel;
+        u32 passSamples = renderSettings.passSamples ? renderSettings.passSamples : samplesPerPixel;
+        
+        for (u32 sampleTarget = MIN_VALUE(passSamples, samplesPerPixel);; sampleTarget = MIN_VALUE(sampleTarget + passSamples, samplesPerPixel))
+        {
+            // passes the checkpoint already covers are skipped
+            if (sampleTarget > resumedSamples)
+            {
+                rayCount += render_image(&image, &camera, &world, &bvh, &renderSettings, &accumulation, sampleTarget);
+                
+                if (progressive)
+                    printf("Finished the pass up to %u samples per pixel\n", sampleTarget);
+                if (checkpointFrame)
+                    save_checkpoint(checkpointFileName, &accumulation, sceneNumber, &world.environment, &renderSettings.path);
+            }
+            
+            if (sampleTarget == samplesPerPixel || past_deadline(renderSettings.deadline))
+                break;
+        }
+        
+        END_TIMED_SECTION(PathTracing);
+        
+        printf("Ray-tracing finished!\n");
+        PRINT_TIMED_SECTION_RESULT(PathTracing, "Time elapsed:", countsPerSecond);
+        
+        if (adaptiveSampling || progressive)
+        {
+            u64 totalSamples = 0;
+            for (u32 i = 0; i < image.width*image.height; ++i)
+                totalSamples += accumulation.pixels[i].count;
+            printf("Average samples per pixel: %.2f (at least %u)\n", (f64)totalSamples/(image.width*image.height),
+                   min_sample_count(&accumulation));
+        }
+        
+        if (rayCount > 0)
+        {
+            f64 seconds = (endTime_PathTracing.QuadPart - startTime_PathTracing.QuadPart)/(f64)countsPerSecond.QuadPart;
+            printf("Traced %llu rays, %.2f million rays per second\n", (unsigned long long)rayCount, rayCount/seconds/1000000.0);
+        }
+        
+        if (heatmapFileName)
+        {
+            // NOTE: the scale runs up to the most samples a pixel actually took, since a time limit can stop the render well
+            // short of the samples asked for, or without there being any limit on them at all
+            u32 maxSamples = max_sample_count(&accumulation);
+            
+            printf("Writing samples per pixel heatmap to file: %s\n", heatmapFileName);
+            write_sample_heatmap(heatmapFileName, accumulation.pixels, image.width, image.height,
+                                 MIN_VALUE(renderSettings.adaptive.minSamples, maxSamples), maxSamples);
+        }
+        
+        char* frameFileName = fileName;
+        if (ANIMATION_FRAME_COUNT > 1)
+            frameFileName = frame_file_name(fileName, frame);
+        
+        printf("Writing output to file: %s\n", frameFileName);
+        write_image_to_bmp(frameFileName, &image);
+        
+        if (frameFileName != fileName)
+            memory_free(frameFileName);
+    }
     
     printf("File output complete. Program finished.\n");
     
     memory_free(fileName);
+    free_accumulation(&accumulation);
     memory_free(image.pixels);
+    free_scene_bvh(&bvh);
+    world.free_objects();
     
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,289 @@
+#include "motion_bvh.h"
+
+/*
+* Flattening
+*/
+
+static f32 motion_key_time(MotionBVH* bvh, u32 key)
+{
+    return bvh->startTime + (bvh->endTime - bvh->startTime)*((f32)key/(MOTION_BVH_TIME_KEYS - 1));
+}
+
+static u32 flatten_motion_bvh_node(BVHNode* node, MotionBVH* bvh, u32* nextIndex)
+{
+    u32 nodeIndex = (*nextIndex)++;
+    MotionBVHNode* motionNode = bvh->nodes + nodeIndex;
+    
+    if (!node->left)
+    {
+        motionNode->firstObject = node->firstObject;
+        motionNode->objectCount = node->objectCount;
+        
+        for (u32 key = 0; key < MOTION_BVH_TIME_KEYS; ++key)
+        {
+            f32 keyTime = motion_key_time(bvh, key);
+            
+            v3f boundsMin = v3f(F32_MAX, F32_MAX, F32_MAX);
+            v3f boundsMax = v3f(F32_MIN, F32_MIN, F32_MIN);
+            
+            for (u32 i = 0; i < node->objectCount; ++i)
+            {
+                SphereObject* object = bvh->objects + bvh->objectIndices[node->firstObject + i];
+                
+                v3f pos = object->pos(keyTime);
+                f32 radius = object->sphere.radius;
+                
+                for (u32 axis = 0; axis < 3; ++axis)
+                {
+                    boundsMin.e[axis] = MIN_VALUE(boundsMin.e[axis], pos.e[axis] - radius);
+                    boundsMax.e[axis] = MAX_VALUE(boundsMax.e[axis], pos.e[axis] + radius);
+                }
+            }
+            
+            motionNode->boundsMin[key] = boundsMin;
+            motionNode->boundsMax[key] = boundsMax;
+        }
+    }
+    else
+    {
+        // the left child is always stored directly after its parent, so only the right one needs an index
+        u32 leftIndex = flatten_motion_bvh_node(node->left, bvh, nextIndex);
+        u32 rightIndex = flatten_motion_bvh_node(node->right, bvh, nextIndex);
+        
+        motionNode->rightChild = rightIndex;
+        motionNode->objectCount = 0;
+        
+        MotionBVHNode* left = bvh->nodes + leftIndex;
+        MotionBVHNode* right = bvh->nodes + rightIndex;
+        
+        for (u32 key = 0; key < MOTION_BVH_TIME_KEYS; ++key)
+        {
+            for (u32 axis = 0; axis < 3; ++axis)
+            {
+                motionNode->boundsMin[key].e[axis] = MIN_VALUE(left->boundsMin[key].e[axis], right->boundsMin[key].e[axis]);
+                motionNode->boundsMax[key].e[axis] = MAX_VALUE(left->boundsMax[key].e[axis], right->boundsMax[key].e[axis]);
+            }
+        }
+    }
+    
+    return nodeIndex;
+}
+
+MotionBVH flatten_motion_bvh(BVH* bvh, f32 startTime, f32 endTime)
+{
+    assert(bvh && bvh->root);
+    assert(startTime <= endTime);
+    
+    MotionBVH result = {};
+    result.objects = bvh->objects;
+    result.objectCount = bvh->objectCount;
+    result.startTime = startTime;
+    result.endTime = endTime;
+    
+    result.objectIndices = (u32*)memory_alloc(bvh->objectCount*sizeof(u32));
+    for (u32 i = 0; i < bvh->objectCount; ++i)
+        result.objectIndices[i] = bvh->objectIndices[i];
+    
+    result.spheres = copy_leaf_spheres(bvh->objects, bvh->objectIndices, bvh->objectCount);
+    
+    result.nodes = (MotionBVHNode*)memory_alloc(bvh->nodeCount*sizeof(MotionBVHNode));
+    
+    u32 nextIndex = 0;
+    flatten_motion_bvh_node(bvh->root, &result, &nextIndex);
+    result.nodeCount = nextIndex;
+    assert(result.nodeCount == bvh->nodeCount);
+    
+    return result;
+}
+
+void free_motion_bvh(MotionBVH* bvh)
+{
+    memory_free(bvh->nodes);
+    memory_free(bvh->objectIndices);
+    free_sphere_arrays(&bvh->spheres);
+    *bvh = {};
+}
+
+/*
+* Traversal
+*/
+
+// where a ray's time falls between the time keys, worked out once per ray
+struct MotionKey
+{
+    u32 key; // the key at or before the ray's time
+    f32 blend; // how far the ray's time is towards the next key
+};
+
+// slab test against the node's box at the ray's time, only counting hits that enter the box before tMax
+static inline bool hit_test(v3f origin, v3f inverseDir, MotionBVHNode* node, MotionKey motionKey, f32 tMax, f32* outTEntry)
+{
+    u32 key = motionKey.key;
+    f32 blend = motionKey.blend;
+    
+    f32 tEntry = 0.0f;
+    f32 tExit = tMax;
+    
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+        f32 boundsMin = node->boundsMin[key].e[axis] + (node->boundsMin[key + 1].e[axis] - node->boundsMin[key].e[axis])*blend;
+        f32 boundsMax = node->boundsMax[key].e[axis] + (node->boundsMax[key + 1].e[axis] - node->boundsMax[key].e[axis])*blend;
+        
+        f32 t0 = (boundsMin - origin.e[axis])*inverseDir.e[axis];
+        f32 t1 = (boundsMax - origin.e[axis])*inverseDir.e[axis];
+        
+        tEntry = MAX_VALUE(tEntry, MIN_VALUE(t0, t1));
+        tExit = MIN_VALUE(tExit, MAX_VALUE(t0, t1));
+    }
+    
+    *outTEntry = tEntry;
+    return tEntry <= tExit;
+}
+
+// the pair of keys the ray's time falls between
+static inline MotionKey motion_key(MotionBVH* bvh, f32 time)
+{
+    MotionKey result = {};
+    if (bvh->endTime > bvh->startTime)
+    {
+        f32 keyPos = (time - bvh->startTime)/(bvh->endTime - bvh->startTime)*(MOTION_BVH_TIME_KEYS - 1);
+        keyPos = clamp(keyPos, 0.0f, (f32)(MOTION_BVH_TIME_KEYS - 1));
+        
+        result.key = MIN_VALUE((u32)keyPos, MOTION_BVH_TIME_KEYS - 2);
+        result.blend = keyPos - result.key;
+    }
+    
+    return result;
+}
+
+static f32 intersection_test(Ray ray, MotionBVH* bvh, f32 time, f32 tMax, SphereObject** outObject)
+{
+    struct StackEntry
+    {
+        u32 nodeIndex;
+        f32 tEntry;
+    };
+    
+    StackEntry stack[BVH_MAX_STACK_SIZE];
+    u32 stackSize = 0;
+    
+    MotionKey motionKey = motion_key(bvh, time);
+    
+    f32 tClosest = tMax;
+    v3f inverseDir = v3f(1.0f/ray.dir.x, 1.0f/ray.dir.y, 1.0f/ray.dir.z);
+    
+    COUNT_TRAVERSAL_RAY();
+    
+    f32 tRoot = 0.0f;
+    if (!hit_test(ray.origin, inverseDir, bvh->nodes, motionKey, tClosest, &tRoot))
+        return F32_MAX;
+    
+    u32 nodeIndex = 0;
+    
+    for (;;)
+    {
+        MotionBVHNode* node = bvh->nodes + nodeIndex;
+        COUNT_NODE_VISIT(node);
+        
+        if (node->objectCount > 0) // reached a leaf node
+            intersect_leaf(ray, bvh->objects, bvh->objectIndices, &bvh->spheres, node->firstObject, node->objectCount, time, &tClosest, outObject);
+        else
+        {
+            u32 leftIndex = nodeIndex + 1;
+            u32 rightIndex = node->rightChild;
+            
+            f32 tLeft = 0.0f;
+            f32 tRight = 0.0f;
+            bool hitLeft = hit_test(ray.origin, inverseDir, bvh->nodes + leftIndex, motionKey, tClosest, &tLeft);
+            bool hitRight = hit_test(ray.origin, inverseDir, bvh->nodes + rightIndex, motionKey, tClosest, &tRight);
+            
+            if (hitLeft && hitRight)
+            {
+                assert(stackSize < ARRAY_LENGTH(stack));
+                
+                if (tLeft <= tRight)
+                {
+                    stack[stackSize++] = {rightIndex, tRight};
+                    nodeIndex = leftIndex;
+                }
+                else
+                {
+                    stack[stackSize++] = {leftIndex, tLeft};
+                    nodeIndex = rightIndex;
+                }
+                
+                continue;
+            }
+            else if (hitLeft)
+            {
+                nodeIndex = leftIndex;
+                continue;
+            }
+            else if (hitRight)
+            {
+                nodeIndex = rightIndex;
+                continue;
+            }
+        }
+        
+        bool foundNode = false;
+        while (stackSize > 0 && !foundNode)
+        {
+            StackEntry entry = stack[--stackSize];
+            if (entry.tEntry < tClosest)
+            {
+                nodeIndex = entry.nodeIndex;
+                foundNode = true;
+            }
+        }
+        
+        if (!foundNode)
+            break;
+    }
+    
+    return tClosest < tMax ? tClosest : F32_MAX;
+}
+
+static bool occlusion_test(Ray ray, MotionBVH* bvh, f32 time, f32 tMax)
+{
+    u32 stack[BVH_MAX_STACK_SIZE + 1];
+    u32 stackSize = 0;
+    
+    MotionKey motionKey = motion_key(bvh, time);
+    v3f inverseDir = v3f(1.0f/ray.dir.x, 1.0f/ray.dir.y, 1.0f/ray.dir.z);
+    
+    COUNT_TRAVERSAL_RAY();
+    
+    f32 tEntry = 0.0f;
+    if (!hit_test(ray.origin, inverseDir, bvh->nodes, motionKey, tMax, &tEntry))
+        return false;
+    
+    stack[stackSize++] = 0;
+    
+    while (stackSize > 0)
+    {
+        u32 nodeIndex = stack[--stackSize];
+        MotionBVHNode* node = bvh->nodes + nodeIndex;
+        COUNT_NODE_VISIT(node);
+        
+        if (node->objectCount > 0)
+        {
+            if (occluded_leaf(ray, bvh->objects, bvh->objectIndices, &bvh->spheres, node->firstObject, node->objectCount, time, tMax))
+                return true;
+            
+            continue;
+        }
+        
+        u32 leftIndex = nodeIndex + 1;
+        u32 rightIndex = node->rightChild;
+        
+        if (hit_test(ray.origin, inverseDir, bvh->nodes + rightIndex, motionKey, tMax, &tEntry))
+            stack[stackSize++] = rightIndex;
+        if (hit_test(ray.origin, inverseDir, bvh->nodes + leftIndex, motionKey, tMax, &tEntry))
+            stack[stackSize++] = leftIndex;
+        
+        assert(stackSize <= ARRAY_LENGTH(stack));
+    }
+    
+    return false;
+}
\ No newline at end of file
@@ -0,0 +1,54 @@
+#ifndef MOTION_BVH_H
+#define MOTION_BVH_H
+
+#include "types.h"
+#include "bvh.h"
+
+// number of evenly spaced times across the render interval that each node stores a box for
+// NOTE: spheres move linearly, so two keys would already be exact for single spheres, but the union of spheres
+// moving in different directions isn't linear, so more keys keep interior nodes tight too
+#define MOTION_BVH_TIME_KEYS 4
+
+// A node of a flattened BVH whose box changes over the render interval. Between two time keys the box is
+// linearly interpolated, which always contains everything under the node since all motion is linear.
+struct alignas(64) MotionBVHNode
+{
+    v3f boundsMin[MOTION_BVH_TIME_KEYS];
+    v3f boundsMax[MOTION_BVH_TIME_KEYS];
+    
+    union
+    {
+        u32 firstObject; // leaf nodes, index into MotionBVH::objectIndices
+        u32 rightChild; // interior nodes, index into MotionBVH::nodes
+    };
+    
+    u32 objectCount; // 0 for interior nodes
+};
+
+// laid out like a LinearBVH, but with nodes that only test rays against the box for the ray's time
+struct MotionBVH
+{
+    MotionBVHNode* nodes;
+    u32 nodeCount;
+    
+    SphereObject* objects;
+    u32* objectIndices;
+    u32 objectCount;
+    
+    // the objects' spheres in the same order as objectIndices, see LinearBVH
+    SphereArrays spheres;
+    
+    f32 startTime;
+    f32 endTime;
+};
+
+MotionBVH flatten_motion_bvh(BVH* bvh, f32 startTime, f32 endTime);
+void free_motion_bvh(MotionBVH* bvh);
+
+// returns the distance to the closest object hit before tMax, or F32_MAX if nothing was hit
+static f32 intersection_test(Ray ray, MotionBVH* bvh, f32 time, f32 tMax, SphereObject** outObject);
+
+// returns true if the ray hits any object before tMax, stopping at the first one it finds
+static bool occlusion_test(Ray ray, MotionBVH* bvh, f32 time, f32 tMax);
+
+#endif //MOTION_BVH_H
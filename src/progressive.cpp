@@ -0,0 +1,160 @@
+#include "progressive.h"
+#include "utils.h"
+
+#define CHECKPOINT_MAGIC 'TPKC'
+
+Accumulation make_accumulation(u32 width, u32 height)
+{
+    Accumulation result = {};
+    result.width = width;
+    result.height = height;
+    result.pixels = (PixelEstimate*)memory_alloc(sizeof(PixelEstimate)*width*height);
+    
+    return result;
+}
+
+void clear_accumulation(Accumulation* accumulation)
+{
+    for (u32 i = 0; i < accumulation->width*accumulation->height; ++i)
+        accumulation->pixels[i] = {};
+}
+
+void free_accumulation(Accumulation* accumulation)
+{
+    memory_free(accumulation->pixels);
+    *accumulation = {};
+}
+
+u32 min_sample_count(Accumulation* accumulation)
+{
+    u32 result = 0xFFFFFFFF;
+    for (u32 i = 0; i < accumulation->width*accumulation->height; ++i)
+        result = MIN_VALUE(result, accumulation->pixels[i].count);
+    
+    return result;
+}
+
+u32 max_sample_count(Accumulation* accumulation)
+{
+    u32 result = 0;
+    for (u32 i = 0; i < accumulation->width*accumulation->height; ++i)
+        result = MAX_VALUE(result, accumulation->pixels[i].count);
+    
+    return result;
+}
+
+void resolve_accumulation(Accumulation* accumulation, Image* image)
+{
+    assert(image->width == accumulation->width && image->height == accumulation->height);
+    
+    for (u32 i = 0; i < accumulation->width*accumulation->height; ++i)
+    {
+        if (accumulation->pixels[i].count > 0)
+            image->pixels[i] = clamp(accumulation->pixels[i].mean, 0.0f, 1.0f);
+    }
+}
+
+static CheckpointHeader make_checkpoint_header(Accumulation* accumulation, u32 sceneNumber, EnvironmentMap* environment, PathSettings* pathSettings)
+{
+    CheckpointHeader result = {};
+    result.magic = CHECKPOINT_MAGIC;
+    result.version = CHECKPOINT_VERSION;
+    result.sceneNumber = sceneNumber;
+    result.width = accumulation->width;
+    result.height = accumulation->height;
+    result.maxDepth = pathSettings->maxDepth;
+    result.rouletteThreshold = pathSettings->rouletteThreshold;
+    result.pixelSize = sizeof(PixelEstimate);
+    
+    if (environment->pixels)
+    {
+        result.environmentWidth = environment->width;
+        result.environmentHeight = environment->height;
+        result.environmentHash = hash_bytes(0xCBF29CE484222325ull, environment->pixels,
+                                            (environment->width + 1)*environment->height*sizeof(v4f));
+    }
+    
+    return result;
+}
+
+bool save_checkpoint(char* fileName, Accumulation* accumulation, u32 sceneNumber, EnvironmentMap* environment, PathSettings* pathSettings)
+{
+    CheckpointHeader header = make_checkpoint_header(accumulation, sceneNumber, environment, pathSettings);
+    u32 pixelsSize = accumulation->width*accumulation->height*sizeof(PixelEstimate);
+    
+    char* tempFileName = concat_strings(fileName, ".tmp");
+    bool saved = false;
+    
+    // NOTE: like the BVH cache, the file is written under a temporary name and then moved into place, so being
+    // stopped part way through writing it leaves the last checkpoint as it was
+    HANDLE file = CreateFile(tempFileName, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+    
+    if (file != INVALID_HANDLE_VALUE)
+    {
+        DWORD bytesWritten = 0;
+        u32 totalWritten = 0;
+        
+        WriteFile(file, &header, sizeof(header), &bytesWritten, 0);
+        totalWritten += bytesWritten;
+        WriteFile(file, accumulation->pixels, pixelsSize, &bytesWritten, 0);
+        totalWritten += bytesWritten;
+        
+        CloseHandle(file);
+        
+        if (totalWritten == sizeof(header) + pixelsSize)
+            saved = MoveFileEx(tempFileName, fileName, MOVEFILE_REPLACE_EXISTING) != 0;
+        
+        if (!saved)
+            DeleteFile(tempFileName);
+    }
+    
+    if (!saved)
+        printf("WARNING: Couldn't write the checkpoint file %s\n", fileName);
+    
+    memory_free(tempFileName);
+    return saved;
+}
+
+bool load_checkpoint(char* fileName, Accumulation* accumulation, u32 sceneNumber, EnvironmentMap* environment, PathSettings* pathSettings)
+{
+    HANDLE file = CreateFile(fileName, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    
+    CheckpointHeader expected = make_checkpoint_header(accumulation, sceneNumber, environment, pathSettings);
+    u32 pixelsSize = accumulation->width*accumulation->height*sizeof(PixelEstimate);
+    
+    CheckpointHeader header = {};
+    DWORD bytesRead = 0;
+    ReadFile(file, &header, sizeof(header), &bytesRead, 0);
+    
+    bool valid = bytesRead == sizeof(header) &&
+                 header.magic == expected.magic &&
+                 header.version == expected.version &&
+                 header.sceneNumber == expected.sceneNumber &&
+                 header.width == expected.width &&
+                 header.height == expected.height &&
+                 header.maxDepth == expected.maxDepth &&
+                 header.rouletteThreshold == expected.rouletteThreshold &&
+                 header.pixelSize == expected.pixelSize &&
+                 header.environmentWidth == expected.environmentWidth &&
+                 header.environmentHeight == expected.environmentHeight &&
+                 header.environmentHash == expected.environmentHash;
+    
+    if (valid)
+    {
+        ReadFile(file, accumulation->pixels, pixelsSize, &bytesRead, 0);
+        valid = bytesRead == pixelsSize;
+        
+        // NOTE: a short file would leave the accumulation half filled in, so it's started over instead
+        if (!valid)
+            clear_accumulation(accumulation);
+    }
+    
+    CloseHandle(file);
+    
+    if (!valid)
+        printf("WARNING: The checkpoint file %s is from a different render, starting over\n", fileName);
+    
+    return valid;
+}
\ No newline at end of file
@@ -0,0 +1,63 @@
+#ifndef PROGRESSIVE_H
+#define PROGRESSIVE_H
+
+#include "types.h"
+#include "image.h"
+#include "shading.h"
+#include "adaptive_sampling.h"
+
+// bump this whenever the file layout, PixelEstimate or what any of the test scenes look like changes, so older
+// checkpoints aren't resumed from
+#define CHECKPOINT_VERSION 3
+
+// Every sample taken so far for each pixel of the image, which passes of samples are added to. It's what gets saved
+// to a checkpoint, so a render that's stopped part way can be picked up again by a later run.
+struct Accumulation
+{
+    u32 width;
+    u32 height;
+    PixelEstimate* pixels;
+};
+
+// The start of a checkpoint file, followed by the accumulated pixels. Resuming needs the same scene, environment map,
+// size and path settings, since the samples already taken would be of a different image otherwise.
+struct CheckpointHeader
+{
+    u32 magic;
+    u32 version;
+    
+    u32 sceneNumber;
+    u32 width;
+    u32 height;
+    u32 maxDepth;
+    f32 rouletteThreshold;
+    
+    u32 pixelSize;
+    
+    // the size of the environment map and a hash of its pixels, all 0 when the render has none
+    u32 environmentWidth;
+    u32 environmentHeight;
+    u64 environmentHash;
+};
+
+Accumulation make_accumulation(u32 width, u32 height);
+void clear_accumulation(Accumulation* accumulation);
+void free_accumulation(Accumulation* accumulation);
+
+// the fewest samples any pixel has taken
+u32 min_sample_count(Accumulation* accumulation);
+
+// the most samples any pixel has taken
+u32 max_sample_count(Accumulation* accumulation);
+
+// sets every pixel of the image that has any samples to the average of them
+void resolve_accumulation(Accumulation* accumulation, Image* image);
+
+// writes the accumulation out to the checkpoint file, replacing the last one only once the new one is complete
+bool save_checkpoint(char* fileName, Accumulation* accumulation, u32 sceneNumber, EnvironmentMap* environment, PathSettings* pathSettings);
+
+// Reads the checkpoint file into the accumulation. Returns false if there is no file, or it was made by a render
+// with a different scene, environment map, image size or path settings.
+bool load_checkpoint(char* fileName, Accumulation* accumulation, u32 sceneNumber, EnvironmentMap* environment, PathSettings* pathSettings);
+
+#endif //PROGRESSIVE_H
@@ -0,0 +1,197 @@
+#include "ray_packet.h"
+
+void set_packet_ray(RayPacket* packet, u32 lane, Ray ray, f32 time)
+{
+    assert(lane < RAY_PACKET_SIZE);
+    
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+        packet->origin[axis][lane] = ray.origin.e[axis];
+        packet->dir[axis][lane] = ray.dir.e[axis];
+        packet->inverseDir[axis][lane] = 1.0f/ray.dir.e[axis];
+    }
+    
+    packet->time[lane] = time;
+}
+
+Ray get_packet_ray(RayPacket* packet, u32 lane)
+{
+    assert(lane < RAY_PACKET_SIZE);
+    
+    v3f origin = v3f(packet->origin[0][lane], packet->origin[1][lane], packet->origin[2][lane]);
+    v3f dir = v3f(packet->dir[0][lane], packet->dir[1][lane], packet->dir[2][lane]);
+    
+    return Ray(origin, dir);
+}
+
+void finish_ray_packet(RayPacket* packet)
+{
+    packet->sameSigns = true;
+    
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+        bool negative = packet->dir[axis][0] < 0.0f;
+        
+        packet->originMin.e[axis] = F32_MAX;
+        packet->originMax.e[axis] = F32_MIN;
+        packet->inverseDirMin.e[axis] = F32_MAX;
+        packet->inverseDirMax.e[axis] = F32_MIN;
+        
+        for (u32 lane = 0; lane < RAY_PACKET_SIZE; ++lane)
+        {
+            // NOTE: a direction of exactly zero gives an infinite inverse, which the range math can't handle
+            if (packet->dir[axis][lane] == 0.0f || (packet->dir[axis][lane] < 0.0f) != negative)
+                packet->sameSigns = false;
+            
+            packet->originMin.e[axis] = MIN_VALUE(packet->originMin.e[axis], packet->origin[axis][lane]);
+            packet->originMax.e[axis] = MAX_VALUE(packet->originMax.e[axis], packet->origin[axis][lane]);
+            packet->inverseDirMin.e[axis] = MIN_VALUE(packet->inverseDirMin.e[axis], packet->inverseDir[axis][lane]);
+            packet->inverseDirMax.e[axis] = MAX_VALUE(packet->inverseDirMax.e[axis], packet->inverseDir[axis][lane]);
+        }
+        
+        packet->nearPlane[axis] = negative ? axis + 3 : axis;
+        packet->farPlane[axis] = negative ? axis : axis + 3;
+    }
+}
+
+static inline f32 packet_max_t(f32* tValues, u32 rayMask)
+{
+    f32 result = F32_MIN;
+    
+    for (u32 lane = 0; lane < RAY_PACKET_SIZE; ++lane)
+    {
+        if (rayMask & (1 << lane))
+            result = MAX_VALUE(result, tValues[lane]);
+    }
+    
+    return result;
+}
+
+#ifdef __AVX__
+static inline u32 hit_test_box(RayPacket* packet, v3f boundsMin, v3f boundsMax, f32* tClosest, u32 rayMask, f32* outTEntry)
+{
+    __m256 tNear = _mm256_setzero_ps();
+    __m256 tFar = _mm256_loadu_ps(tClosest);
+    
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+        __m256 origin = _mm256_load_ps(packet->origin[axis]);
+        __m256 inverseDir = _mm256_load_ps(packet->inverseDir[axis]);
+        
+        // the rays don't share their signs, so the near plane is worked out separately for each of them
+        __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(boundsMin.e[axis]), origin), inverseDir);
+        __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(boundsMax.e[axis]), origin), inverseDir);
+        
+        tNear = _mm256_max_ps(tNear, _mm256_min_ps(t0, t1));
+        tFar = _mm256_min_ps(tFar, _mm256_max_ps(t0, t1));
+    }
+    
+    u32 result = rayMask & (u32)_mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ));
+    
+    // rays that missed are pushed out to infinity so they don't count towards the nearest entry
+    __m256i laneBits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    __m256 hitLanes = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32((s32)result), laneBits), laneBits));
+    *outTEntry = min_lane(_mm256_blendv_ps(_mm256_set1_ps(F32_MAX), tNear, hitLanes));
+    
+    return result;
+}
+
+static inline u32 intersect_sphere(RayPacket* packet, SphereObject* object, f32* tClosest, u32 rayMask)
+{
+    const f32 MIN_T = 0.001f;
+    
+    __m256 time = _mm256_load_ps(packet->time);
+    
+    // b and c of the quadratic, with a = 1 since the directions are normalized
+    __m256 b = _mm256_setzero_ps();
+    __m256 c = _mm256_set1_ps(-object->sphere.radius*object->sphere.radius);
+    
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+        __m256 center = _mm256_add_ps(_mm256_set1_ps(object->sphere.pos.e[axis]), _mm256_mul_ps(time, _mm256_set1_ps(object->velocity.e[axis])));
+        __m256 offset = _mm256_sub_ps(_mm256_load_ps(packet->origin[axis]), center);
+        
+        b = _mm256_add_ps(b, _mm256_mul_ps(_mm256_load_ps(packet->dir[axis]), offset));
+        c = _mm256_add_ps(c, _mm256_mul_ps(offset, offset));
+    }
+    
+    b = _mm256_add_ps(b, b);
+    
+    __m256 discriminant = _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_mul_ps(_mm256_set1_ps(4.0f), c));
+    __m256 t = _mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(_mm256_setzero_ps(), b), _mm256_sqrt_ps(discriminant)), _mm256_set1_ps(0.5f));
+    
+    __m256 oldTClosest = _mm256_loadu_ps(tClosest);
+    __m256 hit = _mm256_and_ps(_mm256_cmp_ps(discriminant, _mm256_setzero_ps(), _CMP_GE_OQ),
+                               _mm256_and_ps(_mm256_cmp_ps(t, _mm256_set1_ps(MIN_T), _CMP_GT_OQ), _mm256_cmp_ps(t, oldTClosest, _CMP_LT_OQ)));
+    
+    u32 result = rayMask & (u32)_mm256_movemask_ps(hit);
+    
+    alignas(32) f32 tValues[RAY_PACKET_SIZE];
+    _mm256_store_ps(tValues, t);
+    
+    for (u32 lane = 0; lane < RAY_PACKET_SIZE; ++lane)
+    {
+        if (result & (1 << lane))
+            tClosest[lane] = tValues[lane];
+    }
+    
+    return result;
+}
+#else
+static inline u32 hit_test_box(RayPacket* packet, v3f boundsMin, v3f boundsMax, f32* tClosest, u32 rayMask, f32* outTEntry)
+{
+    u32 result = 0;
+    *outTEntry = F32_MAX;
+    
+    for (u32 lane = 0; lane < RAY_PACKET_SIZE; ++lane)
+    {
+        if (!(rayMask & (1 << lane)))
+            continue;
+        
+        f32 tNear = 0.0f;
+        f32 tFar = tClosest[lane];
+        
+        for (u32 axis = 0; axis < 3; ++axis)
+        {
+            f32 t0 = (boundsMin.e[axis] - packet->origin[axis][lane])*packet->inverseDir[axis][lane];
+            f32 t1 = (boundsMax.e[axis] - packet->origin[axis][lane])*packet->inverseDir[axis][lane];
+            
+            tNear = MAX_VALUE(tNear, MIN_VALUE(t0, t1));
+            tFar = MIN_VALUE(tFar, MAX_VALUE(t0, t1));
+        }
+        
+        if (tNear <= tFar)
+        {
+            result |= 1 << lane;
+            *outTEntry = MIN_VALUE(*outTEntry, tNear);
+        }
+    }
+    
+    return result;
+}
+
+static inline u32 intersect_sphere(RayPacket* packet, SphereObject* object, f32* tClosest, u32 rayMask)
+{
+    const f32 MIN_T = 0.001f;
+    
+    u32 result = 0;
+    
+    for (u32 lane = 0; lane < RAY_PACKET_SIZE; ++lane)
+    {
+        if (!(rayMask & (1 << lane)))
+            continue;
+        
+        Sphere testSphere = object->sphere;
+        testSphere.pos += packet->time[lane]*object->velocity;
+        
+        f32 t = intersection_test(get_packet_ray(packet, lane), testSphere);
+        if (t > MIN_T && t < tClosest[lane])
+        {
+            tClosest[lane] = t;
+            result |= 1 << lane;
+        }
+    }
+    
+    return result;
+}
+#endif
\ No newline at end of file
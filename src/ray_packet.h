@@ -0,0 +1,54 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include <immintrin.h>
+
+#include "types.h"
+#include "geometry.h"
+
+// number of rays traced together, one for each lane of an AVX register
+#define RAY_PACKET_SIZE 8
+#define RAY_PACKET_ALL_RAYS ((1 << RAY_PACKET_SIZE) - 1)
+
+// A group of rays that are traced through the BVH together, with each component stored as its own array so a
+// single set of SIMD instructions tests all of them against a box or a sphere. Packets only pay off when the rays
+// travel together, like the camera rays through neighbouring pixels.
+struct alignas(32) RayPacket
+{
+    f32 origin[3][RAY_PACKET_SIZE];
+    f32 dir[3][RAY_PACKET_SIZE];
+    f32 inverseDir[3][RAY_PACKET_SIZE];
+    f32 time[RAY_PACKET_SIZE];
+    
+    // The range of origins and inverse directions across the packet, which give bounds on where every ray enters
+    // and leaves a box with a single test. They're only used when all the directions have the same signs, since
+    // then every ray has the same near and far plane along each axis.
+    bool sameSigns;
+    v3f originMin;
+    v3f originMax;
+    v3f inverseDirMin;
+    v3f inverseDirMax;
+    
+    // which of a wide node's bounds arrays holds the near and far plane along each axis, as in WideRay
+    u32 nearPlane[3];
+    u32 farPlane[3];
+};
+
+void set_packet_ray(RayPacket* packet, u32 lane, Ray ray, f32 time);
+Ray get_packet_ray(RayPacket* packet, u32 lane);
+
+// works out the ranges used for culling, once all the rays have been set
+void finish_ray_packet(RayPacket* packet);
+
+// the largest of tValues over the rays in rayMask
+static inline f32 packet_max_t(f32* tValues, u32 rayMask);
+
+// Slab tests the box against the rays in rayMask, and returns the mask of the ones that enter it before their
+// tClosest. outTEntry is set to the nearest entry of any of those rays.
+static inline u32 hit_test_box(RayPacket* packet, v3f boundsMin, v3f boundsMax, f32* tClosest, u32 rayMask, f32* outTEntry);
+
+// Tests the sphere, at each ray's own time, against the rays in rayMask. Every ray that hits it closer than its
+// tClosest has tClosest moved up, and the mask of those rays is returned.
+static inline u32 intersect_sphere(RayPacket* packet, SphereObject* object, f32* tClosest, u32 rayMask);
+
+#endif //RAY_PACKET_H
@@ -50,6 +50,15 @@ Material Material::dialectric(f32 refractiveIndex)
     return result;
 }
 
+Material Material::emissive(v4f colour, f32 brightness)
+{
+    Material result = {};
+    result.type = Material::Type::EMISSIVE;
+    result.colour = colour;
+    result.brightness = brightness;
+    return result;
+}
+
 /*
 * Render Object Functions
 */
@@ -77,42 +86,200 @@ Rect3f SphereObject::get_bounding_box(f32 startTime, f32 endTime)
 * World Functions
 */
 
-SphereObject* World::add_sphere(v3f pos, f32 radius, Material* material, v3f velocity)
+// adds a sphere to the end of a list, doubling the list's capacity when it is full
+static SphereObject* append_sphere(SphereObject** objects, u32* objectCount, u32* objectCapacity,
+                                   v3f pos, f32 radius, u32 material, v3f velocity)
 {
-    assert(material);
-    assert(objectCount < ARRAY_LENGTH(objects));
-    
-    if (!material || objectCount >= ARRAY_LENGTH(objects))
-        return 0;
+    if (*objectCount == *objectCapacity)
+    {
+        u32 newCapacity = MAX_VALUE(*objectCapacity*2, 1024);
+        SphereObject* newObjects = (SphereObject*)memory_alloc(newCapacity*sizeof(SphereObject));
+        assert(newObjects);
+        
+        for (u32 i = 0; i < *objectCount; ++i)
+            newObjects[i] = (*objects)[i];
+        
+        if (*objects)
+            memory_free(*objects);
+        
+        *objects = newObjects;
+        *objectCapacity = newCapacity;
+    }
     
-    SphereObject* object = objects + objectCount;
+    SphereObject* object = *objects + *objectCount;
     *object = {};
     
     object->sphere.pos = pos;
     object->sphere.radius = radius;
-    object->material = *material;
+    object->material = material;
     object->velocity = velocity;
     
-    ++objectCount;
+    ++(*objectCount);
     
     return object;
 }
 
-PlaneObject* World::add_plane(v3f normal, f32 d, Material* material)
+SphereObject* Prototype::add_sphere(v3f pos, f32 radius, u32 material, v3f velocity)
+{
+    return append_sphere(&objects, &objectCount, &objectCapacity, pos, radius, material, velocity);
+}
+
+v3f Instance::to_world(v3f localPos)
+{
+    return pos + scale*(localPos.x*axes[0] + localPos.y*axes[1] + localPos.z*axes[2]);
+}
+
+u32 World::add_material(Material material)
+{
+    if (materialCount == materialCapacity)
+    {
+        u32 newCapacity = MAX_VALUE(materialCapacity*2, 1024);
+        Material* newMaterials = (Material*)memory_alloc(newCapacity*sizeof(Material));
+        assert(newMaterials);
+        
+        for (u32 i = 0; i < materialCount; ++i)
+            newMaterials[i] = materials[i];
+        
+        if (materials)
+            memory_free(materials);
+        
+        materials = newMaterials;
+        materialCapacity = newCapacity;
+    }
+    
+    materials[materialCount] = material;
+    
+    return materialCount++;
+}
+
+SphereObject* World::add_sphere(v3f pos, f32 radius, u32 material, v3f velocity)
+{
+    assert(material < materialCount);
+    
+    if (material >= materialCount)
+        return 0;
+    
+    return append_sphere(&objects, &objectCount, &objectCapacity, pos, radius, material, velocity);
+}
+
+void World::remove_sphere(u32 index)
+{
+    assert(index < objectCount);
+    
+    if (index >= objectCount)
+        return;
+    
+    objects[index] = objects[objectCount - 1];
+    --objectCount;
+}
+
+PlaneObject* World::add_plane(v3f normal, f32 d, u32 material)
 {
-    assert(material);
+    assert(material < materialCount);
     assert(planeCount < ARRAY_LENGTH(planes));
     
-    if (!material || planeCount >= ARRAY_LENGTH(planes))
+    if (material >= materialCount || planeCount >= ARRAY_LENGTH(planes))
         return 0;
     
     PlaneObject* object = planes + planeCount;
     *object = {};
     object->plane.normal = normal;
     object->plane.offset = d;
-    object->material = *material;
+    object->material = material;
     
     ++planeCount;
     
     return object;
+}
+
+Prototype* World::add_prototype()
+{
+    assert(prototypeCount < ARRAY_LENGTH(prototypes));
+    
+    if (prototypeCount >= ARRAY_LENGTH(prototypes))
+        return 0;
+    
+    Prototype* result = prototypes + prototypeCount;
+    *result = {};
+    
+    ++prototypeCount;
+    
+    return result;
+}
+
+Instance* World::add_instance(u32 prototype, v3f pos, f32 scale, f32 rotationDegrees)
+{
+    assert(prototype < prototypeCount);
+    assert(scale > 0.0f);
+    
+    if (prototype >= prototypeCount)
+        return 0;
+    
+    if (instanceCount == instanceCapacity)
+    {
+        u32 newCapacity = MAX_VALUE(instanceCapacity*2, 1024);
+        Instance* newInstances = (Instance*)memory_alloc(newCapacity*sizeof(Instance));
+        assert(newInstances);
+        
+        for (u32 i = 0; i < instanceCount; ++i)
+            newInstances[i] = instances[i];
+        
+        if (instances)
+            memory_free(instances);
+        
+        instances = newInstances;
+        instanceCapacity = newCapacity;
+    }
+    
+    Instance* instance = instances + instanceCount;
+    *instance = {};
+    
+    f32 angle = DEGREES_TO_RADIANS(rotationDegrees);
+    f32 cosAngle = (f32)cos(angle);
+    f32 sinAngle = (f32)sin(angle);
+    
+    instance->prototype = prototype;
+    instance->pos = pos;
+    instance->scale = scale;
+    instance->axes[0] = v3f(cosAngle, 0.0f, -sinAngle);
+    instance->axes[1] = v3f(0.0f, 1.0f, 0.0f);
+    instance->axes[2] = v3f(sinAngle, 0.0f, cosAngle);
+    
+    ++instanceCount;
+    
+    return instance;
+}
+
+void World::free_objects()
+{
+    if (objects)
+        memory_free(objects);
+    
+    objects = 0;
+    objectCount = 0;
+    objectCapacity = 0;
+    
+    for (u32 i = 0; i < prototypeCount; ++i)
+    {
+        if (prototypes[i].objects)
+            memory_free(prototypes[i].objects);
+    }
+    prototypeCount = 0;
+    
+    if (instances)
+        memory_free(instances);
+    
+    instances = 0;
+    instanceCount = 0;
+    instanceCapacity = 0;
+    
+    if (materials)
+        memory_free(materials);
+    
+    materials = 0;
+    materialCount = 0;
+    materialCapacity = 0;
+    
+    free_light_set(&lights);
+    free_environment_map(&environment);
 }
\ No newline at end of file
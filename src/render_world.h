@@ -1,6 +1,9 @@
 #ifndef RENDER_WORLD_H
 #define RENDER_WORLD_H
 
+#include "lights.h"
+#include "environment.h"
+
 struct Colour
 {
     static const v4f BLACK;
@@ -34,36 +37,41 @@ struct Material
         NONE,
         DIFFUSE,
         METAL,
-        DIALECTRIC
+        DIALECTRIC,
+        EMISSIVE // gives off light and doesn't bounce any
     };
     
     Type type;
     v4f colour;
     
-    // used by metal materials to control the fuzziness of reflections
+    // used by metal materials to control the fuzziness of reflections, the alpha of their GGX microfacets
     f32 roughness;
     
     // the refractive index for dialectric materials
     f32 n;
     
+    // emissive materials give off their colour times this
+    f32 brightness;
+    
     // creating new materials
     static Material diffuse(v4f colour);
     static Material metal(v4f colour, f32 roughness = 0.0f);
     static Material dialectric(f32 refractiveIndex);
+    static Material emissive(v4f colour, f32 brightness = 1.0f);
 };
 
-// TODO: Do i want each object to have it's own material, or do I want to have a master
-// material list that each object has an index into?
 struct SphereObject
 {
-    Material material;
     Sphere sphere;
     
     // used for objects that move during the render interval
     // NOTE: the position of all objects are assumed to be defined at time = 0.0, so all times past that will be affected by the velocity
     v3f velocity;
     
-    SphereObject() : material({}), sphere({}) {}
+    // index into World::materials, so the shading data stays out of the way of the geometry
+    u32 material;
+    
+    SphereObject() : sphere({}), velocity(), material(0) {}
     
     // get the object position at the given time
     v3f pos(f32 time = 0.0f);
@@ -72,27 +80,89 @@ struct SphereObject
 
 struct PlaneObject
 {
-    Material material;
     Plane plane;
     
-    PlaneObject() : material({}), plane({}) {}
+    // index into World::materials
+    u32 material;
+    
+    PlaneObject() : plane({}), material(0) {}
+};
+
+// a group of spheres that can be placed around the world any number of times, while only being stored once
+struct Prototype
+{
+    // positions are relative to the prototype's origin
+    u32 objectCount;
+    u32 objectCapacity;
+    SphereObject* objects;
+    
+    // material is an index into the world's materials
+    SphereObject* add_sphere(v3f pos, f32 radius, u32 material, v3f velocity = v3f());
+};
+
+// A copy of a prototype placed in the world. The prototype is scaled, then rotated so its axes line up with
+// the instance's, and then moved to the instance's position.
+// NOTE: only uniform scales are allowed, so the spheres stay spheres
+struct Instance
+{
+    u32 prototype;
+    
+    v3f pos;
+    f32 scale;
+    
+    // the prototype's x, y and z axes in world space
+    v3f axes[3];
+    
+    v3f to_world(v3f localPos);
 };
 
-// TODO: perhaps also keep track of a material list?
 struct World
 {
+    // every object refers to its material by its index in this list
+    u32 materialCount;
+    u32 materialCapacity;
+    Material* materials;
+    
+    // grows as spheres are added, so any pointers into it are only valid until the next add_sphere
     u32 objectCount;
-    SphereObject objects[4192];
+    u32 objectCapacity;
+    SphereObject* objects;
     
     u32 planeCount;
     PlaneObject planes[64];
     
+    u32 prototypeCount;
+    Prototype prototypes[64];
+    
+    u32 instanceCount;
+    u32 instanceCapacity;
+    Instance* instances;
+    
+    // the spheres with emissive materials, see build_light_set
+    LightSet lights;
+    
+    // what rays that miss everything see, the sky gradient in background_colour if it isn't loaded
+    EnvironmentMap environment;
+    
     // defines the interval during which our rendering takes place
     f32 startTime;
     f32 endTime;
     
-    SphereObject* add_sphere(v3f pos, f32 radius, Material* material, v3f velocity = v3f());
-    PlaneObject* add_plane(v3f normal, f32 d, Material* material);
+    // returns the index objects use to refer to the material
+    u32 add_material(Material material);
+    
+    SphereObject* add_sphere(v3f pos, f32 radius, u32 material, v3f velocity = v3f());
+    
+    // NOTE: the last sphere is moved into the removed one's place, so its index changes
+    void remove_sphere(u32 index);
+    PlaneObject* add_plane(v3f normal, f32 d, u32 material);
+    
+    Prototype* add_prototype();
+    
+    // places the prototype after scaling it and rotating it about the y axis
+    Instance* add_instance(u32 prototype, v3f pos, f32 scale = 1.0f, f32 rotationDegrees = 0.0f);
+    
+    void free_objects();
 };
 
 #endif //RENDER_WORLD_H
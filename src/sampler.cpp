@@ -0,0 +1,298 @@
+#include "sampler.h"
+
+// the fractional part of the golden ratio as a fraction of 2^64, which spreads out consecutive counters
+#define GOLDEN_GAMMA 0x9E3779B97F4A7C15ull
+
+// the splitmix64 finalizer, every bit of the input affects every bit of the output
+static inline u64 mix_bits(u64 x)
+{
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    
+    return x;
+}
+
+// Laine and Karras' hash, as improved by Vegdahl, where each bit is only changed by the bits below it
+static inline u32 laine_karras_permutation(u32 x, u32 seed)
+{
+    x ^= x*0x3D20ADEA;
+    x += seed;
+    x *= (seed >> 16) | 1;
+    x ^= x*0x05526C56;
+    x ^= x*0x53A22864;
+    
+    return x;
+}
+
+static inline u32 reverse_bits(u32 x)
+{
+    // NOTE: swapping the bytes takes care of the top two levels of swaps in one instruction
+    x = _byteswap_ulong(x);
+    x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+    x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+    x = ((x >> 4) & 0x0F0F0F0F) | ((x & 0x0F0F0F0F) << 4);
+    
+    return x;
+}
+
+// Owen scrambling, where each bit is only changed by the bits above it. Run on a sample index it shuffles the
+// samples without breaking up any power of two sized block of them, so the first 2^k samples stay a well spread set.
+static inline u32 nested_uniform_scramble(u32 x, u32 seed)
+{
+    return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+// The second dimension of the Sobol sequence with its bits reversed, the first is just the index. Bit i of the
+// result is the parity of the index bits j where C(j, i) is odd, which by Lucas' theorem are the j that have every
+// bit of i set, so it can be worked out a bit of i at a time instead of an index bit at a time.
+static inline u32 reversed_sobol_dimension_1(u32 index)
+{
+    index ^= (index >> 1) & 0x55555555;
+    index ^= (index >> 2) & 0x33333333;
+    index ^= (index >> 4) & 0x0F0F0F0F;
+    index ^= (index >> 8) & 0x00FF00FF;
+    index ^= (index >> 16) & 0x0000FFFF;
+    
+    return index;
+}
+
+// Kensler's hashed permutation of the numbers below length, which walks the cycle until it lands back in range
+static inline u32 permute(u32 i, u32 length, u32 seed)
+{
+    u32 mask = length - 1;
+    mask |= mask >> 1;
+    mask |= mask >> 2;
+    mask |= mask >> 4;
+    mask |= mask >> 8;
+    mask |= mask >> 16;
+    
+    do
+    {
+        i ^= seed;
+        i *= 0xE170893D;
+        i ^= seed >> 16;
+        i ^= (i & mask) >> 4;
+        i ^= seed >> 8;
+        i *= 0x0929EB3F;
+        i ^= seed >> 23;
+        i ^= (i & mask) >> 1;
+        i *= 1 | seed >> 27;
+        i *= 0x6935FA69;
+        i ^= (i & mask) >> 11;
+        i *= 0x74DCB303;
+        i ^= (i & mask) >> 2;
+        i *= 0x9E501CC3;
+        i ^= (i & mask) >> 2;
+        i *= 0xC860A3DF;
+        i &= mask;
+        i ^= i >> 5;
+    } while (i >= length);
+    
+    return (i + seed) % length;
+}
+
+// 1/g and 1/g^2 as fractions of 2^32, where g is the plastic number, the steps of the R2 sequence
+#define R2_A 0xC13FA9A9
+#define R2_B 0x91E10DA5
+static const u32 R2_GENERATORS[2] = { R2_A, R2_B };
+
+// NOTE: The R2 dither, which shifts neighbouring pixels far apart and so pushes the noise into high frequencies. It's
+// only used for the two pairs of dimensions that matter most to how the noise looks, the pixel jitter and the first
+// bounce. Each row is the steps in x and y for both dimensions of a pair, mixed differently for each of the four
+// dimensions so none of them follow another from pixel to pixel.
+static const u32 R2_DITHERS[2][4] = { { R2_A, R2_B, R2_B, R2_A }, { R2_A, 0 - R2_B, 0 - R2_B, R2_A } };
+
+static inline Sampler make_sampler(SamplerSettings* settings, u32 pixelX, u32 pixelY, u32 sample)
+{
+    Sampler result = {};
+    result.type = settings->type;
+    result.sample = sample;
+    
+    u64 pixel = ((u64)pixelY << 48) | ((u64)pixelX << 32);
+    
+    switch (settings->type)
+    {
+        case Sampler::Type::RANDOM:
+            result.key = mix_bits(mix_bits(settings->seed) ^ pixel ^ sample);
+            break;
+        
+        case Sampler::Type::STRATIFIED:
+        {
+            // the squarest grid with at least a cell for every sample
+            u32 sampleCount = MIN_VALUE(MAX_VALUE(settings->sampleCount, 1u), 1u << 30);
+            result.strataX = (u32)ceil(sqrt((f64)sampleCount));
+            result.strataY = (sampleCount + result.strataX - 1)/result.strataX;
+            result.key = mix_bits(mix_bits(settings->seed) ^ pixel);
+        } break;
+        
+        case Sampler::Type::SOBOL:
+            result.key = mix_bits(mix_bits(settings->seed) ^ pixel);
+            break;
+        
+        case Sampler::Type::RANK1:
+            result.key = mix_bits(mix_bits(settings->seed) ^ pixel);
+            result.latticeKey = mix_bits(settings->seed);
+            result.pixelX = pixelX;
+            result.pixelY = pixelY;
+            break;
+    }
+    
+    return result;
+}
+
+static inline void start_bounce(Sampler* sampler, u32 bounce)
+{
+    sampler->bounce = bounce;
+    sampler->dimension = 0;
+}
+
+// Bob Jenkins' lowbias32 integer hash, for when a second seed is needed from one that's already been hashed
+static inline u32 hash_u32(u32 x)
+{
+    x ^= x >> 16;
+    x *= 0x7FEB352D;
+    x ^= x >> 15;
+    x *= 0x846CA68B;
+    x ^= x >> 16;
+    
+    return x;
+}
+
+// both dimensions of one of the bounce's pairs as fractions of 2^32, for the samplers that work in pairs
+static inline void sample_pair_bits(Sampler* sampler, u32 pair, u32* outBits)
+{
+    u64 pairCounter = ((u64)sampler->bounce << 32) | pair;
+    u64 pairHash = mix_bits(sampler->key + pairCounter*GOLDEN_GAMMA);
+    
+    switch (sampler->type)
+    {
+        case Sampler::Type::STRATIFIED:
+        {
+            // once a grid's worth of samples is used up, the next lot gets a grid shuffled a different way
+            u32 cellCount = sampler->strataX*sampler->strataY;
+            u32 round = sampler->sample/cellCount;
+            u32 cell = permute(sampler->sample % cellCount, cellCount, (u32)pairHash + round*0x9E3779B9);
+            
+            u32 stratumX = cell % sampler->strataX;
+            u32 stratumY = cell/sampler->strataX;
+            u64 jitter = mix_bits(pairHash + sampler->sample*GOLDEN_GAMMA);
+            
+            // the start of the cell, plus the jitter scaled down to the cell's size
+            outBits[0] = (u32)((((u64)stratumX << 32) + (u32)jitter)/sampler->strataX);
+            outBits[1] = (u32)((((u64)stratumY << 32) + (u32)(jitter >> 32))/sampler->strataY);
+        } break;
+        
+        case Sampler::Type::SOBOL:
+        {
+            u32 index = nested_uniform_scramble(sampler->sample, (u32)pairHash);
+            u32 scrambleSeed = (u32)(pairHash >> 32);
+            
+            // NOTE: the points come out with their bits reversed, which is the order the scramble works in anyway
+            outBits[0] = reverse_bits(laine_karras_permutation(index, scrambleSeed));
+            outBits[1] = reverse_bits(laine_karras_permutation(reversed_sobol_dimension_1(index), hash_u32(scrambleSeed)));
+        } break;
+        
+        case Sampler::Type::RANK1:
+        {
+            u64 latticeHash = mix_bits(sampler->latticeKey + pairCounter*GOLDEN_GAMMA);
+            u32 index = nested_uniform_scramble(sampler->sample, (u32)latticeHash);
+            
+            u32 shift[2] = { (u32)pairHash, (u32)(pairHash >> 32) };
+            if (sampler->bounce < 2 && pair == 0)
+            {
+                u32 latticeShift = (u32)(latticeHash >> 32);
+                const u32* dither = R2_DITHERS[sampler->bounce];
+                
+                shift[0] = sampler->pixelX*dither[0] + sampler->pixelY*dither[1] + latticeShift;
+                shift[1] = sampler->pixelX*dither[2] + sampler->pixelY*dither[3] + hash_u32(latticeShift);
+            }
+            
+            // the points wrap around the unit square, which is where the lattice gets its even spread
+            outBits[0] = index*R2_GENERATORS[0] + shift[0];
+            outBits[1] = index*R2_GENERATORS[1] + shift[1];
+        } break;
+        
+        case Sampler::Type::RANDOM:
+        {
+            // NOTE: the same numbers sample_bits would give, one dimension at a time
+            u64 counter = ((u64)sampler->bounce << 32) | (pair << 1);
+            outBits[0] = (u32)(mix_bits(sampler->key + counter*GOLDEN_GAMMA) >> 32);
+            outBits[1] = (u32)(mix_bits(sampler->key + (counter + 1)*GOLDEN_GAMMA) >> 32);
+        } break;
+    }
+}
+
+// 32 random bits for the sampler's next dimension
+static inline u32 sample_bits(Sampler* sampler)
+{
+    if (sampler->type == Sampler::Type::RANDOM)
+    {
+        u64 counter = ((u64)sampler->bounce << 32) | sampler->dimension++;
+        return (u32)(mix_bits(sampler->key + counter*GOLDEN_GAMMA) >> 32);
+    }
+    
+    // NOTE: the second dimension of a pair always comes straight after the first, so it's kept from when the
+    // first was drawn instead of working the pair out again
+    if (sampler->dimension++ & 1)
+        return sampler->pairSecond;
+    
+    u32 bits[2];
+    sample_pair_bits(sampler, sampler->dimension >> 1, bits);
+    sampler->pairSecond = bits[1];
+    
+    return bits[0];
+}
+
+// NOTE: the top 24 bits fill a float's mantissa exactly, so the result can never round up to 1
+static inline f32 bits_to_f32(u32 bits)
+{
+    return (bits >> 8)*(1.0f/16777216.0f);
+}
+
+static inline f32 sample_f32(Sampler* sampler)
+{
+    return bits_to_f32(sample_bits(sampler));
+}
+
+static inline f32 sample_f32(Sampler* sampler, f32 min, f32 max)
+{
+    assert(min <= max);
+    return sample_f32(sampler)*(max - min) + min;
+}
+
+static inline v2f sample_v2f(Sampler* sampler)
+{
+    sampler->dimension = (sampler->dimension + 1) & ~1u;
+    
+    u32 bits[2];
+    sample_pair_bits(sampler, sampler->dimension >> 1, bits);
+    sampler->dimension += 2;
+    
+    return v2f(bits_to_f32(bits[0]), bits_to_f32(bits[1]));
+}
+
+static v3f random_point_in_unit_sphere(Sampler* sampler)
+{
+    v2f direction = sample_v2f(sampler);
+    return warp_uniform_ball(direction, sample_f32(sampler));
+}
+
+static v3f random_point_in_sphere(Sampler* sampler, Sphere* sphere)
+{
+    v3f randomPoint = random_point_in_unit_sphere(sampler);
+    return randomPoint*sphere->radius + sphere->pos;
+}
+
+static v3f random_unit_vector(Sampler* sampler)
+{
+    return warp_uniform_sphere(sample_v2f(sampler));
+}
+
+static v3f random_point_in_unit_circle(Sampler* sampler)
+{
+    v2f point = warp_concentric_disk(sample_v2f(sampler));
+    return v3f(point.x, point.y, 0.0f);
+}
\ No newline at end of file
@@ -0,0 +1,86 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "types.h"
+#include "geometry.h"
+#include "warps.h"
+
+// A counter based random number generator. Each number is a hash of the pixel, the sample, the bounce and how many
+// numbers that bounce has already used, instead of the next number of a stream some thread owns. So a sample always
+// gets the same numbers, whichever thread traces it and whatever was traced before it, and renders come out the
+// same bit for bit every time.
+//
+// The numbers a bounce uses are its dimensions, and apart from RANDOM the samplers work on them two at a time. Each
+// pair of dimensions of each bounce gets a well spread 2D point set of its own, with the order of the samples
+// shuffled for every pair so the pairs don't line up with each other.
+struct Sampler
+{
+    enum Type
+    {
+        RANDOM, // every number is hashed on its own, white noise
+        STRATIFIED, // a jittered grid of cells for each pair, with the cells handed out in a shuffled order
+        SOBOL, // the first two Sobol dimensions for each pair, Owen scrambled per pixel
+        RANK1 // the R2 rank-1 lattice for each pair, shifted per pixel, with a blue noise dither for the camera and first bounce
+    };
+    
+    Type type;
+    
+    // hash of the seed and pixel, and for RANDOM the sample as well
+    u64 key;
+    u32 sample;
+    
+    // STRATIFIED only, the size of the grid each pair of dimensions is split into
+    u32 strataX;
+    u32 strataY;
+    
+    // RANK1 only, every pixel shares the lattice and the order of its samples, which come from this hash of the
+    // seed, and the pixel only picks how far the lattice is shifted
+    u64 latticeKey;
+    u32 pixelX;
+    u32 pixelY;
+    
+    // camera rays are bounce 0
+    u32 bounce;
+    u32 dimension;
+    
+    // the second dimension of the pair the last number came from, for the samplers that work in pairs
+    u32 pairSecond;
+};
+
+// which sampler a render uses, the same for both engines
+struct SamplerSettings
+{
+    Sampler::Type type;
+    
+    // a different seed gives different noise
+    u32 seed;
+    
+    // how many samples each pixel is expected to get, which STRATIFIED sizes its grid for
+    u32 sampleCount;
+};
+
+// the names the samplers go by on the command line, in the order of Sampler::Type
+static const char* SAMPLER_NAMES[] = { "random", "stratified", "sobol", "rank1" };
+
+// the sampler for one sample of a pixel
+static inline Sampler make_sampler(SamplerSettings* settings, u32 pixelX, u32 pixelY, u32 sample);
+
+// moves the sampler on to the numbers for a bounce of the path
+static inline void start_bounce(Sampler* sampler, u32 bounce);
+
+// returns a value in the range [0, 1)
+static inline f32 sample_f32(Sampler* sampler);
+// returns a value in the range [min, max)
+static inline f32 sample_f32(Sampler* sampler, f32 min, f32 max);
+
+// Returns a point in [0, 1)^2. Both values come from the same pair of dimensions, skipping ahead to the next pair
+// if one has already been started, so the samplers that spread points out in 2D can do so here.
+static inline v2f sample_v2f(Sampler* sampler);
+
+// the same as the ones in utils.h, with the numbers drawn from the sampler, see warps.h
+static v3f random_point_in_unit_sphere(Sampler* sampler);
+static v3f random_point_in_sphere(Sampler* sampler, Sphere* sphere);
+static v3f random_unit_vector(Sampler* sampler);
+static v3f random_point_in_unit_circle(Sampler* sampler);
+
+#endif //SAMPLER_H
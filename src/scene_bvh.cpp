@@ -0,0 +1,264 @@
+#include "scene_bvh.h"
+
+// makes the layout the renderer traverses from the tree
+static void convert_scene_bvh(SceneBVH* bvh, BVHBuildSettings* settings)
+{
+    switch (bvh->layout)
+    {
+        case SceneBVH::Layout::BINARY:
+            bvh->binary = flatten_bvh(&bvh->tree);
+            break;
+        case SceneBVH::Layout::WIDE_4:
+            bvh->wide4 = collapse_bvh<4>(&bvh->tree);
+            break;
+        case SceneBVH::Layout::WIDE_8:
+            bvh->wide8 = collapse_bvh<8>(&bvh->tree);
+            break;
+        case SceneBVH::Layout::MOTION:
+            bvh->motion = flatten_motion_bvh(&bvh->tree, settings->startTime, settings->endTime);
+            break;
+        case SceneBVH::Layout::DYNAMIC:
+            bvh->dynamic = make_dynamic_bvh(&bvh->tree);
+            break;
+    }
+}
+
+static void unmap_scene_bvh_cache(SceneBVH* bvh)
+{
+    UnmapViewOfFile(bvh->cacheView);
+    CloseHandle(bvh->cacheMapping);
+    CloseHandle(bvh->cacheFile);
+    
+    bvh->cacheView = 0;
+    bvh->cacheMapping = 0;
+    bvh->cacheFile = 0;
+}
+
+static void free_scene_bvh_layout(SceneBVH* bvh)
+{
+    switch (bvh->layout)
+    {
+        case SceneBVH::Layout::BINARY:
+            free_linear_bvh(&bvh->binary);
+            break;
+        case SceneBVH::Layout::WIDE_4:
+            free_wide_bvh(&bvh->wide4);
+            break;
+        case SceneBVH::Layout::WIDE_8:
+            free_wide_bvh(&bvh->wide8);
+            break;
+        case SceneBVH::Layout::MOTION:
+            free_motion_bvh(&bvh->motion);
+            break;
+        case SceneBVH::Layout::DYNAMIC:
+            free_dynamic_bvh(&bvh->dynamic);
+            break;
+    }
+}
+
+SceneBVH build_scene_bvh(World* world, BVHBuildSettings* settings, SceneBVH::Layout layout, BVHStats* outStats)
+{
+    assert(world);
+    assert(settings);
+    
+    SceneBVH result = {};
+    result.layout = layout;
+    result.objectCount = world->objectCount;
+    
+    // NOTE: a world can be made up entirely of instances
+    if (world->objectCount > 0)
+    {
+        result.tree = build_bvh(world->objects, world->objectCount, settings);
+        assert(result.tree.root);
+        
+        BVHStats stats = compute_bvh_stats(&result.tree);
+        result.builtCost = stats.sahCost;
+        result.cost = stats.sahCost;
+        
+        if (outStats)
+            *outStats = stats;
+        
+        convert_scene_bvh(&result, settings);
+    }
+    
+    result.instances = build_instance_bvh(world, settings);
+    
+    return result;
+}
+
+bool update_scene_bvh(SceneBVH* bvh, World* world, BVHBuildSettings* settings, BVHStats* outStats)
+{
+    assert(bvh && (bvh->tree.root || bvh->cacheView || bvh->objectCount == 0));
+    assert(bvh->layout != SceneBVH::Layout::DYNAMIC);
+    assert(world);
+    assert(settings);
+    
+    // NOTE: refitting keeps the structure of the tree, so it only works for the same set of objects
+    assert(world->objectCount == bvh->objectCount);
+    
+    bool rebuilt = false;
+    
+    // NOTE: a world made up entirely of instances has no tree, only the instances need updating
+    if (bvh->objectCount > 0)
+    {
+        if (bvh->cacheView)
+        {
+            // a BVH loaded from the cache has no tree that could be refit, so the first update has to build one
+            unmap_scene_bvh_cache(bvh);
+            rebuilt = true;
+        }
+        else
+        {
+            bvh->tree.objects = world->objects;
+            bvh->cost = refit_bvh(&bvh->tree, settings->startTime, settings->endTime);
+            
+            if (bvh->cost > settings->maxRefitCostGrowth*bvh->builtCost)
+            {
+                free_bvh(&bvh->tree);
+                rebuilt = true;
+            }
+            
+            free_scene_bvh_layout(bvh);
+        }
+        
+        if (rebuilt)
+        {
+            bvh->tree = build_bvh(world->objects, world->objectCount, settings);
+            
+            bvh->builtCost = compute_bvh_stats(&bvh->tree).sahCost;
+            bvh->cost = bvh->builtCost;
+        }
+        
+        if (outStats)
+            *outStats = compute_bvh_stats(&bvh->tree);
+        
+        convert_scene_bvh(bvh, settings);
+    }
+    
+    // NOTE: there are only ever a handful of prototypes, so they're cheap enough to rebuild every time
+    free_instance_bvh(&bvh->instances);
+    bvh->instances = build_instance_bvh(world, settings);
+    
+    return rebuilt;
+}
+
+void free_scene_bvh(SceneBVH* bvh)
+{
+    if (bvh->cacheView)
+        unmap_scene_bvh_cache(bvh);
+    else if (bvh->tree.root)
+    {
+        free_scene_bvh_layout(bvh);
+        free_bvh(&bvh->tree);
+    }
+    
+    free_instance_bvh(&bvh->instances);
+}
+
+static f32 intersection_test(Ray ray, SceneBVH* bvh, f32 time, f32 tMax, SphereObject** outObject, Sphere* outSphere)
+{
+    f32 tResult = F32_MAX;
+    
+    if (bvh->objectCount > 0)
+    {
+        switch (bvh->layout)
+        {
+            case SceneBVH::Layout::BINARY:
+                tResult = intersection_test(ray, &bvh->binary, time, tMax, outObject);
+                break;
+            case SceneBVH::Layout::WIDE_4:
+                tResult = intersection_test(ray, &bvh->wide4, time, tMax, outObject);
+                break;
+            case SceneBVH::Layout::WIDE_8:
+                tResult = intersection_test(ray, &bvh->wide8, time, tMax, outObject);
+                break;
+            case SceneBVH::Layout::MOTION:
+                tResult = intersection_test(ray, &bvh->motion, time, tMax, outObject);
+                break;
+            case SceneBVH::Layout::DYNAMIC:
+                tResult = intersection_test(ray, &bvh->dynamic, time, tMax, outObject);
+                break;
+        }
+        
+        if (tResult != F32_MAX)
+            *outSphere = Sphere((*outObject)->pos(time), (*outObject)->sphere.radius);
+    }
+    
+    // anything closer than the best standalone object hit is also in front of it
+    f32 tInstance = intersection_test(ray, &bvh->instances, time, MIN_VALUE(tResult, tMax), outObject, outSphere);
+    if (tInstance != F32_MAX)
+        tResult = tInstance;
+    
+    return tResult;
+}
+
+static bool occlusion_test(Ray ray, SceneBVH* bvh, f32 time, f32 tMax)
+{
+    if (bvh->objectCount > 0)
+    {
+        bool occluded = false;
+        switch (bvh->layout)
+        {
+            case SceneBVH::Layout::BINARY:
+                occluded = occlusion_test(ray, &bvh->binary, time, tMax);
+                break;
+            case SceneBVH::Layout::WIDE_4:
+                occluded = occlusion_test(ray, &bvh->wide4, time, tMax);
+                break;
+            case SceneBVH::Layout::WIDE_8:
+                occluded = occlusion_test(ray, &bvh->wide8, time, tMax);
+                break;
+            case SceneBVH::Layout::MOTION:
+                occluded = occlusion_test(ray, &bvh->motion, time, tMax);
+                break;
+            case SceneBVH::Layout::DYNAMIC:
+                occluded = occlusion_test(ray, &bvh->dynamic, time, tMax);
+                break;
+        }
+        
+        if (occluded)
+            return true;
+    }
+    
+    return occlusion_test(ray, &bvh->instances, time, tMax);
+}
+
+static void intersection_test(RayPacket* packet, SceneBVH* bvh, f32* outT, SphereObject** outObjects, Sphere* outSpheres)
+{
+    for (u32 lane = 0; lane < RAY_PACKET_SIZE; ++lane)
+        outT[lane] = F32_MAX;
+    
+    bool tracedPacket = false;
+    if (bvh->objectCount > 0)
+    {
+        if (bvh->layout == SceneBVH::Layout::WIDE_4)
+        {
+            intersection_test(packet, &bvh->wide4, outT, outObjects);
+            tracedPacket = true;
+        }
+        else if (bvh->layout == SceneBVH::Layout::WIDE_8)
+        {
+            intersection_test(packet, &bvh->wide8, outT, outObjects);
+            tracedPacket = true;
+        }
+    }
+    
+    for (u32 lane = 0; lane < RAY_PACKET_SIZE; ++lane)
+    {
+        Ray ray = get_packet_ray(packet, lane);
+        f32 time = packet->time[lane];
+        
+        if (!tracedPacket)
+            outT[lane] = intersection_test(ray, bvh, time, F32_MAX, outObjects + lane, outSpheres + lane);
+        else
+        {
+            if (outT[lane] != F32_MAX)
+                outSpheres[lane] = Sphere(outObjects[lane]->pos(time), outObjects[lane]->sphere.radius);
+            
+            // NOTE: instances are still traced one ray at a time, but only in front of whatever sphere each ray hit
+            f32 tInstance = intersection_test(ray, &bvh->instances, time, outT[lane], outObjects + lane, outSpheres + lane);
+            if (tInstance != F32_MAX)
+                outT[lane] = tInstance;
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,74 @@
+#ifndef SCENE_BVH_H
+#define SCENE_BVH_H
+
+#include "types.h"
+#include "bvh.h"
+#include "wide_bvh.h"
+#include "motion_bvh.h"
+#include "dynamic_bvh.h"
+#include "instance_bvh.h"
+
+// the acceleration structure the renderer traces rays against, in whichever node layout was chosen
+struct SceneBVH
+{
+    enum Layout
+    {
+        BINARY, // two children per node
+        WIDE_4, // four children per node, tested together with SSE
+        WIDE_8, // eight children per node, tested together with AVX
+        MOTION, // two children per node, with boxes interpolated to each ray's time for moving objects
+        DYNAMIC // two children per node and one object per leaf, objects can be inserted and removed one at a time
+    };
+    
+    Layout layout;
+    
+    // the number of objects the layout was made from, 0 when the world is made up entirely of instances
+    u32 objectCount;
+    
+    // the tree the layout was made from, kept around so it can be refit or rebuilt when the objects move
+    BVH tree;
+    
+    // SAH cost of the tree right after it was last built from scratch, and after its latest refit
+    f32 builtCost;
+    f32 cost;
+    
+    // only set when the layout was loaded from a cache file, in which case its arrays point into this mapped view
+    // of the file rather than being allocated, and there is no tree
+    void* cacheView;
+    HANDLE cacheFile;
+    HANDLE cacheMapping;
+    
+    // the world's instances are always kept in their own two level BVH, whatever the layout
+    InstanceBVH instances;
+    
+    // only the member matching the layout is valid
+    LinearBVH binary;
+    WideBVH<4> wide4;
+    WideBVH<8> wide8;
+    MotionBVH motion;
+    DynamicBVH dynamic;
+};
+
+// builds a tree over all the spheres in the world, and fills outStats with a report on the tree if given
+SceneBVH build_scene_bvh(World* world, BVHBuildSettings* settings, SceneBVH::Layout layout, BVHStats* outStats = 0);
+void free_scene_bvh(SceneBVH* bvh);
+
+// Moves the BVH to the interval in settings, for rendering the next frame of an animation. The tree is refit in
+// place unless that makes it more than settings->maxRefitCostGrowth times as costly as when it was built, in which
+// case it is rebuilt. Returns true if the tree was rebuilt.
+// NOTE: dynamic BVHs are kept up to date by inserting and removing objects instead, and can't be updated this way
+bool update_scene_bvh(SceneBVH* bvh, World* world, BVHBuildSettings* settings, BVHStats* outStats = 0);
+
+// Returns the distance to the closest object hit before tMax, or F32_MAX if nothing was hit. outSphere is filled
+// with the sphere that was hit, where it is at the ray's time and in world space even if it is part of an instance.
+static f32 intersection_test(Ray ray, SceneBVH* bvh, f32 time, f32 tMax, SphereObject** outObject, Sphere* outSphere);
+
+// Returns true if the ray hits any sphere before tMax, whether it's one of the world's or part of an instance. Shadow
+// rays only need to know whether anything is in the way, so this stops at the first hit it finds.
+static bool occlusion_test(Ray ray, SceneBVH* bvh, f32 time, f32 tMax);
+
+// Traces the packet's rays against the world's spheres, filling in the same results as the single ray test for each
+// of them. The wide layouts trace the rays together, the others fall back to tracing them one at a time.
+static void intersection_test(RayPacket* packet, SceneBVH* bvh, f32* outT, SphereObject** outObjects, Sphere* outSpheres);
+
+#endif //SCENE_BVH_H
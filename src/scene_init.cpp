@@ -4,7 +4,7 @@ static void generate_random_sphere_grid(World* world, u32 numRows, u32 numCols,
 {
     f32 cellSize = maxRadius*2.0f;
     
-    Material glassMaterial = Material::dialectric(1.42f);
+    u32 glassMaterial = world->add_material(Material::dialectric(1.42f));
     
     for (u32 row = 0; row < numRows; ++row)
     {
@@ -15,19 +15,17 @@ static void generate_random_sphere_grid(World* world, u32 numRows, u32 numCols,
             f32 sphereSize = random_f32(minRadius, maxRadius);
             v3f spherePos = v3f(row*cellSize, yLevel + sphereSize, col*cellSize);
             
-            Material sphereMaterial;
+            u32 sphereMaterial = glassMaterial;
             
             v4f sphereColour = v4f(random_v3f());
             sphereColour.b = 1.0f;
             
             if (materialChoice < 50)
-                sphereMaterial = Material::diffuse(sphereColour);
+                sphereMaterial = world->add_material(Material::diffuse(sphereColour));
             else if (materialChoice < 90)
-                sphereMaterial = Material::metal(sphereColour, random_f32());
-            else
-                sphereMaterial = glassMaterial;
+                sphereMaterial = world->add_material(Material::metal(sphereColour, random_f32()));
             
-            world->add_sphere(spherePos, sphereSize, &sphereMaterial);
+            world->add_sphere(spherePos, sphereSize, sphereMaterial);
         }
     }
 }
@@ -39,30 +37,30 @@ void init_test_scene_1(World* world, Camera* camera, f32 aspectRatio)
     
     // adding a bunch of materials
     
-    Material materialList[32] = {};
+    u32 materialList[32] = {};
     u32 numMaterials = 0;
-    materialList[numMaterials++] = Material::dialectric(1.5f);
-    materialList[numMaterials++] = Material::metal(Colour::GOLD, 0.2f);
-    materialList[numMaterials++] = Material::metal(Colour::SILVER, 0.01f);
-    materialList[numMaterials++] = Material::diffuse(Colour::WHITE);
-    materialList[numMaterials++] = Material::diffuse(Colour::RED);
-    materialList[numMaterials++] = Material::diffuse(Colour::ORANGE);
-    materialList[numMaterials++] = Material::diffuse(Colour::YELLOW);
-    materialList[numMaterials++] = Material::diffuse(Colour::GREEN);
-    materialList[numMaterials++] = Material::diffuse(Colour::BLUE);
-    materialList[numMaterials++] = Material::diffuse(Colour::INDIGO);
-    materialList[numMaterials++] = Material::diffuse(Colour::VIOLET);
-    materialList[numMaterials++] = Material::diffuse(Colour::PINK);
-    materialList[numMaterials++] = Material::diffuse(Colour::MAROON);
-    materialList[numMaterials++] = Material::diffuse(Colour::LAVENDER);
-    materialList[numMaterials++] = Material::diffuse(Colour::CYAN);
-    materialList[numMaterials++] = Material::diffuse(Colour::TEAL);
-    materialList[numMaterials++] = Material::diffuse(Colour::DARK_GREEN);
-    materialList[numMaterials++] = Material::diffuse(Colour::BROWN);
+    materialList[numMaterials++] = world->add_material(Material::dialectric(1.5f));
+    materialList[numMaterials++] = world->add_material(Material::metal(Colour::GOLD, 0.2f));
+    materialList[numMaterials++] = world->add_material(Material::metal(Colour::SILVER, 0.01f));
+    materialList[numMaterials++] = world->add_material(Material::diffuse(Colour::WHITE));
+    materialList[numMaterials++] = world->add_material(Material::diffuse(Colour::RED));
+    materialList[numMaterials++] = world->add_material(Material::diffuse(Colour::ORANGE));
+    materialList[numMaterials++] = world->add_material(Material::diffuse(Colour::YELLOW));
+    materialList[numMaterials++] = world->add_material(Material::diffuse(Colour::GREEN));
+    materialList[numMaterials++] = world->add_material(Material::diffuse(Colour::BLUE));
+    materialList[numMaterials++] = world->add_material(Material::diffuse(Colour::INDIGO));
+    materialList[numMaterials++] = world->add_material(Material::diffuse(Colour::VIOLET));
+    materialList[numMaterials++] = world->add_material(Material::diffuse(Colour::PINK));
+    materialList[numMaterials++] = world->add_material(Material::diffuse(Colour::MAROON));
+    materialList[numMaterials++] = world->add_material(Material::diffuse(Colour::LAVENDER));
+    materialList[numMaterials++] = world->add_material(Material::diffuse(Colour::CYAN));
+    materialList[numMaterials++] = world->add_material(Material::diffuse(Colour::TEAL));
+    materialList[numMaterials++] = world->add_material(Material::diffuse(Colour::DARK_GREEN));
+    materialList[numMaterials++] = world->add_material(Material::diffuse(Colour::BROWN));
     
     // creating the scene to render!
     
-    world->add_plane(v3f(0.0f, 1.0f, 0.0f), 0.0f, materialList + 3);
+    world->add_plane(v3f(0.0f, 1.0f, 0.0f), 0.0f, materialList[3]);
     
     const u32 GRID_ROW_COUNT = 16;
     const f32 GRID_CELL_SIZE = 3.5f;
@@ -90,13 +88,13 @@ void init_test_scene_1(World* world, Camera* camera, f32 aspectRatio)
                 materialIndex = 0;
             }
             
-            world->add_sphere(pos, radius, materialList + materialIndex);
+            world->add_sphere(pos, radius, materialList[materialIndex]);
         }
     }
     
-    world->add_sphere(v3f(1.0f, 4.0f, 0.5f), 4.0f, materialList);
-    world->add_sphere(v3f(-11.0f, 4.0f, -5.0f), 4.0f, materialList + 1);
-    world->add_sphere(v3f(5.5f, 4.0f, 15.0f), 4.0f, materialList + 2);
+    world->add_sphere(v3f(1.0f, 4.0f, 0.5f), 4.0f, materialList[0]);
+    world->add_sphere(v3f(-11.0f, 4.0f, -5.0f), 4.0f, materialList[1]);
+    world->add_sphere(v3f(5.5f, 4.0f, 15.0f), 4.0f, materialList[2]);
     
     // setting up camera properties
     
@@ -111,9 +109,9 @@ void init_test_scene_2(World* world, Camera* camera, f32 aspectRatio)
     assert(world);
     assert(camera);
     
-    Material wallMaterial = Material::diffuse(Colour::LAVENDER);
+    u32 wallMaterial = world->add_material(Material::diffuse(Colour::LAVENDER));
     
-    Material glassMaterial = Material::dialectric(1.42f);
+    u32 glassMaterial = world->add_material(Material::dialectric(1.42f));
     
     const u32 NUM_ROWS = 20;
     const u32 NUM_COLS = 20;
@@ -123,11 +121,12 @@ void init_test_scene_2(World* world, Camera* camera, f32 aspectRatio)
     const f32 CELL_SIZE = MAX_RADIUS*2.0f;
     const f32 CELL_Y_SPACING = 2.5f;
     
-    // NOTE: I can't put up three walls at once because it eats away all the light
-    world->add_plane(v3f(0.0f, 0.0f, 1.0f), -3.0f, &wallMaterial); // back wall
-    //world->add_plane(v3f(1.0f, 0.0f, 0.0f), -5.0f, &wallMaterial); // left wall
-    world->add_plane(v3f(-1.0f, 0.0, 0.0f), -((f32)NUM_ROWS*(f32)CELL_SIZE) - 3.0f, &wallMaterial); // right wall
-    world->add_plane(v3f(0.0f, 1.0f, 0.0f), -0.1f, &glassMaterial); // floor
+    // NOTE: with three walls up most paths never make it out to the sky, so the lights over the grid light the scene,
+    // and shadow rays find them from every surface. The left wall sits behind the camera.
+    world->add_plane(v3f(0.0f, 0.0f, 1.0f), -3.0f, wallMaterial); // back wall
+    world->add_plane(v3f(1.0f, 0.0f, 0.0f), -10.0f, wallMaterial); // left wall
+    world->add_plane(v3f(-1.0f, 0.0, 0.0f), -((f32)NUM_ROWS*(f32)CELL_SIZE) - 3.0f, wallMaterial); // right wall
+    world->add_plane(v3f(0.0f, 1.0f, 0.0f), -0.1f, glassMaterial); // floor
     
     generate_random_sphere_grid(world, NUM_ROWS, NUM_COLS, 0.0f, MIN_RADIUS, MAX_RADIUS);
     generate_random_sphere_grid(world, NUM_ROWS, NUM_COLS, CELL_SIZE + CELL_Y_SPACING, MIN_RADIUS, MAX_RADIUS);
@@ -136,6 +135,18 @@ void init_test_scene_2(World* world, Camera* camera, f32 aspectRatio)
     generate_random_sphere_grid(world, NUM_ROWS, NUM_COLS, CELL_SIZE*4.0f + CELL_Y_SPACING*4.0f, MIN_RADIUS, MAX_RADIUS);
     generate_random_sphere_grid(world, NUM_ROWS, NUM_COLS, CELL_SIZE*5.0f + CELL_Y_SPACING*5.0f, MIN_RADIUS, MAX_RADIUS);
     
+    // a row of lights above the top of the grid
+    const u32 NUM_LIGHTS = 4;
+    const f32 LIGHT_RADIUS = 3.0f;
+    const f32 LIGHT_HEIGHT = CELL_SIZE*7.0f + CELL_Y_SPACING*6.0f + LIGHT_RADIUS;
+    
+    u32 lightMaterial = world->add_material(Material::emissive(v4f(1.0f, 0.9f, 0.75f), 30.0f));
+    for (u32 light = 0; light < NUM_LIGHTS; ++light)
+    {
+        f32 x = ((f32)light + 0.5f)*(f32)NUM_ROWS*CELL_SIZE/(f32)NUM_LIGHTS;
+        world->add_sphere(v3f(x, LIGHT_HEIGHT, (f32)NUM_COLS*0.5f*CELL_SIZE), LIGHT_RADIUS, lightMaterial);
+    }
+    
     v3f cameraPos = v3f(-5.0f, 3.0f, NUM_ROWS*CELL_SIZE*1.2f);
     *camera = Camera(cameraPos, 50.0f, aspectRatio);
     camera->set_target(v3f((f32)NUM_ROWS*0.5f*CELL_SIZE, 30.0f, (f32)NUM_COLS*0.5f*CELL_SIZE));
@@ -147,16 +158,16 @@ void init_test_scene_3(World* world, Camera* camera, f32 aspectRatio)
     assert(world);
     assert(camera);
     
-    Material floorMaterial = Material::diffuse(Colour::RED);
-    world->add_plane(v3f(0.0f, 1.0f, 0.0f), 0.0f, &floorMaterial);
+    u32 floorMaterial = world->add_material(Material::diffuse(Colour::RED));
+    world->add_plane(v3f(0.0f, 1.0f, 0.0f), 0.0f, floorMaterial);
     
-    Material materials[] = 
+    u32 materials[] =
     {
-        Material::diffuse(Colour::PINK),
-        Material::diffuse(Colour::YELLOW),
-        Material::diffuse(Colour::BROWN),
-        Material::diffuse(Colour::MAROON),
-        Material::dialectric(1.42f)
+        world->add_material(Material::diffuse(Colour::PINK)),
+        world->add_material(Material::diffuse(Colour::YELLOW)),
+        world->add_material(Material::diffuse(Colour::BROWN)),
+        world->add_material(Material::diffuse(Colour::MAROON)),
+        world->add_material(Material::dialectric(1.42f))
     };
     
     v3f sphereVelocity = v3f(0.5f, 0.0f, 0.0f);
@@ -164,14 +175,118 @@ void init_test_scene_3(World* world, Camera* camera, f32 aspectRatio)
     world->startTime = 0.0f;
     world->endTime = 1.0f;
     
-    world->add_sphere(v3f(-1.0f, 2.0f, -2.0f), 0.5f, materials, sphereVelocity);
-    world->add_sphere(v3f(2.0f, 1.0f, -3.5f), 1.0f, materials + 1, v3f(0.0f, 0.1f, 0.0f));
-    world->add_sphere(v3f(-1.5f, 3.5f, -0.5f), 0.75f, materials + 2);
-    world->add_sphere(v3f(-0.5f, 1.2f, -0.6f), 0.3f, materials + 3);
-    world->add_sphere(v3f(-1.9f, 1.5f, -3.0f), 1.2f, materials + 4);
+    world->add_sphere(v3f(-1.0f, 2.0f, -2.0f), 0.5f, materials[0], sphereVelocity);
+    world->add_sphere(v3f(2.0f, 1.0f, -3.5f), 1.0f, materials[1], v3f(0.0f, 0.1f, 0.0f));
+    world->add_sphere(v3f(-1.5f, 3.5f, -0.5f), 0.75f, materials[2]);
+    world->add_sphere(v3f(-0.5f, 1.2f, -0.6f), 0.3f, materials[3]);
+    world->add_sphere(v3f(-1.9f, 1.5f, -3.0f), 1.2f, materials[4]);
     
     // set up camera
     
     v3f cameraPos = v3f(0.0f, 2.0f, 3.0f);
     *camera = Camera(cameraPos, 55.0f, aspectRatio);
 }
+
+void init_test_scene_4(World* world, Camera* camera, f32 aspectRatio)
+{
+    assert(world);
+    assert(camera);
+    
+    const u32 NUM_ROWS = 1000;
+    const u32 NUM_COLS = 1000;
+    const f32 MIN_RADIUS = 0.2f;
+    const f32 MAX_RADIUS = 0.5f;
+    
+    u32 groundMaterial = world->add_material(Material::diffuse(Colour::GREY));
+    world->add_plane(v3f(0.0f, 1.0f, 0.0f), 0.0f, groundMaterial);
+    
+    generate_random_sphere_grid(world, NUM_ROWS, NUM_COLS, 0.0f, MIN_RADIUS, MAX_RADIUS);
+    
+    f32 fieldSize = NUM_ROWS*MAX_RADIUS*2.0f;
+    
+    *camera = Camera(v3f(-10.0f, 25.0f, -10.0f), 60.0f, aspectRatio);
+    camera->set_target(v3f(fieldSize*0.5f, 0.0f, fieldSize*0.5f));
+}
+
+void init_test_scene_5(World* world, Camera* camera, f32 aspectRatio)
+{
+    assert(world);
+    assert(camera);
+    
+    const u32 NUM_TREE_TYPES = 4;
+    const u32 LEAVES_PER_TREE = 400;
+    const u32 NUM_ROWS = 200;
+    const u32 NUM_COLS = 200;
+    const f32 TREE_SPACING = 6.0f;
+    
+    u32 groundMaterial = world->add_material(Material::diffuse(Colour::BROWN));
+    world->add_plane(v3f(0.0f, 1.0f, 0.0f), 0.0f, groundMaterial);
+    
+    u32 trunkMaterial = world->add_material(Material::diffuse(Colour::BROWN));
+    
+    for (u32 treeType = 0; treeType < NUM_TREE_TYPES; ++treeType)
+    {
+        Prototype* tree = world->add_prototype();
+        
+        f32 trunkHeight = random_f32(2.0f, 4.0f);
+        for (f32 y = 0.3f; y < trunkHeight; y += 0.3f)
+            tree->add_sphere(v3f(0.0f, y, 0.0f), 0.3f, trunkMaterial);
+        
+        // the canopy is a ball of leaves sitting on top of the trunk
+        Sphere canopy = Sphere(v3f(0.0f, trunkHeight + 1.5f, 0.0f), random_f32(1.5f, 2.5f));
+        v4f leafColour = v4f(random_f32(0.1f, 0.4f), random_f32(0.5f, 0.8f), random_f32(0.1f, 0.3f));
+        
+        for (u32 i = 0; i < LEAVES_PER_TREE; ++i)
+        {
+            u32 leafMaterial = world->add_material(Material::diffuse(leafColour*random_f32(0.8f, 1.2f)));
+            tree->add_sphere(random_point_in_sphere(&canopy), random_f32(0.1f, 0.3f), leafMaterial);
+        }
+    }
+    
+    for (u32 row = 0; row < NUM_ROWS; ++row)
+    {
+        for (u32 col = 0; col < NUM_COLS; ++col)
+        {
+            v3f pos = v3f(row*TREE_SPACING + random_f32(-2.0f, 2.0f), 0.0f, col*TREE_SPACING + random_f32(-2.0f, 2.0f));
+            world->add_instance(random_u32(0, NUM_TREE_TYPES), pos, random_f32(0.7f, 1.3f), random_f32(0.0f, 360.0f));
+        }
+    }
+    
+    *camera = Camera(v3f(-5.0f, 8.0f, -5.0f), 60.0f, aspectRatio);
+    camera->set_target(v3f(NUM_ROWS*TREE_SPACING*0.25f, 0.0f, NUM_COLS*TREE_SPACING*0.25f));
+}
+
+void init_test_scene_6(World* world, Camera* camera, f32 aspectRatio)
+{
+    assert(world);
+    assert(camera);
+    
+    const u32 CLUSTER_SPHERES = 20000;
+    const u32 OUTLIER_SPHERES = 16;
+    const f32 CLUSTER_RADIUS = 10.0f;
+    const f32 OUTLIER_DISTANCE = 100.0f;
+    
+    u32 groundMaterial = world->add_material(Material::diffuse(Colour::GREY));
+    world->add_plane(v3f(0.0f, 1.0f, 0.0f), 0.0f, groundMaterial);
+    
+    u32 clusterMaterial = world->add_material(Material::diffuse(Colour::YELLOW));
+    u32 outlierMaterial = world->add_material(Material::metal(Colour::WHITE, 0.1f));
+    
+    v3f clusterCentre = v3f(0.0f, CLUSTER_RADIUS + 1.0f, 0.0f);
+    Sphere cluster = Sphere(clusterCentre, CLUSTER_RADIUS);
+    
+    for (u32 i = 0; i < CLUSTER_SPHERES; ++i)
+        world->add_sphere(random_point_in_sphere(&cluster), random_f32(0.05f, 0.2f), clusterMaterial);
+    
+    // NOTE: every outlier is twice as far off as the one before, so the SAH splits them off one at a time and leaves
+    // almost the whole cluster on one side, rather than halving the cluster
+    f32 outlierDistance = OUTLIER_DISTANCE;
+    for (u32 i = 0; i < OUTLIER_SPHERES; ++i)
+    {
+        world->add_sphere(clusterCentre + v3f(outlierDistance, 0.0f, 0.0f), 2.0f, outlierMaterial);
+        outlierDistance *= 2.0f;
+    }
+    
+    *camera = Camera(v3f(0.0f, 15.0f, -40.0f), 50.0f, aspectRatio);
+    camera->set_target(clusterCentre);
+}
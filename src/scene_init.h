@@ -13,4 +13,15 @@ void init_test_scene_2(World* world, Camera* camera, f32 aspectRatio);
 // TODO: testing this out!
 void init_test_scene_3(World* world, Camera* camera, f32 aspectRatio);
 
+// A flat field of a million small spheres with random materials, mostly useful for timing BVH construction
+void init_test_scene_4(World* world, Camera* camera, f32 aspectRatio);
+
+// A forest of tens of thousands of trees made of spheres, where every tree is an instance of one of a few prototypes,
+// so the scene only stores a few thousand spheres
+void init_test_scene_5(World* world, Camera* camera, f32 aspectRatio);
+
+// A tight cluster of twenty thousand spheres with a handful of lone spheres far off around it, the lopsided splits this
+// gives are mostly useful for testing the parallel BVH build
+void init_test_scene_6(World* world, Camera* camera, f32 aspectRatio);
+
 #endif //SCENE_INIT_H
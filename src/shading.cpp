@@ -0,0 +1,371 @@
+#include "shading.h"
+
+// calculates reflectance for a material using Schlick's Approximation
+static f64 reflectance(f64 cosine, f64 refractRatio)
+{
+    f64 r0 = (1.0 - refractRatio) / (1.0 + refractRatio);
+    r0 = r0*r0;
+    
+    return r0 + (1.0 - r0)*pow((1.0 - cosine), 5);
+}
+
+static void intersect_planes(Ray ray, World* world, SurfaceHit* hit)
+{
+    const f32 MIN_T = 0.001f;
+    
+    for (u32 i = 0; i < world->planeCount; ++i)
+    {
+        f32 t = F32_MIN;
+        
+        Plane plane = world->planes[i].plane;
+        t = intersection_test(ray, plane);
+        
+        if (t > MIN_T && t < hit->t)
+        {
+            hit->t = t;
+            hit->point = ray.at(t);
+            hit->normal = plane.normal;
+            hit->material = world->materials + world->planes[i].material;
+            hit->object = 0;
+        }
+    }
+}
+
+static void add_sphere_hit(Ray ray, f32 t, SphereObject* object, Sphere sphere, World* world, SurfaceHit* hit)
+{
+    const f32 MIN_T = 0.001f;
+    
+    if (t > MIN_T && t < hit->t)
+    {
+        assert(object);
+        
+        hit->t = t;
+        hit->point = ray.at(t);
+        hit->normal = normalize(hit->point - sphere.pos);
+        hit->material = world->materials + object->material;
+        hit->object = object;
+    }
+}
+
+static bool occluded_by_planes(Ray ray, World* world, f32 tMax)
+{
+    const f32 MIN_T = 0.001f;
+    
+    for (u32 i = 0; i < world->planeCount; ++i)
+    {
+        f32 t = intersection_test(ray, world->planes[i].plane);
+        if (t > MIN_T && t < tMax)
+            return true;
+    }
+    
+    return false;
+}
+
+static v4f background_colour(Ray ray, World* world)
+{
+    if (world->environment.pixels)
+        return environment_light(&world->environment, ray.dir);
+    
+    // a simple gradient
+    f32 ratio = 0.5f*(ray.dir.y + 1.0f);
+    return (1.0f - ratio)*Colour::WHITE + ratio*v4f(0.7f, 0.8f, 0.9f);
+}
+
+static bool survives_roulette(v4f* throughput, f32 threshold, Sampler* sampler)
+{
+    f32 brightest = MAX_VALUE(MAX_VALUE(throughput->r, throughput->g), throughput->b);
+    if (brightest >= threshold)
+        return true;
+    
+    // NOTE: the dimmer the path, the less it could still add to the image, and the more likely it is to be ended
+    f32 survivalChance = brightest/threshold;
+    if (sample_f32(sampler) >= survivalChance)
+        return false;
+    
+    *throughput = *throughput/survivalChance;
+    return true;
+}
+
+/*
+* BSDFs
+*/
+
+static v4f bsdf_weight(BSDFSample* sample)
+{
+    // NOTE: alpha isn't light, so it's left at 1 instead of going through the ratio
+    v4f value = sample->value;
+    return v4f(value.r/sample->pdf, value.g/sample->pdf, value.b/sample->pdf);
+}
+
+// Diffuse
+
+static bool sample_diffuse(v3f viewDir, SurfaceHit* hit, Sampler* sampler, BSDFSample* outSample)
+{
+    // NOTE: cosine weighted, so the cosine cancels out of value/pdf and the path just picks up the colour
+    outSample->lightDir = warp_cosine_hemisphere(sample_v2f(sampler), hit->normal);
+    outSample->value = eval_diffuse(viewDir, outSample->lightDir, hit);
+    outSample->pdf = pdf_diffuse(viewDir, outSample->lightDir, hit);
+    outSample->specular = false;
+    
+    // a direction right along the surface brings no light and can't be divided by
+    return outSample->pdf > 0.0f;
+}
+
+static v4f eval_diffuse(v3f viewDir, v3f lightDir, SurfaceHit* hit)
+{
+    UNREFERENCED_PARAMETER(viewDir);
+    
+    f32 cosine = MAX_VALUE(0.0f, dot(lightDir, hit->normal));
+    return hit->material->colour*(cosine/MATH_PI);
+}
+
+static f32 pdf_diffuse(v3f viewDir, v3f lightDir, SurfaceHit* hit)
+{
+    UNREFERENCED_PARAMETER(viewDir);
+    
+    return MAX_VALUE(0.0f, dot(lightDir, hit->normal))/MATH_PI;
+}
+
+// Metal
+
+// the share of the microfacets facing halfway that are seen from dir, Smith's shadowing term for GGX
+static f32 ggx_visible(v3f dir, v3f normal, f32 alpha)
+{
+    f32 cosine = dot(dir, normal);
+    f32 alphaSquared = alpha*alpha;
+    return 2.0f*cosine/(cosine + sqrtf(alphaSquared + (1.0f - alphaSquared)*cosine*cosine));
+}
+
+// the density of microfacets facing halfway, the GGX distribution
+static f32 ggx_distribution(v3f halfway, v3f normal, f32 alpha)
+{
+    f32 cosine = dot(halfway, normal);
+    f32 alphaSquared = alpha*alpha;
+    f32 denominator = cosine*cosine*(alphaSquared - 1.0f) + 1.0f;
+    return alphaSquared/(MATH_PI*denominator*denominator);
+}
+
+static bool sample_metal(v3f viewDir, SurfaceHit* hit, Sampler* sampler, BSDFSample* outSample)
+{
+    Material* material = hit->material;
+    
+    if (dot(viewDir, hit->normal) <= 0.0f)
+        return false;
+    
+    if (material->roughness < MIRROR_ROUGHNESS)
+    {
+        // a perfect mirror only ever reflects one way
+        outSample->lightDir = reflect_direction(-viewDir, hit->normal);
+        outSample->value = material->colour;
+        outSample->pdf = 1.0f;
+        outSample->specular = true;
+        return true;
+    }
+    
+    // NOTE: a microfacet is picked in proportion to how much of it faces the normal, and the path reflects off of it
+    // like a mirror, which is close to how the BSDF spreads the light but leaves out the masking and the Fresnel term
+    v3f halfway = warp_ggx_normal(sample_v2f(sampler), material->roughness, hit->normal);
+    outSample->lightDir = reflect_direction(-viewDir, halfway);
+    outSample->specular = false;
+    
+    // the reflection can still end up pointing into the surface, in which case it's absorbed
+    if (dot(outSample->lightDir, hit->normal) <= 0.0f)
+        return false;
+    
+    outSample->value = eval_metal(viewDir, outSample->lightDir, hit);
+    outSample->pdf = pdf_metal(viewDir, outSample->lightDir, hit);
+    return outSample->pdf > 0.0f;
+}
+
+static v4f eval_metal(v3f viewDir, v3f lightDir, SurfaceHit* hit)
+{
+    Material* material = hit->material;
+    
+    f32 viewCosine = dot(viewDir, hit->normal);
+    f32 lightCosine = dot(lightDir, hit->normal);
+    if (material->roughness < MIRROR_ROUGHNESS || viewCosine <= 0.0f || lightCosine <= 0.0f)
+        return v4f();
+    
+    v3f halfway = normalize(viewDir + lightDir);
+    f32 distribution = ggx_distribution(halfway, hit->normal, material->roughness);
+    f32 visible = ggx_visible(viewDir, hit->normal, material->roughness)*ggx_visible(lightDir, hit->normal, material->roughness);
+    
+    // the colour is how much a metal reflects head on, and Schlick's approximation takes it up to white at grazing angles
+    f32 grazing = (f32)pow(1.0f - MAX_VALUE(0.0f, dot(viewDir, halfway)), 5);
+    v4f fresnel = material->colour + (Colour::WHITE - material->colour)*grazing;
+    
+    // NOTE: the BSDF's 1/cos(lightDir) cancels with the cosine it's multiplied by
+    return fresnel*(distribution*visible/(4.0f*viewCosine));
+}
+
+static f32 pdf_metal(v3f viewDir, v3f lightDir, SurfaceHit* hit)
+{
+    Material* material = hit->material;
+    if (material->roughness < MIRROR_ROUGHNESS)
+        return 0.0f;
+    
+    v3f halfway = normalize(viewDir + lightDir);
+    f32 halfwayCosine = dot(halfway, hit->normal);
+    f32 viewHalfwayCosine = dot(viewDir, halfway);
+    if (halfwayCosine <= 0.0f || viewHalfwayCosine <= 0.0f)
+        return 0.0f;
+    
+    // the density of the microfacet, times how much reflecting off of it stretches the directions around it
+    return ggx_distribution(halfway, hit->normal, material->roughness)*halfwayCosine/(4.0f*viewHalfwayCosine);
+}
+
+// Dialectric
+
+static bool sample_dialectric(v3f viewDir, SurfaceHit* hit, Sampler* sampler, BSDFSample* outSample)
+{
+    Material* material = hit->material;
+    
+    // TODO: make this a formal parameter somewhere
+    f32 worldIndex = 1.0f; // index of refraction of the world, air = 1.0
+    
+    // NOTE: the normal always points out of the object, so a path on its way out needs it flipped to its own side
+    v3f normal = hit->normal;
+    f32 refractRatio = worldIndex/material->n;
+    if (dot(viewDir, normal) < 0.0f)
+    {
+        normal = -normal;
+        refractRatio = 1.0f/refractRatio;
+    }
+    
+    f32 cosTheta = MIN_VALUE(dot(viewDir, normal), 1.0f);
+    f32 sinTheta = sqrtf(MAX_VALUE(0.0f, 1.0f - cosTheta*cosTheta));
+    
+    // using Schlick's Approximation, and when refraction is impossible the ray must reflect
+    bool internalReflection = refractRatio*sinTheta > 1.0f;
+    f32 reflectChance = internalReflection ? 1.0f : (f32)reflectance(cosTheta, refractRatio);
+    
+    if (sample_f32(sampler) < reflectChance)
+    {
+        outSample->lightDir = reflect_direction(-viewDir, normal);
+        outSample->pdf = reflectChance;
+    }
+    else
+    {
+        // Refraction!
+        v3f rayPerpendicular = refractRatio*(cosTheta*normal - viewDir);
+        v3f rayParallel = -sqrtf(ABS_VALUE(1.0f - norm_squared(rayPerpendicular)))*normal;
+        
+        outSample->lightDir = normalize(rayPerpendicular + rayParallel);
+        outSample->pdf = 1.0f - reflectChance;
+    }
+    
+    // NOTE: the chance of picking reflection or refraction is the share of the light each one carries, so the two
+    // cancel out and the path just picks up the colour
+    outSample->value = material->colour*outSample->pdf;
+    outSample->specular = true;
+    return true;
+}
+
+// All materials
+
+static bool sample_bsdf(v3f viewDir, SurfaceHit* hit, Sampler* sampler, BSDFSample* outSample)
+{
+    switch (hit->material->type)
+    {
+        case Material::Type::DIFFUSE:
+            return sample_diffuse(viewDir, hit, sampler, outSample);
+        case Material::Type::METAL:
+            return sample_metal(viewDir, hit, sampler, outSample);
+        case Material::Type::DIALECTRIC:
+            return sample_dialectric(viewDir, hit, sampler, outSample);
+        case Material::Type::EMISSIVE:
+        case Material::Type::NONE:
+            break;
+    }
+    
+    return false;
+}
+
+static v4f eval_bsdf(v3f viewDir, v3f lightDir, SurfaceHit* hit)
+{
+    switch (hit->material->type)
+    {
+        case Material::Type::DIFFUSE:
+            return eval_diffuse(viewDir, lightDir, hit);
+        case Material::Type::METAL:
+            return eval_metal(viewDir, lightDir, hit);
+        case Material::Type::DIALECTRIC:
+        case Material::Type::EMISSIVE:
+        case Material::Type::NONE:
+            break;
+    }
+    
+    return v4f();
+}
+
+static f32 pdf_bsdf(v3f viewDir, v3f lightDir, SurfaceHit* hit)
+{
+    switch (hit->material->type)
+    {
+        case Material::Type::DIFFUSE:
+            return pdf_diffuse(viewDir, lightDir, hit);
+        case Material::Type::METAL:
+            return pdf_metal(viewDir, lightDir, hit);
+        case Material::Type::DIALECTRIC:
+        case Material::Type::EMISSIVE:
+        case Material::Type::NONE:
+            break;
+    }
+    
+    return 0.0f;
+}
+
+static bool sample_uniform_bounce(v3f viewDir, SurfaceHit* hit, Sampler* sampler, BSDFSample* outSample)
+{
+    Material* material = hit->material;
+    if (is_specular(material))
+        return sample_bsdf(viewDir, hit, sampler, outSample);
+    
+    // the sphere folded over onto the side of the normal
+    v3f lightDir = warp_uniform_sphere(sample_v2f(sampler));
+    if (dot(lightDir, hit->normal) < 0.0f)
+        lightDir = -lightDir;
+    
+    outSample->lightDir = lightDir;
+    outSample->value = eval_bsdf(viewDir, lightDir, hit);
+    outSample->pdf = 1.0f/(2.0f*MATH_PI);
+    outSample->specular = false;
+    return true;
+}
+/*
+* Direct light
+*/
+
+static bool is_specular(Material* material)
+{
+    return material->type == Material::Type::DIALECTRIC || (material->type == Material::Type::METAL && material->roughness < MIRROR_ROUGHNESS);
+}
+
+static f32 mis_weight(f32 pdf, f32 otherPdf)
+{
+    f32 squared = pdf*pdf;
+    return squared/(squared + otherPdf*otherPdf);
+}
+
+static bool sample_direct_light(v3f viewDir, SurfaceHit* hit, World* world, LightSet::Selection selection, f32 time, Sampler* sampler,
+                                Ray* outShadowRay, f32* outDistance, v4f* outLight)
+{
+    LightSample lightSample = {};
+    if (!sample_light(world, selection, hit->point, hit->normal, time, sampler, &lightSample))
+        return false;
+    
+    v4f value = eval_bsdf(viewDir, lightSample.dir, hit);
+    if (value.r <= 0.0f && value.g <= 0.0f && value.b <= 0.0f)
+        return false;
+    
+    f32 weight = mis_weight(lightSample.pdf, pdf_bsdf(viewDir, lightSample.dir, hit))/lightSample.pdf;
+    
+    // NOTE: alpha is left at 0, the path's own sample already covers the pixel
+    v4f light = hadamard(value, lightSample.emission)*weight;
+    *outLight = v4f(light.r, light.g, light.b, 0.0f);
+    
+    // stops just short of the light, so its own surface doesn't count as being in the way
+    *outShadowRay = Ray(hit->point, lightSample.dir);
+    *outDistance = lightSample.distance*0.999f;
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,119 @@
+#ifndef SHADING_H
+#define SHADING_H
+
+#include "types.h"
+#include "geometry.h"
+#include "render_world.h"
+#include "sampler.h"
+#include "lights.h"
+
+// the closest surface a ray hits
+struct SurfaceHit
+{
+    f32 t; // F32_MAX if nothing was hit
+    v3f point;
+    v3f normal;
+    Material* material;
+    
+    // the sphere that was hit, 0 for planes
+    SphereObject* object;
+};
+
+// how far paths are followed before they're ended, the same for both engines
+struct PathSettings
+{
+    // paths are cut off after this many bounces, whatever they're still carrying
+    u32 maxDepth;
+    
+    // Once every channel of a path's throughput is below this, the path is ended at random, with the paths that
+    // carry on boosted to make up for the ones that don't. 0 turns this off.
+    f32 rouletteThreshold;
+    
+    // megakernel only, bounces off of diffuse and rough metal surfaces pick their direction evenly over the
+    // hemisphere instead of following the BSDF, which the BSDF benchmark compares against
+    bool uniformBounces;
+    
+    // diffuse and rough metal surfaces don't aim shadow rays at the lights, so light is only found by bouncing into it
+    bool skipLightSampling;
+    
+    // how the lights shadow rays are aimed at are picked
+    LightSet::Selection lightSelection;
+};
+
+// records the closest of the world's planes the ray hits, if it's in front of whatever the ray has hit so far
+static void intersect_planes(Ray ray, World* world, SurfaceHit* hit);
+
+// records a sphere the BVH found, if it's in front of whatever the ray has hit so far
+static void add_sphere_hit(Ray ray, f32 t, SphereObject* object, Sphere sphere, World* world, SurfaceHit* hit);
+
+// true if any of the world's planes is in the way of the ray before tMax
+static bool occluded_by_planes(Ray ray, World* world, f32 tMax);
+
+// the light a ray sees when it doesn't hit anything, from the world's environment map if it has one
+static v4f background_colour(Ray ray, World* world);
+
+// Russian roulette, returns false if the path should end here. A path that survives has its throughput divided by
+// the chance it had of surviving, so on average the paths that carry on add up to the same light as all of them would.
+static bool survives_roulette(v4f* throughput, f32 threshold, Sampler* sampler);
+
+// A metal smoother than this is a mirror. Its microfacets would all face so close to the normal that f32 can't
+// tell them apart, and the GGX distribution would blow up.
+#define MIRROR_ROUGHNESS 0.001f
+
+// What a material does to a path that hits it, as its BSDF, the share of the light arriving from lightDir that leaves
+// towards viewDir. Both point away from the surface, with viewDir back along the ray that hit it.
+struct BSDFSample
+{
+    // the direction the path carries on in
+    v3f lightDir;
+    
+    // the BSDF for lightDir, times the cosine between lightDir and the normal
+    v4f value;
+    
+    // The density lightDir was picked with. For a specular bounce, which only goes in one or two exact directions,
+    // it's the chance of picking the one it went in instead.
+    f32 pdf;
+    bool specular;
+};
+
+// Picks a direction for a path to carry on in after hitting the surface, with the directions that bring back the
+// most light the most likely. Returns false if the path is absorbed.
+static bool sample_bsdf(v3f viewDir, SurfaceHit* hit, Sampler* sampler, BSDFSample* outSample);
+
+// The BSDF times the cosine, and the density sample_bsdf picks lightDir with, for any pair of directions. Specular
+// bounces never go in any direction they could be asked about, so for those these are always 0.
+static v4f eval_bsdf(v3f viewDir, v3f lightDir, SurfaceHit* hit);
+static f32 pdf_bsdf(v3f viewDir, v3f lightDir, SurfaceHit* hit);
+
+// what a path's throughput gets multiplied by for a sample, value/pdf
+static v4f bsdf_weight(BSDFSample* sample);
+
+// each material's versions of the above
+static bool sample_diffuse(v3f viewDir, SurfaceHit* hit, Sampler* sampler, BSDFSample* outSample);
+static v4f eval_diffuse(v3f viewDir, v3f lightDir, SurfaceHit* hit);
+static f32 pdf_diffuse(v3f viewDir, v3f lightDir, SurfaceHit* hit);
+
+// NOTE: rough metals are a GGX microfacet BSDF, with the roughness as its alpha
+static bool sample_metal(v3f viewDir, SurfaceHit* hit, Sampler* sampler, BSDFSample* outSample);
+static v4f eval_metal(v3f viewDir, v3f lightDir, SurfaceHit* hit);
+static f32 pdf_metal(v3f viewDir, v3f lightDir, SurfaceHit* hit);
+
+static bool sample_dialectric(v3f viewDir, SurfaceHit* hit, Sampler* sampler, BSDFSample* outSample);
+
+// sample_bsdf for PathSettings::uniformBounces, specular bounces are still sampled the same way
+static bool sample_uniform_bounce(v3f viewDir, SurfaceHit* hit, Sampler* sampler, BSDFSample* outSample);
+
+// true for the materials only paths can find light through, since a shadow ray could never line up with their bounce
+static bool is_specular(Material* material);
+
+// The power heuristic, the share of the light found by a strategy that picked the direction with pdf, when another
+// one could have picked it with otherPdf. The two shares add up to 1, so light either strategy finds is only counted once.
+static f32 mis_weight(f32 pdf, f32 otherPdf);
+
+// A shadow ray from the surface towards a light picked by sample_light, and the light it brings back if nothing is in
+// the way, already weighted by the BSDF and against the path having bounced into the light itself. Returns false if
+// the light can't add anything, and there's no ray to trace.
+static bool sample_direct_light(v3f viewDir, SurfaceHit* hit, World* world, LightSet::Selection selection, f32 time, Sampler* sampler,
+                                Ray* outShadowRay, f32* outDistance, v4f* outLight);
+
+#endif //SHADING_H
@@ -87,4 +87,16 @@ static bool string_ends_with(char* string, char* substring)
     return result;
 }
 
+static bool strings_equal(char* str1, char* str2)
+{
+    if (!str1 || !str2)
+        return false;
+    
+    u32 index = 0;
+    while (str1[index] != 0 && str1[index] == str2[index])
+        ++index;
+    
+    return str1[index] == str2[index];
+}
+
 #endif //STRINGS_H
@@ -0,0 +1,87 @@
+#include "traversal_stats.h"
+
+static thread_local TraversalStats threadTraversalStats;
+static thread_local u64 threadCacheTags[TRAVERSAL_CACHE_LINES];
+
+static TraversalStats totalTraversalStats;
+
+// looks up every line the memory covers in the simulated cache, replacing whatever was in a line's slot on a miss
+static inline void count_memory_access(void* memory, u32 size)
+{
+    u64 firstLine = (u64)(uintptr_t)memory/TRAVERSAL_CACHE_LINE_SIZE;
+    u64 lastLine = ((u64)(uintptr_t)memory + size - 1)/TRAVERSAL_CACHE_LINE_SIZE;
+    
+    for (u64 line = firstLine; line <= lastLine; ++line)
+    {
+        // NOTE: tags are stored off by one, so an empty slot never matches
+        u64* tag = threadCacheTags + (line % TRAVERSAL_CACHE_LINES);
+        
+        ++threadTraversalStats.cacheAccesses;
+        if (*tag != line + 1)
+        {
+            ++threadTraversalStats.cacheMisses;
+            *tag = line + 1;
+        }
+    }
+}
+
+static inline void count_traversal_rays(u32 count)
+{
+    threadTraversalStats.rays += count;
+}
+
+static inline void count_node_visit(void* node, u32 size)
+{
+    ++threadTraversalStats.nodeVisits;
+    count_memory_access(node, size);
+}
+
+static inline void count_object_test(void* object, u32 size)
+{
+    ++threadTraversalStats.objectTests;
+    count_memory_access(object, size);
+}
+
+// a batch test reads the same stretch of each of the sphere arrays
+static inline void count_sphere_batch(SphereArrays* spheres, u32 first, u32 count)
+{
+    threadTraversalStats.objectTests += count;
+    
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+        count_memory_access(spheres->pos[axis] + first, count*sizeof(f32));
+        count_memory_access(spheres->velocity[axis] + first, count*sizeof(f32));
+    }
+    count_memory_access(spheres->radius + first, count*sizeof(f32));
+}
+
+void flush_traversal_stats()
+{
+    InterlockedAdd64(&totalTraversalStats.rays, threadTraversalStats.rays);
+    InterlockedAdd64(&totalTraversalStats.nodeVisits, threadTraversalStats.nodeVisits);
+    InterlockedAdd64(&totalTraversalStats.objectTests, threadTraversalStats.objectTests);
+    InterlockedAdd64(&totalTraversalStats.cacheAccesses, threadTraversalStats.cacheAccesses);
+    InterlockedAdd64(&totalTraversalStats.cacheMisses, threadTraversalStats.cacheMisses);
+    
+    threadTraversalStats = {};
+}
+
+TraversalStats get_traversal_stats()
+{
+    return totalTraversalStats;
+}
+
+void reset_traversal_stats()
+{
+    totalTraversalStats = {};
+}
+
+void print_traversal_stats(TraversalStats* stats)
+{
+    f64 rays = (f64)MAX_VALUE(stats->rays, 1);
+    
+    printf("Traversal: %lld rays, %.2f nodes and %.2f spheres per ray\n",
+           (long long)stats->rays, stats->nodeVisits/rays, stats->objectTests/rays);
+    printf("Simulated cache: %.2f misses per ray, %.2f%% of %lld line accesses\n",
+           stats->cacheMisses/rays, 100.0*stats->cacheMisses/(f64)MAX_VALUE(stats->cacheAccesses, 1), (long long)stats->cacheAccesses);
+}
\ No newline at end of file
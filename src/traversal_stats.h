@@ -0,0 +1,50 @@
+#ifndef TRAVERSAL_STATS_H
+#define TRAVERSAL_STATS_H
+
+#include "types.h"
+#include "geometry.h"
+
+// 1 = BVH traversal counts the nodes it visits, the spheres it tests and the cache lines it would miss, to measure
+// how coherent a set of rays is. Counting costs a little on every node, so it's off unless something is being measured.
+#define BVH_TRAVERSAL_STATS 0
+
+// the simulated cache is direct mapped with this many 64 byte lines, 32KB like a typical L1 data cache
+#define TRAVERSAL_CACHE_LINES 512
+#define TRAVERSAL_CACHE_LINE_SIZE 64
+
+struct TraversalStats
+{
+    s64 rays;
+    s64 nodeVisits;
+    s64 objectTests;
+    
+    // NOTE: these are for a simulated cache that only sees the BVH nodes and spheres each thread touches, not the real
+    // hardware, so they show how much memory traffic the order of the rays causes rather than true miss rates
+    s64 cacheAccesses;
+    s64 cacheMisses;
+};
+
+// adds what the calling thread has counted to the totals, and starts it counting from zero again
+void flush_traversal_stats();
+
+// the totals of every flushed thread since the last reset
+TraversalStats get_traversal_stats();
+void reset_traversal_stats();
+
+void print_traversal_stats(TraversalStats* stats);
+
+#if BVH_TRAVERSAL_STATS
+#define COUNT_TRAVERSAL_RAY() count_traversal_rays(1)
+#define COUNT_TRAVERSAL_RAYS(count) count_traversal_rays(count)
+#define COUNT_NODE_VISIT(node) count_node_visit((node), sizeof(*(node)))
+#define COUNT_OBJECT_TEST(object) count_object_test((object), sizeof(*(object)))
+#define COUNT_SPHERE_BATCH(spheres, first, count) count_sphere_batch((spheres), (first), (count))
+#else
+#define COUNT_TRAVERSAL_RAY()
+#define COUNT_TRAVERSAL_RAYS(count)
+#define COUNT_NODE_VISIT(node)
+#define COUNT_OBJECT_TEST(object)
+#define COUNT_SPHERE_BATCH(spheres, first, count)
+#endif
+
+#endif //TRAVERSAL_STATS_H
@@ -4,6 +4,7 @@
 #include <random>
 
 #include "types.h"
+#include "warps.h"
 
 static inline f32 clamp(f32 value, f32 min, f32 max)
 {
@@ -24,6 +25,9 @@ static inline bool is_equal(f32 a, f32 b, f32 error = 0.0001f)
     return ABS_VALUE(a - b) <= error;
 }
 
+// NOTE: these are for setting up scenes, everything drawn while rendering comes from a Sampler so it doesn't depend on
+// which thread drew it
+
 // returns a random value in the range [0, 1)
 static inline f64 random_f64()
 {
@@ -79,18 +83,8 @@ static inline v3f random_v3f(f32 min, f32 max)
 
 static v3f random_point_in_unit_sphere()
 {
-    v3f randomPoint = v3f();
-    bool found = false;
-    
-    while (!found)
-    {
-        randomPoint = random_v3f(-1.0f, 1.0f);
-        
-        if (norm(randomPoint) <= 1.0f)
-            found = true;
-    }
-    
-    return randomPoint;
+    v2f direction = v2f(random_f32(), random_f32());
+    return warp_uniform_ball(direction, random_f32());
 }
 
 static v3f random_point_in_sphere(Sphere* sphere)
@@ -101,17 +95,14 @@ static v3f random_point_in_sphere(Sphere* sphere)
 
 static v3f random_unit_vector()
 {
-    // TODO: couldn't I just use random_v3f and then normalize that instead?
-    v3f randomPoint = random_point_in_unit_sphere();
-    randomPoint = normalize(randomPoint);
-    return randomPoint;
+    return warp_uniform_sphere(v2f(random_f32(), random_f32()));
 }
 
 static v3f random_point_in_hemisphere(Sphere* sphere, v3f hemisphereNormal)
 {
     v3f randomPoint = random_point_in_unit_sphere()*sphere->radius;
     
-    // if the hemisphere is on the wrong side of the normal, we reflect the point about 
+    // if the hemisphere is on the wrong side of the normal, we reflect the point about
     // the centre
     if (dot(randomPoint, hemisphereNormal) < 0.0f)
     {
@@ -123,18 +114,8 @@ static v3f random_point_in_hemisphere(Sphere* sphere, v3f hemisphereNormal)
 
 static v3f random_point_in_unit_circle()
 {
-    v3f randomPoint = v3f();
-    bool found = false;
-    
-    while (!found)
-    {
-        randomPoint = v3f(random_f32(-1, 1), random_f32(-1, 1), 0);
-        
-        if (norm(randomPoint) <= 1.0f)
-            found = true;
-    }
-    
-    return randomPoint;
+    v2f point = warp_concentric_disk(v2f(random_f32(), random_f32()));
+    return v3f(point.x, point.y, 0.0f);
 }
 
 #endif //UTILS_H
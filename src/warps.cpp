@@ -0,0 +1,318 @@
+#include "warps.h"
+
+// Sine and cosine of an angle given in turns. The angle is brought into the nearest quarter turn, where short
+// polynomials are accurate to about 3e-7, and the quarter it came from swaps and negates the results. It's a good
+// deal faster than sinf and cosf, and the batches below do exactly the same steps, so both give the same directions.
+static inline void sin_cos_turns(f32 turns, f32* outSin, f32* outCos)
+{
+    f32 quarters = floorf(turns*4.0f + 0.5f);
+    f32 angle = (turns - quarters*0.25f)*(2.0f*MATH_PI);
+    f32 angleSquared = angle*angle;
+    
+    f32 sine = ((((-1.0f/5040.0f)*angleSquared + 1.0f/120.0f)*angleSquared + -1.0f/6.0f)*angleSquared + 1.0f)*angle;
+    f32 cosine = ((((1.0f/40320.0f)*angleSquared + -1.0f/720.0f)*angleSquared + 1.0f/24.0f)*angleSquared + -0.5f)*angleSquared + 1.0f;
+    
+    // NOTE: the quarter picks by indexing and multiplying instead of branching, since which quarter an angle is in
+    // is as random as the angle, and a mispredicted branch costs more than the whole polynomial
+    s32 quarter = (s32)quarters;
+    f32 values[2] = { sine, cosine };
+    
+    *outSin = values[quarter & 1]*(f32)(1 - (quarter & 2));
+    *outCos = values[(quarter & 1) ^ 1]*(f32)(1 - ((quarter + 1) & 2));
+}
+
+static inline v2f warp_concentric_disk(v2f sample)
+{
+    f32 a = 2.0f*sample.x - 1.0f;
+    f32 b = 2.0f*sample.y - 1.0f;
+    
+    // NOTE: the point is moved out along its line from the centre until the edge of the square it's on lands on the
+    // circle, the larger of a and b is the radius, and the ratio of the two picks the angle within that eighth
+    // NOTE: which of the two is larger is a coin flip, so everything that depends on it is a plain select or
+    // arithmetic that compiles without a branch to mispredict
+    bool xMajor = a*a > b*b;
+    f32 radius = xMajor ? a : b;
+    f32 other = xMajor ? b : a;
+    f32 ratio = other/(radius + (f32)(radius == 0.0f));
+    f32 eighths = ratio*0.125f;
+    f32 turns = 0.25f*(f32)!xMajor + eighths*(f32)(2*(s32)xMajor - 1);
+    
+    f32 sine;
+    f32 cosine;
+    sin_cos_turns(turns, &sine, &cosine);
+    
+    return v2f(radius*cosine, radius*sine);
+}
+
+static inline v3f warp_uniform_sphere(v2f sample)
+{
+    // NOTE: by Archimedes' hat-box theorem, picking z evenly picks an even amount of the sphere's area
+    f32 z = 1.0f - 2.0f*sample.x;
+    f32 radius = sqrtf(MAX_VALUE(0.0f, 1.0f - z*z));
+    
+    f32 sine;
+    f32 cosine;
+    sin_cos_turns(sample.y, &sine, &cosine);
+    
+    return v3f(radius*cosine, radius*sine, z);
+}
+
+static inline v3f warp_uniform_ball(v2f sample, f32 radiusSample)
+{
+    // the volume inside a radius goes up with its cube
+    return warp_uniform_sphere(sample)*cbrtf(radiusSample);
+}
+
+static inline void make_orthonormal_basis(v3f normal, v3f* outTangent, v3f* outBitangent)
+{
+    // Duff et al.'s frame, which only needs the sign of z to stay accurate for normals pointing down -z
+    f32 sign = copysignf(1.0f, normal.z);
+    f32 a = -1.0f/(sign + normal.z);
+    f32 b = normal.x*normal.y*a;
+    
+    *outTangent = v3f(1.0f + sign*normal.x*normal.x*a, sign*b, -sign*normal.x);
+    *outBitangent = v3f(b, sign + normal.y*normal.y*a, -normal.y);
+}
+
+static inline v3f warp_cosine_hemisphere(v2f sample, v3f normal)
+{
+    // NOTE: Malley's method, points spread evenly over the disk and lifted up onto the hemisphere are cosine weighted
+    v2f disk = warp_concentric_disk(sample);
+    f32 height = sqrtf(MAX_VALUE(0.0f, 1.0f - disk.x*disk.x - disk.y*disk.y));
+    
+    v3f tangent = v3f();
+    v3f bitangent = v3f();
+    make_orthonormal_basis(normal, &tangent, &bitangent);
+    
+    return disk.x*tangent + disk.y*bitangent + height*normal;
+}
+
+static inline v3f warp_ggx_normal(v2f sample, f32 alpha, v3f normal)
+{
+    f32 cosThetaSquared = (1.0f - sample.x)/(1.0f + (alpha*alpha - 1.0f)*sample.x);
+    f32 cosTheta = sqrtf(cosThetaSquared);
+    f32 sinTheta = sqrtf(MAX_VALUE(0.0f, 1.0f - cosThetaSquared));
+    
+    f32 sine;
+    f32 cosine;
+    sin_cos_turns(sample.y, &sine, &cosine);
+    
+    v3f tangent = v3f();
+    v3f bitangent = v3f();
+    make_orthonormal_basis(normal, &tangent, &bitangent);
+    
+    return (sinTheta*cosine)*tangent + (sinTheta*sine)*bitangent + cosTheta*normal;
+}
+
+static inline v3f warp_uniform_cone(v2f sample, f32 cosMax, v3f axis)
+{
+    // the same as the sphere, a cap of the sphere takes up area evenly along the axis
+    f32 cosTheta = 1.0f - sample.x*(1.0f - cosMax);
+    f32 sinTheta = sqrtf(MAX_VALUE(0.0f, 1.0f - cosTheta*cosTheta));
+    
+    f32 sine;
+    f32 cosine;
+    sin_cos_turns(sample.y, &sine, &cosine);
+    
+    v3f tangent = v3f();
+    v3f bitangent = v3f();
+    make_orthonormal_basis(axis, &tangent, &bitangent);
+    
+    return (sinTheta*cosine)*tangent + (sinTheta*sine)*bitangent + cosTheta*axis;
+}
+
+/*
+* Batches
+*/
+
+// the lane by lane version of sin_cos_turns
+static inline void sin_cos_turns(__m256 turns, __m256* outSin, __m256* outCos)
+{
+    __m256 quarters = _mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(turns, _mm256_set1_ps(4.0f)), _mm256_set1_ps(0.5f)));
+    __m256 angle = _mm256_mul_ps(_mm256_sub_ps(turns, _mm256_mul_ps(quarters, _mm256_set1_ps(0.25f))), _mm256_set1_ps(2.0f*MATH_PI));
+    __m256 angleSquared = _mm256_mul_ps(angle, angle);
+    
+    __m256 sine = _mm256_set1_ps(-1.0f/5040.0f);
+    sine = _mm256_add_ps(_mm256_mul_ps(sine, angleSquared), _mm256_set1_ps(1.0f/120.0f));
+    sine = _mm256_add_ps(_mm256_mul_ps(sine, angleSquared), _mm256_set1_ps(-1.0f/6.0f));
+    sine = _mm256_add_ps(_mm256_mul_ps(sine, angleSquared), _mm256_set1_ps(1.0f));
+    sine = _mm256_mul_ps(sine, angle);
+    
+    __m256 cosine = _mm256_set1_ps(1.0f/40320.0f);
+    cosine = _mm256_add_ps(_mm256_mul_ps(cosine, angleSquared), _mm256_set1_ps(-1.0f/720.0f));
+    cosine = _mm256_add_ps(_mm256_mul_ps(cosine, angleSquared), _mm256_set1_ps(1.0f/24.0f));
+    cosine = _mm256_add_ps(_mm256_mul_ps(cosine, angleSquared), _mm256_set1_ps(-0.5f));
+    cosine = _mm256_add_ps(_mm256_mul_ps(cosine, angleSquared), _mm256_set1_ps(1.0f));
+    
+    // an odd quarter swaps sine and cosine, and the sign bits come from which half turn each one ends up in
+    __m256i quarter = _mm256_cvtps_epi32(quarters);
+    __m256i one = _mm256_set1_epi32(1);
+    __m256i two = _mm256_set1_epi32(2);
+    __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(quarter, one), one));
+    __m256 sineSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(quarter, two), 30));
+    __m256 cosineSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(quarter, one), two), 30));
+    
+    *outSin = _mm256_xor_ps(_mm256_blendv_ps(sine, cosine, swap), sineSign);
+    *outCos = _mm256_xor_ps(_mm256_blendv_ps(cosine, sine, swap), cosineSign);
+}
+
+static inline void concentric_disk(__m256 sampleX, __m256 sampleY, __m256* outX, __m256* outY)
+{
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256 a = _mm256_sub_ps(_mm256_add_ps(sampleX, sampleX), one);
+    __m256 b = _mm256_sub_ps(_mm256_add_ps(sampleY, sampleY), one);
+    
+    __m256 xMajor = _mm256_cmp_ps(_mm256_mul_ps(a, a), _mm256_mul_ps(b, b), _CMP_GT_OQ);
+    __m256 radius = _mm256_blendv_ps(b, a, xMajor);
+    __m256 safeRadius = _mm256_blendv_ps(radius, one, _mm256_cmp_ps(radius, _mm256_setzero_ps(), _CMP_EQ_OQ));
+    __m256 ratio = _mm256_div_ps(_mm256_blendv_ps(a, b, xMajor), safeRadius);
+    
+    // an eighth of a turn is pi/4
+    __m256 eighths = _mm256_mul_ps(ratio, _mm256_set1_ps(0.125f));
+    __m256 turns = _mm256_blendv_ps(_mm256_sub_ps(_mm256_set1_ps(0.25f), eighths), eighths, xMajor);
+    
+    __m256 sine;
+    __m256 cosine;
+    sin_cos_turns(turns, &sine, &cosine);
+    
+    *outX = _mm256_mul_ps(radius, cosine);
+    *outY = _mm256_mul_ps(radius, sine);
+}
+
+// the lane by lane version of make_orthonormal_basis
+static inline void orthonormal_basis(__m256 normal[3], __m256 outTangent[3], __m256 outBitangent[3])
+{
+    __m256 signBit = _mm256_set1_ps(-0.0f);
+    __m256 sign = _mm256_or_ps(_mm256_and_ps(normal[2], signBit), _mm256_set1_ps(1.0f));
+    __m256 a = _mm256_div_ps(_mm256_set1_ps(-1.0f), _mm256_add_ps(sign, normal[2]));
+    __m256 b = _mm256_mul_ps(_mm256_mul_ps(normal[0], normal[1]), a);
+    
+    outTangent[0] = _mm256_add_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(_mm256_mul_ps(sign, _mm256_mul_ps(normal[0], normal[0])), a));
+    outTangent[1] = _mm256_mul_ps(sign, b);
+    outTangent[2] = _mm256_xor_ps(_mm256_mul_ps(sign, normal[0]), signBit);
+    
+    outBitangent[0] = b;
+    outBitangent[1] = _mm256_add_ps(sign, _mm256_mul_ps(_mm256_mul_ps(normal[1], normal[1]), a));
+    outBitangent[2] = _mm256_xor_ps(normal[1], signBit);
+}
+
+// x*tangent + y*bitangent + z*normal, stored to the arrays at index
+static inline void store_in_frame(__m256 x, __m256 y, __m256 z, __m256 tangent[3], __m256 bitangent[3], __m256 normal[3],
+                                  f32* outDirs[3], u32 index)
+{
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+        __m256 dir = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, tangent[axis]), _mm256_mul_ps(y, bitangent[axis])), _mm256_mul_ps(z, normal[axis]));
+        _mm256_storeu_ps(outDirs[axis] + index, dir);
+    }
+}
+
+// NOTE: the batches finish off the last few samples with the single sample warps
+
+void warp_concentric_disk_batch(f32* samples[2], u32 count, f32* outPoints[2])
+{
+    u32 i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 x;
+        __m256 y;
+        concentric_disk(_mm256_loadu_ps(samples[0] + i), _mm256_loadu_ps(samples[1] + i), &x, &y);
+        
+        _mm256_storeu_ps(outPoints[0] + i, x);
+        _mm256_storeu_ps(outPoints[1] + i, y);
+    }
+    
+    for (; i < count; ++i)
+    {
+        v2f point = warp_concentric_disk(v2f(samples[0][i], samples[1][i]));
+        outPoints[0][i] = point.x;
+        outPoints[1][i] = point.y;
+    }
+}
+
+void warp_uniform_sphere_batch(f32* samples[2], u32 count, f32* outDirs[3])
+{
+    u32 i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 one = _mm256_set1_ps(1.0f);
+        __m256 sampleX = _mm256_loadu_ps(samples[0] + i);
+        __m256 z = _mm256_sub_ps(one, _mm256_add_ps(sampleX, sampleX));
+        __m256 radius = _mm256_sqrt_ps(_mm256_max_ps(_mm256_setzero_ps(), _mm256_sub_ps(one, _mm256_mul_ps(z, z))));
+        
+        __m256 sine;
+        __m256 cosine;
+        sin_cos_turns(_mm256_loadu_ps(samples[1] + i), &sine, &cosine);
+        
+        _mm256_storeu_ps(outDirs[0] + i, _mm256_mul_ps(radius, cosine));
+        _mm256_storeu_ps(outDirs[1] + i, _mm256_mul_ps(radius, sine));
+        _mm256_storeu_ps(outDirs[2] + i, z);
+    }
+    
+    for (; i < count; ++i)
+    {
+        v3f dir = warp_uniform_sphere(v2f(samples[0][i], samples[1][i]));
+        for (u32 axis = 0; axis < 3; ++axis)
+            outDirs[axis][i] = dir.e[axis];
+    }
+}
+
+void warp_cosine_hemisphere_batch(f32* samples[2], f32* normals[3], u32 count, f32* outDirs[3])
+{
+    u32 i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 x;
+        __m256 y;
+        concentric_disk(_mm256_loadu_ps(samples[0] + i), _mm256_loadu_ps(samples[1] + i), &x, &y);
+        
+        __m256 lengthSquared = _mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y));
+        __m256 z = _mm256_sqrt_ps(_mm256_max_ps(_mm256_setzero_ps(), _mm256_sub_ps(_mm256_set1_ps(1.0f), lengthSquared)));
+        
+        __m256 normal[3] = { _mm256_loadu_ps(normals[0] + i), _mm256_loadu_ps(normals[1] + i), _mm256_loadu_ps(normals[2] + i) };
+        __m256 tangent[3];
+        __m256 bitangent[3];
+        orthonormal_basis(normal, tangent, bitangent);
+        
+        store_in_frame(x, y, z, tangent, bitangent, normal, outDirs, i);
+    }
+    
+    for (; i < count; ++i)
+    {
+        v3f dir = warp_cosine_hemisphere(v2f(samples[0][i], samples[1][i]), v3f(normals[0][i], normals[1][i], normals[2][i]));
+        for (u32 axis = 0; axis < 3; ++axis)
+            outDirs[axis][i] = dir.e[axis];
+    }
+}
+
+void warp_ggx_normal_batch(f32* samples[2], f32 alpha, f32* normals[3], u32 count, f32* outDirs[3])
+{
+    u32 i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 one = _mm256_set1_ps(1.0f);
+        __m256 sampleX = _mm256_loadu_ps(samples[0] + i);
+        __m256 denominator = _mm256_add_ps(one, _mm256_mul_ps(_mm256_set1_ps(alpha*alpha - 1.0f), sampleX));
+        __m256 cosThetaSquared = _mm256_div_ps(_mm256_sub_ps(one, sampleX), denominator);
+        __m256 cosTheta = _mm256_sqrt_ps(cosThetaSquared);
+        __m256 sinTheta = _mm256_sqrt_ps(_mm256_max_ps(_mm256_setzero_ps(), _mm256_sub_ps(one, cosThetaSquared)));
+        
+        __m256 sine;
+        __m256 cosine;
+        sin_cos_turns(_mm256_loadu_ps(samples[1] + i), &sine, &cosine);
+        
+        __m256 normal[3] = { _mm256_loadu_ps(normals[0] + i), _mm256_loadu_ps(normals[1] + i), _mm256_loadu_ps(normals[2] + i) };
+        __m256 tangent[3];
+        __m256 bitangent[3];
+        orthonormal_basis(normal, tangent, bitangent);
+        
+        store_in_frame(_mm256_mul_ps(sinTheta, cosine), _mm256_mul_ps(sinTheta, sine), cosTheta, tangent, bitangent, normal, outDirs, i);
+    }
+    
+    for (; i < count; ++i)
+    {
+        v3f dir = warp_ggx_normal(v2f(samples[0][i], samples[1][i]), alpha, v3f(normals[0][i], normals[1][i], normals[2][i]));
+        for (u32 axis = 0; axis < 3; ++axis)
+            outDirs[axis][i] = dir.e[axis];
+    }
+}
\ No newline at end of file
@@ -0,0 +1,42 @@
+#ifndef WARPS_H
+#define WARPS_H
+
+#include <immintrin.h>
+
+#include "types.h"
+#include "vectors.h"
+
+// Closed form maps from a point in [0, 1)^2 onto the shapes paths get sampled over. Each takes exactly the numbers
+// it's given, instead of drawing until one lands inside the shape, so a sampler's dimensions always line up with the
+// same part of the shape and nearby sample points stay nearby after the warp.
+
+// a point in the unit disk, with Shirley and Chiu's concentric mapping, which keeps the square's strata from getting
+// squashed the way a polar mapping does
+static inline v2f warp_concentric_disk(v2f sample);
+
+// a point on the unit sphere
+static inline v3f warp_uniform_sphere(v2f sample);
+
+// a point inside the unit sphere, with radiusSample in [0, 1) picking how far out it is
+static inline v3f warp_uniform_ball(v2f sample, f32 radiusSample);
+
+// a unit direction on the side of normal, more likely the closer it is to normal, as cos(theta)/pi
+static inline v3f warp_cosine_hemisphere(v2f sample, v3f normal);
+
+// a microfacet normal for the GGX distribution with roughness alpha, as D(h)*cos(theta_h)
+static inline v3f warp_ggx_normal(v2f sample, f32 alpha, v3f normal);
+
+// a unit direction inside the cone around axis whose edge is at cosMax from it, evenly over its solid angle
+static inline v3f warp_uniform_cone(v2f sample, f32 cosMax, v3f axis);
+
+// the other two axes of a frame around normal, which has to be unit length
+static inline void make_orthonormal_basis(v3f normal, v3f* outTangent, v3f* outBitangent);
+
+// Batch versions, which warp count samples at once, 8 at a time with AVX2. Samples, normals and results are kept as
+// an array for each component, the way RayPacket keeps its rays, so a register's worth loads straight in.
+void warp_concentric_disk_batch(f32* samples[2], u32 count, f32* outPoints[2]);
+void warp_uniform_sphere_batch(f32* samples[2], u32 count, f32* outDirs[3]);
+void warp_cosine_hemisphere_batch(f32* samples[2], f32* normals[3], u32 count, f32* outDirs[3]);
+void warp_ggx_normal_batch(f32* samples[2], f32 alpha, f32* normals[3], u32 count, f32* outDirs[3]);
+
+#endif //WARPS_H
@@ -0,0 +1,537 @@
+#include "wavefront.h"
+
+static WavefrontPaths alloc_wavefront_paths()
+{
+    WavefrontPaths result = {};
+    result.origins = (v3f*)memory_alloc(WAVEFRONT_MAX_PATHS*sizeof(v3f));
+    result.dirs = (v3f*)memory_alloc(WAVEFRONT_MAX_PATHS*sizeof(v3f));
+    result.times = (f32*)memory_alloc(WAVEFRONT_MAX_PATHS*sizeof(f32));
+    result.throughputs = (v4f*)memory_alloc(WAVEFRONT_MAX_PATHS*sizeof(v4f));
+    result.bouncePdfs = (f32*)memory_alloc(WAVEFRONT_MAX_PATHS*sizeof(f32));
+    result.bounceNormals = (v3f*)memory_alloc(WAVEFRONT_MAX_PATHS*sizeof(v3f));
+    result.pixels = (u32*)memory_alloc(WAVEFRONT_MAX_PATHS*sizeof(u32));
+    result.depths = (u32*)memory_alloc(WAVEFRONT_MAX_PATHS*sizeof(u32));
+    result.samplers = (Sampler*)memory_alloc(WAVEFRONT_MAX_PATHS*sizeof(Sampler));
+    
+    return result;
+}
+
+static void free_wavefront_paths(WavefrontPaths* paths)
+{
+    memory_free(paths->origins);
+    memory_free(paths->dirs);
+    memory_free(paths->times);
+    memory_free(paths->throughputs);
+    memory_free(paths->bouncePdfs);
+    memory_free(paths->bounceNormals);
+    memory_free(paths->pixels);
+    memory_free(paths->depths);
+    memory_free(paths->samplers);
+    *paths = {};
+}
+
+static inline void append_path(WavefrontPaths* paths, Ray ray, f32 time, v4f throughput, f32 bouncePdf, v3f bounceNormal, u32 pixel,
+                               u32 depth, Sampler* sampler)
+{
+    assert(paths->count < WAVEFRONT_MAX_PATHS);
+    
+    u32 index = paths->count++;
+    paths->origins[index] = ray.origin;
+    paths->dirs[index] = ray.dir;
+    paths->times[index] = time;
+    paths->throughputs[index] = throughput;
+    paths->bouncePdfs[index] = bouncePdf;
+    paths->bounceNormals[index] = bounceNormal;
+    paths->pixels[index] = pixel;
+    paths->depths[index] = depth;
+    paths->samplers[index] = *sampler;
+}
+
+static WavefrontShadowRays alloc_wavefront_shadow_rays()
+{
+    WavefrontShadowRays result = {};
+    result.origins = (v3f*)memory_alloc(WAVEFRONT_MAX_PATHS*sizeof(v3f));
+    result.dirs = (v3f*)memory_alloc(WAVEFRONT_MAX_PATHS*sizeof(v3f));
+    result.distances = (f32*)memory_alloc(WAVEFRONT_MAX_PATHS*sizeof(f32));
+    result.times = (f32*)memory_alloc(WAVEFRONT_MAX_PATHS*sizeof(f32));
+    result.lights = (v4f*)memory_alloc(WAVEFRONT_MAX_PATHS*sizeof(v4f));
+    result.pixels = (u32*)memory_alloc(WAVEFRONT_MAX_PATHS*sizeof(u32));
+    
+    return result;
+}
+
+static void free_wavefront_shadow_rays(WavefrontShadowRays* shadowRays)
+{
+    memory_free(shadowRays->origins);
+    memory_free(shadowRays->dirs);
+    memory_free(shadowRays->distances);
+    memory_free(shadowRays->times);
+    memory_free(shadowRays->lights);
+    memory_free(shadowRays->pixels);
+    *shadowRays = {};
+}
+
+// Aims a shadow ray from the path's hit at one of the lights, the same way trace_path does, and queues it up for the
+// shadow stage. Every path draws the light's numbers after its BSDF sample's, the same as the megakernel engine.
+static inline void append_shadow_ray(WavefrontState* state, u32 index, Sampler* sampler)
+{
+    WavefrontPaths* paths = &state->paths;
+    WavefrontShadowRays* shadowRays = &state->shadowRays;
+    
+    Ray shadowRay = Ray(v3f(), v3f());
+    f32 distance = 0.0f;
+    v4f light = v4f();
+    if (!sample_direct_light(-paths->dirs[index], state->hits + index, state->world, state->pathSettings.lightSelection, paths->times[index],
+                             sampler, &shadowRay, &distance, &light))
+        return;
+    
+    assert(shadowRays->count < WAVEFRONT_MAX_PATHS);
+    
+    u32 shadowIndex = shadowRays->count++;
+    shadowRays->origins[shadowIndex] = shadowRay.origin;
+    shadowRays->dirs[shadowIndex] = shadowRay.dir;
+    shadowRays->distances[shadowIndex] = distance;
+    shadowRays->times[shadowIndex] = paths->times[index];
+    shadowRays->lights[shadowIndex] = hadamard(paths->throughputs[index], light);
+    shadowRays->pixels[shadowIndex] = paths->pixels[index];
+}
+
+/*
+* Stages
+*/
+
+// starts a path for each of the block's next camera samples, until the paths are full or there are none left
+static void generate_stage(WavefrontState* state)
+{
+    WavefrontPaths* paths = &state->paths;
+    
+    while (paths->count < WAVEFRONT_MAX_PATHS && state->nextSample < state->sampleCount)
+    {
+        u32 sample = state->nextSample % state->samplesPerPixel;
+        u32 pixel = state->nextSample++/state->samplesPerPixel;
+        u32 pixelX = state->startX + pixel % state->blockWidth;
+        u32 pixelY = state->startY + pixel/state->blockWidth;
+        
+        // NOTE: the numbers are drawn in the same order as the megakernel engine draws them, so both give the same samples
+        Sampler sampler = make_sampler(&state->samplerSettings, pixelX, pixelY, sample);
+        
+        v2f jitter = sample_v2f(&sampler);
+        f32 u = (pixelX + jitter.x)/state->image->width;
+        f32 v = (pixelY - jitter.y)/state->image->height;
+        
+        f32 rayTime = state->world->startTime;
+        if (state->world->endTime > state->world->startTime)
+            rayTime = sample_f32(&sampler, state->world->startTime, state->world->endTime);
+        
+        append_path(paths, state->camera->get_ray(u, v, &sampler), rayTime, Colour::WHITE, 0.0f, v3f(), pixel, 0, &sampler);
+        
+        // NOTE: every sample is opaque, the same as the megakernel's paths, which start from black with an alpha of 1
+        state->pixelSums[pixel] += Colour::BLACK;
+    }
+}
+
+// finds what every path hits, and sorts the paths into the miss queue or the queue for the material they hit
+static void intersect_stage(WavefrontState* state)
+{
+    WavefrontPaths* paths = &state->paths;
+    state->rayCount += paths->count;
+    
+    state->missCount = 0;
+    for (u32 type = 0; type < ARRAY_LENGTH(state->materialCounts); ++type)
+        state->materialCounts[type] = 0;
+    
+    for (u32 i = 0; i < paths->count; ++i)
+    {
+        Ray ray = Ray(paths->origins[i], paths->dirs[i]);
+        
+        SurfaceHit* hit = state->hits + i;
+        *hit = {};
+        hit->t = F32_MAX;
+        
+        intersect_planes(ray, state->world, hit);
+        
+        SphereObject* testObject = 0;
+        Sphere testSphere = Sphere();
+        f32 t = intersection_test(ray, state->bvh, paths->times[i], hit->t, &testObject, &testSphere);
+        add_sphere_hit(ray, t, testObject, testSphere, state->world, hit);
+        
+        if (hit->t == F32_MAX || hit->t <= 0)
+            state->missQueue[state->missCount++] = i;
+        else
+        {
+            u32 type = hit->material->type;
+            state->materialQueues[type][state->materialCounts[type]++] = i;
+        }
+    }
+}
+
+// Bounces every path in the material's queue off of what it hit, and carries on the ones that survive in
+// nextPaths. Each material gets its own copy of the loop with its BSDF built in.
+template <bool (*SampleBSDF)(v3f, SurfaceHit*, Sampler*, BSDFSample*)>
+static void shade_stage(WavefrontState* state, Material::Type type)
+{
+    WavefrontPaths* paths = &state->paths;
+    
+    u32* queue = state->materialQueues[type];
+    u32 queueCount = state->materialCounts[type];
+    
+    for (u32 i = 0; i < queueCount; ++i)
+    {
+        u32 index = queue[i];
+        
+        // NOTE: the last bounce would only be able to add black, so those paths end here
+        u32 depth = paths->depths[index] + 1;
+        if (depth >= state->pathSettings.maxDepth)
+            continue;
+        
+        SurfaceHit* hit = state->hits + index;
+        
+        Sampler* sampler = paths->samplers + index;
+        start_bounce(sampler, depth);
+        
+        BSDFSample bsdfSample = {};
+        bool sampled = SampleBSDF(-paths->dirs[index], hit, sampler, &bsdfSample);
+        
+        if (!state->pathSettings.skipLightSampling && !is_specular(hit->material))
+            append_shadow_ray(state, index, sampler);
+        
+        if (!sampled)
+            continue;
+        
+        v4f throughput = hadamard(paths->throughputs[index], bsdf_weight(&bsdfSample));
+        if (!survives_roulette(&throughput, state->pathSettings.rouletteThreshold, sampler))
+            continue;
+        
+        Ray scatteredRay = Ray(hit->point, bsdfSample.lightDir);
+        f32 bouncePdf = bsdfSample.specular ? 0.0f : bsdfSample.pdf;
+        append_path(&state->nextPaths, scatteredRay, paths->times[index], throughput, bouncePdf, hit->normal, paths->pixels[index], depth,
+                    sampler);
+    }
+}
+
+// The diffuse version of shade_stage. Every path's sample is drawn first and the whole queue is warped into bounce
+// directions as one batch, then the paths carry on the same way as in shade_stage. The directions are cosine
+// weighted, the same as sample_diffuse, so each path's weight is just the colour.
+static void diffuse_stage(WavefrontState* state)
+{
+    WavefrontPaths* paths = &state->paths;
+    
+    u32* queue = state->materialQueues[Material::Type::DIFFUSE];
+    u32 queueCount = state->materialCounts[Material::Type::DIFFUSE];
+    
+    f32* samples[2] = { state->warpScratch, state->warpScratch + WAVEFRONT_MAX_PATHS };
+    f32* normals[3] = { state->warpScratch + 2*WAVEFRONT_MAX_PATHS, state->warpScratch + 3*WAVEFRONT_MAX_PATHS,
+                        state->warpScratch + 4*WAVEFRONT_MAX_PATHS };
+    f32* dirs[3] = { state->warpScratch + 5*WAVEFRONT_MAX_PATHS, state->warpScratch + 6*WAVEFRONT_MAX_PATHS,
+                     state->warpScratch + 7*WAVEFRONT_MAX_PATHS };
+    
+    // NOTE: the paths that bounce are packed back into the front of the queue, in the same order
+    u32 bounceCount = 0;
+    for (u32 i = 0; i < queueCount; ++i)
+    {
+        u32 index = queue[i];
+        
+        u32 depth = paths->depths[index] + 1;
+        if (depth >= state->pathSettings.maxDepth)
+            continue;
+        
+        Sampler* sampler = paths->samplers + index;
+        start_bounce(sampler, depth);
+        
+        // the same numbers sample_diffuse would draw
+        v2f sample = sample_v2f(sampler);
+        samples[0][bounceCount] = sample.x;
+        samples[1][bounceCount] = sample.y;
+        
+        v3f normal = state->hits[index].normal;
+        for (u32 axis = 0; axis < 3; ++axis)
+            normals[axis][bounceCount] = normal.e[axis];
+        
+        if (!state->pathSettings.skipLightSampling)
+            append_shadow_ray(state, index, sampler);
+        
+        queue[bounceCount++] = index;
+    }
+    
+    warp_cosine_hemisphere_batch(samples, normals, bounceCount, dirs);
+    
+    for (u32 i = 0; i < bounceCount; ++i)
+    {
+        u32 index = queue[i];
+        SurfaceHit* hit = state->hits + index;
+        Sampler* sampler = paths->samplers + index;
+        
+        // a direction right along the surface brings no light, and ends the path the same as in sample_diffuse
+        Ray scatteredRay = Ray(hit->point, v3f(dirs[0][i], dirs[1][i], dirs[2][i]));
+        f32 bouncePdf = pdf_diffuse(-paths->dirs[index], scatteredRay.dir, hit);
+        if (bouncePdf <= 0.0f)
+            continue;
+        
+        v4f throughput = hadamard(paths->throughputs[index], hit->material->colour);
+        if (!survives_roulette(&throughput, state->pathSettings.rouletteThreshold, sampler))
+            continue;
+        
+        append_path(&state->nextPaths, scatteredRay, paths->times[index], throughput, bouncePdf, hit->normal, paths->pixels[index],
+                    paths->depths[index] + 1, sampler);
+    }
+}
+
+// Adds the light given off by whatever every path in the emissive queue hit to its pixel. Those paths end there, a
+// light doesn't bounce any.
+static void emission_stage(WavefrontState* state)
+{
+    WavefrontPaths* paths = &state->paths;
+    
+    u32* queue = state->materialQueues[Material::Type::EMISSIVE];
+    u32 queueCount = state->materialCounts[Material::Type::EMISSIVE];
+    
+    for (u32 i = 0; i < queueCount; ++i)
+    {
+        u32 index = queue[i];
+        SurfaceHit* hit = state->hits + index;
+        
+        // the shadow ray from the last surface could have found this light too, so the two share it
+        f32 weight = 1.0f;
+        f32 bouncePdf = paths->bouncePdfs[index];
+        if (!state->pathSettings.skipLightSampling && bouncePdf > 0.0f)
+            weight = mis_weight(bouncePdf, light_pdf(state->world, state->pathSettings.lightSelection, hit->object, paths->origins[index],
+                                                     paths->bounceNormals[index], paths->times[index]));
+        
+        state->pixelSums[paths->pixels[index]] += hadamard(paths->throughputs[index], emitted_light(hit->material))*weight;
+    }
+}
+
+// traces every shadow ray the shading stages queued, and adds the light of the ones that reach their light to their pixel
+static void shadow_stage(WavefrontState* state)
+{
+    WavefrontShadowRays* shadowRays = &state->shadowRays;
+    state->rayCount += shadowRays->count;
+    
+    for (u32 i = 0; i < shadowRays->count; ++i)
+    {
+        Ray ray = Ray(shadowRays->origins[i], shadowRays->dirs[i]);
+        f32 distance = shadowRays->distances[i];
+        
+        if (occluded_by_planes(ray, state->world, distance) || occlusion_test(ray, state->bvh, shadowRays->times[i], distance))
+            continue;
+        
+        state->pixelSums[shadowRays->pixels[i]] += shadowRays->lights[i];
+    }
+    
+    shadowRays->count = 0;
+}
+
+// adds the sky or environment map seen by every path that missed everything to its pixel
+static void accumulate_stage(WavefrontState* state)
+{
+    WavefrontPaths* paths = &state->paths;
+    
+    for (u32 i = 0; i < state->missCount; ++i)
+    {
+        u32 index = state->missQueue[i];
+        
+        v4f skyColour = background_colour(Ray(paths->origins[index], paths->dirs[index]), state->world);
+        
+        // the environment map is a light too, which the shadow ray from the last surface could have found
+        f32 weight = 1.0f;
+        f32 bouncePdf = paths->bouncePdfs[index];
+        if (!state->pathSettings.skipLightSampling && bouncePdf > 0.0f && state->world->environment.pixels)
+            weight = mis_weight(bouncePdf, environment_light_pdf(state->world, paths->dirs[index]));
+        
+        state->pixelSums[paths->pixels[index]] += hadamard(paths->throughputs[index], skyColour)*weight;
+    }
+}
+
+// spreads the bottom 10 bits of x out so there are two zero bits between each of them, for interleaving
+static inline u32 spread_bits(u32 x)
+{
+    x &= 0x3FF;
+    x = (x | (x << 16)) & 0x030000FF;
+    x = (x | (x << 8)) & 0x0300F00F;
+    x = (x | (x << 4)) & 0x030C30C3;
+    x = (x | (x << 2)) & 0x09249249;
+    
+    return x;
+}
+
+// Puts the bounced paths into paths, ordered by the octant of their direction and then the Morton code of their
+// origin. After a diffuse bounce the rays of neighbouring paths point every which way, so traced in the order they
+// were made each one walks a different part of the BVH. In this order rays starting near each other and heading
+// the same way are traced one after another, and find most of the nodes they need still in the cache.
+static void sort_stage(WavefrontState* state)
+{
+    WavefrontPaths* bounced = &state->nextPaths;
+    u32 count = bounced->count;
+    
+    // the origins are placed on a 512^3 grid over the box around all of them
+    v3f originMin = v3f(F32_MAX, F32_MAX, F32_MAX);
+    v3f originMax = v3f(F32_MIN, F32_MIN, F32_MIN);
+    for (u32 i = 0; i < count; ++i)
+    {
+        for (u32 axis = 0; axis < 3; ++axis)
+        {
+            originMin.e[axis] = MIN_VALUE(originMin.e[axis], bounced->origins[i].e[axis]);
+            originMax.e[axis] = MAX_VALUE(originMax.e[axis], bounced->origins[i].e[axis]);
+        }
+    }
+    
+    v3f gridScale = v3f();
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+        f32 extent = originMax.e[axis] - originMin.e[axis];
+        gridScale.e[axis] = extent > 0.0f ? 511.0f/extent : 0.0f;
+    }
+    
+    for (u32 i = 0; i < count; ++i)
+    {
+        v3f dir = bounced->dirs[i];
+        u32 octant = (dir.x < 0.0f ? 1 : 0) | (dir.y < 0.0f ? 2 : 0) | (dir.z < 0.0f ? 4 : 0);
+        
+        u32 morton = 0;
+        for (u32 axis = 0; axis < 3; ++axis)
+        {
+            u32 cell = (u32)((bounced->origins[i].e[axis] - originMin.e[axis])*gridScale.e[axis]);
+            morton |= spread_bits(MIN_VALUE(cell, 511)) << axis;
+        }
+        
+        u64 key = (octant << 27) | morton;
+        state->sortEntries[i] = (key << 32) | i;
+    }
+    
+    // LSD radix sort on the 30 bit keys, a byte at a time
+    u64* entries = state->sortEntries;
+    u64* scratch = state->sortScratch;
+    
+    for (u32 shift = 32; shift < 64; shift += 8)
+    {
+        u32 offsets[256] = {};
+        for (u32 i = 0; i < count; ++i)
+            ++offsets[(entries[i] >> shift) & 0xFF];
+        
+        u32 total = 0;
+        for (u32 digit = 0; digit < 256; ++digit)
+        {
+            u32 digitCount = offsets[digit];
+            offsets[digit] = total;
+            total += digitCount;
+        }
+        
+        for (u32 i = 0; i < count; ++i)
+            scratch[offsets[(entries[i] >> shift) & 0xFF]++] = entries[i];
+        
+        SWAP(entries, scratch, u64*);
+    }
+    
+    // NOTE: an even number of passes leaves the sorted entries back in sortEntries
+    WavefrontPaths* paths = &state->paths;
+    for (u32 i = 0; i < count; ++i)
+    {
+        u32 index = (u32)entries[i];
+        
+        paths->origins[i] = bounced->origins[index];
+        paths->dirs[i] = bounced->dirs[index];
+        paths->times[i] = bounced->times[index];
+        paths->throughputs[i] = bounced->throughputs[index];
+        paths->bouncePdfs[i] = bounced->bouncePdfs[index];
+        paths->bounceNormals[i] = bounced->bounceNormals[index];
+        paths->pixels[i] = bounced->pixels[index];
+        paths->depths[i] = bounced->depths[index];
+        paths->samplers[i] = bounced->samplers[index];
+    }
+    
+    paths->count = count;
+    bounced->count = 0;
+}
+
+u64 render_wavefront_block(Image* image, u32 startX, u32 startY, u32 endX, u32 endY, Camera* camera, World* world, SceneBVH* bvh,
+                           u32 samplesPerPixel, PathSettings* pathSettings, bool sortRays, SamplerSettings* samplerSettings)
+{
+    assert(image && camera && world && bvh && pathSettings);
+    assert(startX < endX && startY < endY);
+    
+    WavefrontState state = {};
+    state.image = image;
+    state.startX = startX;
+    state.startY = startY;
+    state.blockWidth = endX - startX;
+    state.camera = camera;
+    state.world = world;
+    state.bvh = bvh;
+    state.samplesPerPixel = samplesPerPixel;
+    state.pathSettings = *pathSettings;
+    state.sortRays = sortRays;
+    state.samplerSettings = *samplerSettings;
+    
+    u32 pixelCount = (endX - startX)*(endY - startY);
+    state.sampleCount = pixelCount*samplesPerPixel;
+    
+    state.paths = alloc_wavefront_paths();
+    state.nextPaths = alloc_wavefront_paths();
+    state.shadowRays = alloc_wavefront_shadow_rays();
+    state.hits = (SurfaceHit*)memory_alloc(WAVEFRONT_MAX_PATHS*sizeof(SurfaceHit));
+    state.missQueue = (u32*)memory_alloc(WAVEFRONT_MAX_PATHS*sizeof(u32));
+    for (u32 type = 0; type < ARRAY_LENGTH(state.materialQueues); ++type)
+        state.materialQueues[type] = (u32*)memory_alloc(WAVEFRONT_MAX_PATHS*sizeof(u32));
+    state.pixelSums = (v4f*)memory_alloc(pixelCount*sizeof(v4f));
+    state.warpScratch = (f32*)memory_alloc(8*WAVEFRONT_MAX_PATHS*sizeof(f32));
+    
+    if (sortRays)
+    {
+        state.sortEntries = (u64*)memory_alloc(WAVEFRONT_MAX_PATHS*sizeof(u64));
+        state.sortScratch = (u64*)memory_alloc(WAVEFRONT_MAX_PATHS*sizeof(u64));
+    }
+    
+    if (pathSettings->maxDepth > 0)
+        generate_stage(&state);
+    
+    while (state.paths.count > 0)
+    {
+        intersect_stage(&state);
+        
+        emission_stage(&state);
+        diffuse_stage(&state);
+        shade_stage<sample_metal>(&state, Material::Type::METAL);
+        shade_stage<sample_dialectric>(&state, Material::Type::DIALECTRIC);
+        
+        shadow_stage(&state);
+        accumulate_stage(&state);
+        
+        // the bounced paths become the ones being traced, and any room left over goes to new camera samples
+        if (sortRays)
+            sort_stage(&state);
+        else
+        {
+            SWAP(state.paths, state.nextPaths, WavefrontPaths);
+            state.nextPaths.count = 0;
+        }
+        
+        generate_stage(&state);
+    }
+    
+    for (u32 pixel = 0; pixel < pixelCount; ++pixel)
+    {
+        u32 pixelX = startX + pixel % state.blockWidth;
+        u32 pixelY = startY + pixel/state.blockWidth;
+        
+        v4f pixelColour = clamp(state.pixelSums[pixel]/(f32)samplesPerPixel, 0.0f, 1.0f);
+        set_pixel(image, pixelX, pixelY, pixelColour);
+    }
+    
+    free_wavefront_paths(&state.paths);
+    free_wavefront_paths(&state.nextPaths);
+    free_wavefront_shadow_rays(&state.shadowRays);
+    memory_free(state.hits);
+    memory_free(state.missQueue);
+    for (u32 type = 0; type < ARRAY_LENGTH(state.materialQueues); ++type)
+        memory_free(state.materialQueues[type]);
+    memory_free(state.pixelSums);
+    memory_free(state.warpScratch);
+    
+    if (sortRays)
+    {
+        memory_free(state.sortEntries);
+        memory_free(state.sortScratch);
+    }
+    
+    return state.rayCount;
+}
\ No newline at end of file
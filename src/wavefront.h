@@ -0,0 +1,118 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "types.h"
+#include "image.h"
+#include "camera.h"
+#include "shading.h"
+#include "sampler.h"
+#include "warps.h"
+#include "scene_bvh.h"
+
+// the most paths a block has in flight at once, each stage works through up to this many at a time
+#define WAVEFRONT_MAX_PATHS 8192
+
+// The state of a set of paths, with each part kept in its own array so a stage only pulls in what it uses.
+// Paths are packed at the front, so the first count entries are all live.
+struct WavefrontPaths
+{
+    v3f* origins;
+    v3f* dirs;
+    f32* times;
+    
+    // what the light arriving along the ray gets multiplied by on its way back to the camera
+    v4f* throughputs;
+    
+    // the density the last bounce picked the ray with, 0 for camera rays and specular bounces, and the normal it
+    // left from, see trace_path
+    f32* bouncePdfs;
+    v3f* bounceNormals;
+    
+    // index into the block's pixels, and the number of bounces so far
+    u32* pixels;
+    u32* depths;
+    
+    // where each path gets its random numbers, see Sampler
+    Sampler* samplers;
+    
+    u32 count;
+};
+
+// The shadow rays the shading stages aim at the lights, and the light each one brings back to its pixel if nothing
+// is in the way, kept the same way as WavefrontPaths.
+struct WavefrontShadowRays
+{
+    v3f* origins;
+    v3f* dirs;
+    f32* distances;
+    f32* times;
+    v4f* lights;
+    u32* pixels;
+    
+    u32 count;
+};
+
+// Everything the stages hand to each other while tracing a block of pixels. Instead of following one path from
+// the camera to the sky, each stage runs over every path in flight before the next stage starts, so each stage's
+// code and data stay hot in the cache and the material code isn't all branched between for every ray.
+struct WavefrontState
+{
+    // the block of pixels being rendered
+    Image* image;
+    u32 startX;
+    u32 startY;
+    u32 blockWidth;
+    
+    Camera* camera;
+    World* world;
+    SceneBVH* bvh;
+    
+    u32 samplesPerPixel;
+    PathSettings pathSettings;
+    
+    // when set, bounced paths are put in order of direction and origin before they're traced, see sort_stage
+    bool sortRays;
+    
+    SamplerSettings samplerSettings;
+    
+    // the paths being traced, and the paths they bounce into
+    WavefrontPaths paths;
+    WavefrontPaths nextPaths;
+    
+    // what each path in paths hit, filled in by the intersect stage
+    SurfaceHit* hits;
+    
+    // indices into paths, sorted by what happened to them in the intersect stage
+    u32* missQueue;
+    u32 missCount;
+    u32* materialQueues[Material::Type::EMISSIVE + 1];
+    u32 materialCounts[Material::Type::EMISSIVE + 1];
+    
+    // the shadow rays from this round of shading, traced by the shadow stage
+    WavefrontShadowRays shadowRays;
+    
+    // camera samples are handed out in order, every sample of a pixel before the next pixel
+    u32 nextSample;
+    u32 sampleCount;
+    
+    // sort keys in the top 32 bits and path indices in the bottom 32, and room for the radix sort to work in
+    u64* sortEntries;
+    u64* sortScratch;
+    
+    // the sum of every sample's colour for each pixel in the block
+    v4f* pixelSums;
+    
+    // room for the diffuse stage to lay out its samples, normals and bounce directions as arrays of each component
+    f32* warpScratch;
+    
+    // every path and shadow ray traced so far, for reporting rays per second
+    u64 rayCount;
+};
+
+// Renders the pixels from (startX, startY) up to (endX, endY) with the wavefront engine. Gives the same image as
+// tracing every path on its own with cast_ray, just with the work done in a different order. Returns the number of
+// rays traced, shadow rays included.
+u64 render_wavefront_block(Image* image, u32 startX, u32 startY, u32 endX, u32 endY, Camera* camera, World* world, SceneBVH* bvh,
+                           u32 samplesPerPixel, PathSettings* pathSettings, bool sortRays, SamplerSettings* samplerSettings);
+
+#endif //WAVEFRONT_H
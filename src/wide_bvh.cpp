@@ -0,0 +1,492 @@
+#include "wide_bvh.h"
+
+/*
+* Collapsing
+*/
+
+template <u32 Width>
+static u32 collapse_bvh_node(BVHNode* node, WideBVH<Width>* wideBVH)
+{
+    u32 nodeIndex = wideBVH->nodeCount++;
+    
+    BVHNode* children[Width];
+    u32 childCount = 0;
+    
+    if (!node->left)
+    {
+        // only happens when the whole tree is a single leaf
+        children[childCount++] = node;
+    }
+    else
+    {
+        children[childCount++] = node->left;
+        children[childCount++] = node->right;
+    }
+    
+    // keep pulling up the grandchildren of the largest interior child until the node is full, since the
+    // largest boxes are the ones most rays will have to test anyway
+    while (childCount < Width)
+    {
+        u32 largestIndex = Width;
+        f32 largestArea = -1.0f;
+        
+        for (u32 i = 0; i < childCount; ++i)
+        {
+            if (children[i]->left && surface_area(children[i]->boundingBox) > largestArea)
+            {
+                largestIndex = i;
+                largestArea = surface_area(children[i]->boundingBox);
+            }
+        }
+        
+        if (largestIndex == Width)
+            break;
+        
+        BVHNode* opened = children[largestIndex];
+        children[largestIndex] = opened->left;
+        children[childCount++] = opened->right;
+    }
+    
+    for (u32 i = 0; i < Width; ++i)
+    {
+        WideBVHNode<Width>* wideNode = wideBVH->nodes + nodeIndex;
+        
+        if (i < childCount)
+        {
+            Rect3f box = children[i]->boundingBox;
+            wideNode->bounds[0][i] = box.left();
+            wideNode->bounds[1][i] = box.bottom();
+            wideNode->bounds[2][i] = box.back();
+            wideNode->bounds[3][i] = box.right();
+            wideNode->bounds[4][i] = box.top();
+            wideNode->bounds[5][i] = box.front();
+            
+            if (!children[i]->left)
+            {
+                wideNode->child[i] = children[i]->firstObject;
+                wideNode->objectCount[i] = children[i]->objectCount;
+            }
+            else
+            {
+                // NOTE: collapsing the child adds nodes to the array, but it never moves, so wideNode stays valid
+                u32 childIndex = collapse_bvh_node(children[i], wideBVH);
+                wideNode->child[i] = childIndex;
+                wideNode->objectCount[i] = 0;
+            }
+        }
+        else
+        {
+            // an inside-out box that no ray can ever hit
+            for (u32 axis = 0; axis < 3; ++axis)
+            {
+                wideNode->bounds[axis][i] = F32_MAX;
+                wideNode->bounds[axis + 3][i] = F32_MIN;
+            }
+            
+            wideNode->child[i] = WIDE_BVH_EMPTY_CHILD;
+            wideNode->objectCount[i] = 0;
+        }
+    }
+    
+    return nodeIndex;
+}
+
+template <u32 Width>
+WideBVH<Width> collapse_bvh(BVH* bvh)
+{
+    assert(bvh && bvh->root);
+    
+    WideBVH<Width> result = {};
+    result.objects = bvh->objects;
+    result.objectCount = bvh->objectCount;
+    
+    // every wide node takes at least one interior node of the binary tree with it
+    u32 maxNodeCount = MAX_VALUE((bvh->nodeCount - 1)/2, 1);
+    result.nodes = (WideBVHNode<Width>*)memory_alloc(maxNodeCount*sizeof(WideBVHNode<Width>));
+    
+    collapse_bvh_node(bvh->root, &result);
+    assert(result.nodeCount <= maxNodeCount);
+    
+    result.objectIndices = (u32*)memory_alloc(bvh->objectCount*sizeof(u32));
+    for (u32 i = 0; i < bvh->objectCount; ++i)
+        result.objectIndices[i] = bvh->objectIndices[i];
+    
+    result.spheres = copy_leaf_spheres(bvh->objects, bvh->objectIndices, bvh->objectCount);
+    
+    return result;
+}
+
+template <u32 Width>
+void free_wide_bvh(WideBVH<Width>* bvh)
+{
+    memory_free(bvh->nodes);
+    memory_free(bvh->objectIndices);
+    free_sphere_arrays(&bvh->spheres);
+    *bvh = {};
+}
+
+/*
+* Traversal
+*/
+
+static WideRay make_wide_ray(Ray ray)
+{
+    WideRay result = {};
+    result.origin = ray.origin;
+    result.inverseDir = v3f(1.0f/ray.dir.x, 1.0f/ray.dir.y, 1.0f/ray.dir.z);
+    
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+        bool negative = ray.dir.e[axis] < 0.0f;
+        result.nearPlane[axis] = negative ? axis + 3 : axis;
+        result.farPlane[axis] = negative ? axis : axis + 3;
+    }
+    
+    return result;
+}
+
+// Slab tests every child of a node against the interval [0, tMax]. Returns a bit mask of the children
+// that were hit and fills outTEntry with the distance each child's box is entered at.
+template <u32 Width>
+static inline u32 hit_test_children(WideBVHNode<Width>* node, WideRay* ray, f32 tMax, f32* outTEntry)
+{
+    u32 result = 0;
+    
+    for (u32 i = 0; i < Width; ++i)
+    {
+        f32 tNear = 0.0f;
+        f32 tFar = tMax;
+        
+        for (u32 axis = 0; axis < 3; ++axis)
+        {
+            tNear = MAX_VALUE(tNear, (node->bounds[ray->nearPlane[axis]][i] - ray->origin.e[axis])*ray->inverseDir.e[axis]);
+            tFar = MIN_VALUE(tFar, (node->bounds[ray->farPlane[axis]][i] - ray->origin.e[axis])*ray->inverseDir.e[axis]);
+        }
+        
+        outTEntry[i] = tNear;
+        if (tNear <= tFar)
+            result |= 1 << i;
+    }
+    
+    return result;
+}
+
+template <>
+inline u32 hit_test_children<4>(WideBVHNode<4>* node, WideRay* ray, f32 tMax, f32* outTEntry)
+{
+    __m128 tNear = _mm_setzero_ps();
+    __m128 tFar = _mm_set1_ps(tMax);
+    
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+        __m128 origin = _mm_set1_ps(ray->origin.e[axis]);
+        __m128 inverseDir = _mm_set1_ps(ray->inverseDir.e[axis]);
+        
+        __m128 nearPlane = _mm_load_ps(node->bounds[ray->nearPlane[axis]]);
+        __m128 farPlane = _mm_load_ps(node->bounds[ray->farPlane[axis]]);
+        
+        tNear = _mm_max_ps(tNear, _mm_mul_ps(_mm_sub_ps(nearPlane, origin), inverseDir));
+        tFar = _mm_min_ps(tFar, _mm_mul_ps(_mm_sub_ps(farPlane, origin), inverseDir));
+    }
+    
+    _mm_storeu_ps(outTEntry, tNear);
+    return (u32)_mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
+}
+
+#ifdef __AVX__
+template <>
+inline u32 hit_test_children<8>(WideBVHNode<8>* node, WideRay* ray, f32 tMax, f32* outTEntry)
+{
+    __m256 tNear = _mm256_setzero_ps();
+    __m256 tFar = _mm256_set1_ps(tMax);
+    
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+        __m256 origin = _mm256_set1_ps(ray->origin.e[axis]);
+        __m256 inverseDir = _mm256_set1_ps(ray->inverseDir.e[axis]);
+        
+        __m256 nearPlane = _mm256_load_ps(node->bounds[ray->nearPlane[axis]]);
+        __m256 farPlane = _mm256_load_ps(node->bounds[ray->farPlane[axis]]);
+        
+        tNear = _mm256_max_ps(tNear, _mm256_mul_ps(_mm256_sub_ps(nearPlane, origin), inverseDir));
+        tFar = _mm256_min_ps(tFar, _mm256_mul_ps(_mm256_sub_ps(farPlane, origin), inverseDir));
+    }
+    
+    _mm256_storeu_ps(outTEntry, tNear);
+    return (u32)_mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ));
+}
+#endif
+
+template <u32 Width>
+static f32 intersection_test(Ray ray, WideBVH<Width>* bvh, f32 time, f32 tMax, SphereObject** outObject)
+{
+    struct StackEntry
+    {
+        u32 index;
+        u32 objectCount; // 0 for interior nodes
+        f32 tEntry;
+    };
+    
+    // every node visited on the way down can leave all but one of its children on the stack
+    StackEntry stack[BVH_MAX_STACK_SIZE*(Width - 1) + 1];
+    u32 stackSize = 0;
+    
+    f32 tClosest = tMax;
+    WideRay wideRay = make_wide_ray(ray);
+    
+    COUNT_TRAVERSAL_RAY();
+    
+    stack[stackSize++] = {0, 0, 0.0f};
+    
+    while (stackSize > 0)
+    {
+        StackEntry entry = stack[--stackSize];
+        
+        // something closer was found after this entry was pushed
+        if (entry.tEntry >= tClosest)
+            continue;
+        
+        if (entry.objectCount > 0)
+        {
+            intersect_leaf(ray, bvh->objects, bvh->objectIndices, &bvh->spheres, entry.index, entry.objectCount, time, &tClosest, outObject);
+            continue;
+        }
+        
+        WideBVHNode<Width>* node = bvh->nodes + entry.index;
+        COUNT_NODE_VISIT(node);
+        
+        f32 tEntries[Width];
+        u32 hitMask = hit_test_children<Width>(node, &wideRay, tClosest, tEntries);
+        
+        // push the hit children from farthest to nearest, so the nearest one is visited next
+        u32 firstPushed = stackSize;
+        for (u32 i = 0; i < Width; ++i)
+        {
+            if (!(hitMask & (1 << i)))
+                continue;
+            
+            StackEntry child = {node->child[i], node->objectCount[i], tEntries[i]};
+            
+            u32 insertIndex = stackSize++;
+            while (insertIndex > firstPushed && stack[insertIndex - 1].tEntry < child.tEntry)
+            {
+                stack[insertIndex] = stack[insertIndex - 1];
+                --insertIndex;
+            }
+            
+            stack[insertIndex] = child;
+        }
+        
+        assert(stackSize <= ARRAY_LENGTH(stack));
+    }
+    
+    return tClosest < tMax ? tClosest : F32_MAX;
+}
+
+template <u32 Width>
+static bool occlusion_test(Ray ray, WideBVH<Width>* bvh, f32 time, f32 tMax)
+{
+    struct StackEntry
+    {
+        u32 index;
+        u32 objectCount; // 0 for interior nodes
+    };
+    
+    StackEntry stack[BVH_MAX_STACK_SIZE*(Width - 1) + 1];
+    u32 stackSize = 0;
+    
+    WideRay wideRay = make_wide_ray(ray);
+    
+    COUNT_TRAVERSAL_RAY();
+    
+    stack[stackSize++] = {0, 0};
+    
+    while (stackSize > 0)
+    {
+        StackEntry entry = stack[--stackSize];
+        
+        if (entry.objectCount > 0)
+        {
+            if (occluded_leaf(ray, bvh->objects, bvh->objectIndices, &bvh->spheres, entry.index, entry.objectCount, time, tMax))
+                return true;
+            
+            continue;
+        }
+        
+        WideBVHNode<Width>* node = bvh->nodes + entry.index;
+        COUNT_NODE_VISIT(node);
+        
+        f32 tEntries[Width];
+        u32 hitMask = hit_test_children<Width>(node, &wideRay, tMax, tEntries);
+        
+        // NOTE: any hit will do, so the children go on the stack in whatever order they're stored
+        for (u32 i = 0; i < Width; ++i)
+        {
+            if (hitMask & (1 << i))
+                stack[stackSize++] = {node->child[i], node->objectCount[i]};
+        }
+        
+        assert(stackSize <= ARRAY_LENGTH(stack));
+    }
+    
+    return false;
+}
+
+/*
+* Packet Traversal
+*/
+
+// Returns a mask of the children that at least one ray of the packet might hit before tMax. The packet's ranges
+// give the lowest any ray's entry along an axis can be and the highest any ray's exit can be, so a child whose
+// entry bound is past its exit bound is missed by every ray. Only valid for packets whose directions share signs.
+template <u32 Width>
+static inline u32 cull_packet_children(WideBVHNode<Width>* node, RayPacket* packet, f32 tMax)
+{
+    u32 result = 0;
+    
+    for (u32 i = 0; i < Width; ++i)
+    {
+        f32 tNear = 0.0f;
+        f32 tFar = tMax;
+        
+        for (u32 axis = 0; axis < 3; ++axis)
+        {
+            f32 near0 = (node->bounds[packet->nearPlane[axis]][i] - packet->originMax.e[axis]);
+            f32 near1 = (node->bounds[packet->nearPlane[axis]][i] - packet->originMin.e[axis]);
+            f32 far0 = (node->bounds[packet->farPlane[axis]][i] - packet->originMax.e[axis]);
+            f32 far1 = (node->bounds[packet->farPlane[axis]][i] - packet->originMin.e[axis]);
+            
+            f32 invMin = packet->inverseDirMin.e[axis];
+            f32 invMax = packet->inverseDirMax.e[axis];
+            
+            tNear = MAX_VALUE(tNear, MIN_VALUE(MIN_VALUE(near0*invMin, near0*invMax), MIN_VALUE(near1*invMin, near1*invMax)));
+            tFar = MIN_VALUE(tFar, MAX_VALUE(MAX_VALUE(far0*invMin, far0*invMax), MAX_VALUE(far1*invMin, far1*invMax)));
+        }
+        
+        if (tNear <= tFar)
+            result |= 1 << i;
+    }
+    
+    return result;
+}
+
+#ifdef __AVX__
+template <>
+inline u32 cull_packet_children<8>(WideBVHNode<8>* node, RayPacket* packet, f32 tMax)
+{
+    __m256 tNear = _mm256_setzero_ps();
+    __m256 tFar = _mm256_set1_ps(tMax);
+    
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+        __m256 originMin = _mm256_set1_ps(packet->originMin.e[axis]);
+        __m256 originMax = _mm256_set1_ps(packet->originMax.e[axis]);
+        __m256 invMin = _mm256_set1_ps(packet->inverseDirMin.e[axis]);
+        __m256 invMax = _mm256_set1_ps(packet->inverseDirMax.e[axis]);
+        
+        __m256 nearPlane = _mm256_load_ps(node->bounds[packet->nearPlane[axis]]);
+        __m256 farPlane = _mm256_load_ps(node->bounds[packet->farPlane[axis]]);
+        
+        __m256 near0 = _mm256_sub_ps(nearPlane, originMax);
+        __m256 near1 = _mm256_sub_ps(nearPlane, originMin);
+        __m256 far0 = _mm256_sub_ps(farPlane, originMax);
+        __m256 far1 = _mm256_sub_ps(farPlane, originMin);
+        
+        __m256 nearBound = _mm256_min_ps(_mm256_min_ps(_mm256_mul_ps(near0, invMin), _mm256_mul_ps(near0, invMax)),
+                                         _mm256_min_ps(_mm256_mul_ps(near1, invMin), _mm256_mul_ps(near1, invMax)));
+        __m256 farBound = _mm256_max_ps(_mm256_max_ps(_mm256_mul_ps(far0, invMin), _mm256_mul_ps(far0, invMax)),
+                                        _mm256_max_ps(_mm256_mul_ps(far1, invMin), _mm256_mul_ps(far1, invMax)));
+        
+        tNear = _mm256_max_ps(tNear, nearBound);
+        tFar = _mm256_min_ps(tFar, farBound);
+    }
+    
+    return (u32)_mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ));
+}
+#endif
+
+template <u32 Width>
+static void intersection_test(RayPacket* packet, WideBVH<Width>* bvh, f32* tClosest, SphereObject** outObjects)
+{
+    struct StackEntry
+    {
+        u32 index;
+        u32 objectCount; // 0 for interior nodes
+        u32 rayMask; // the rays that entered the box
+        f32 tEntry; // the nearest entry of any of those rays
+    };
+    
+    StackEntry stack[BVH_MAX_STACK_SIZE*(Width - 1) + 1];
+    u32 stackSize = 0;
+    
+    // NOTE: the whole packet shares each node and sphere it reads, so those are counted once per packet, not per ray
+    COUNT_TRAVERSAL_RAYS(RAY_PACKET_SIZE);
+    
+    stack[stackSize++] = {0, 0, RAY_PACKET_ALL_RAYS, 0.0f};
+    
+    while (stackSize > 0)
+    {
+        StackEntry entry = stack[--stackSize];
+        
+        // every ray that entered this box has found something closer since it was pushed
+        f32 tMax = packet_max_t(tClosest, entry.rayMask);
+        if (entry.tEntry >= tMax)
+            continue;
+        
+        if (entry.objectCount > 0)
+        {
+            for (u32 i = 0; i < entry.objectCount; ++i)
+            {
+                SphereObject* object = bvh->objects + bvh->objectIndices[entry.index + i];
+                COUNT_OBJECT_TEST(object);
+                
+                u32 hitMask = intersect_sphere(packet, object, tClosest, entry.rayMask);
+                for (u32 lane = 0; lane < RAY_PACKET_SIZE; ++lane)
+                {
+                    if (hitMask & (1 << lane))
+                        outObjects[lane] = object;
+                }
+            }
+            
+            continue;
+        }
+        
+        WideBVHNode<Width>* node = bvh->nodes + entry.index;
+        COUNT_NODE_VISIT(node);
+        
+        // NOTE: the whole packet is rejected from most children with one test, only children that survive it get
+        // tested against each ray
+        u32 childMask = (1 << Width) - 1;
+        if (packet->sameSigns)
+            childMask = cull_packet_children<Width>(node, packet, tMax);
+        
+        u32 firstPushed = stackSize;
+        for (u32 i = 0; i < Width; ++i)
+        {
+            if (!(childMask & (1 << i)) || node->child[i] == WIDE_BVH_EMPTY_CHILD)
+                continue;
+            
+            v3f boundsMin = v3f(node->bounds[0][i], node->bounds[1][i], node->bounds[2][i]);
+            v3f boundsMax = v3f(node->bounds[3][i], node->bounds[4][i], node->bounds[5][i]);
+            
+            f32 tEntry = 0.0f;
+            u32 rayMask = hit_test_box(packet, boundsMin, boundsMax, tClosest, entry.rayMask, &tEntry);
+            if (!rayMask)
+                continue;
+            
+            StackEntry child = {node->child[i], node->objectCount[i], rayMask, tEntry};
+            
+            // push the hit children from farthest to nearest, so the nearest one is visited next
+            u32 insertIndex = stackSize++;
+            while (insertIndex > firstPushed && stack[insertIndex - 1].tEntry < child.tEntry)
+            {
+                stack[insertIndex] = stack[insertIndex - 1];
+                --insertIndex;
+            }
+            
+            stack[insertIndex] = child;
+        }
+        
+        assert(stackSize <= ARRAY_LENGTH(stack));
+    }
+}
\ No newline at end of file
@@ -0,0 +1,66 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include <immintrin.h>
+
+#include "types.h"
+#include "bvh.h"
+#include "ray_packet.h"
+
+// marks an unused child slot in a node that has fewer children than the width
+#define WIDE_BVH_EMPTY_CHILD 0xFFFFFFFF
+
+// A node with up to Width children, whose boxes are stored as separate arrays for each plane so
+// that all of them can be slab tested at once. bounds[0..2] hold the minimum x/y/z of each child and
+// bounds[3..5] the maximum. A 4-wide node is two cache lines and an 8-wide node is four.
+template <u32 Width>
+struct alignas(64) WideBVHNode
+{
+    f32 bounds[6][Width];
+    
+    // interior children hold an index into WideBVH::nodes, leaf children an index into WideBVH::objectIndices
+    u32 child[Width];
+    
+    // 0 for interior children
+    u32 objectCount[Width];
+};
+
+// a BVH collapsed from a binary one, so each node tests several boxes with a single set of SIMD instructions
+template <u32 Width>
+struct WideBVH
+{
+    WideBVHNode<Width>* nodes;
+    u32 nodeCount;
+    
+    SphereObject* objects;
+    u32* objectIndices;
+    u32 objectCount;
+    
+    // the objects' spheres in the same order as objectIndices, see LinearBVH
+    SphereArrays spheres;
+};
+
+// everything about a ray that the box tests need, worked out once per ray instead of at every node
+struct WideRay
+{
+    v3f origin;
+    v3f inverseDir;
+    
+    // which bounds array holds the near and far plane along each axis, based on the direction's sign
+    u32 nearPlane[3];
+    u32 farPlane[3];
+};
+
+template <u32 Width> WideBVH<Width> collapse_bvh(BVH* bvh);
+template <u32 Width> void free_wide_bvh(WideBVH<Width>* bvh);
+
+template <u32 Width> static f32 intersection_test(Ray ray, WideBVH<Width>* bvh, f32 time, f32 tMax, SphereObject** outObject);
+
+// returns true if the ray hits any object before tMax, stopping at the first one it finds
+template <u32 Width> static bool occlusion_test(Ray ray, WideBVH<Width>* bvh, f32 time, f32 tMax);
+
+// Traces all the rays of the packet together. tClosest holds each ray's tMax going in, and is moved up to the
+// closest hit of any ray that hits something, with outObjects set to what it hit. Other rays are left alone.
+template <u32 Width> static void intersection_test(RayPacket* packet, WideBVH<Width>* bvh, f32* tClosest, SphereObject** outObjects);
+
+#endif //WIDE_BVH_H